@@ -0,0 +1,164 @@
+#include "arena.h"
+#include "stats.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <gmp.h>
+
+#define ARENA_MIN_SHIFT 4 // SMALLEST CLASS, 16 BYTES
+#define ARENA_MAX_SHIFT 20 // LARGEST CLASS, 1 MiB; BIGGER BLOCKS GO TO MALLOC
+#define ARENA_CLASSES   (ARENA_MAX_SHIFT - ARENA_MIN_SHIFT + 1)
+#define ARENA_CACHE     64 // BLOCKS A THREAD HOLDS PER CLASS BEFORE HANDING HALF BACK
+
+// FREE BLOCK, LINKED THROUGH ITS OWN FIRST WORD
+typedef struct block {
+    struct block *next;
+} block_t;
+
+// PER-THREAD CACHE OF FREE BLOCKS
+typedef struct {
+    block_t *head[ARENA_CLASSES];
+    uint64_t count[ARENA_CLASSES];
+    bool attached;
+} cache_t;
+
+static _Thread_local cache_t cache;
+static block_t *depot[ARENA_CLASSES]; // BLOCKS SHARED BETWEEN THREADS
+static pthread_mutex_t depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+// SIZE CLASS
+// @param size : Bytes wanted, at most 2^ARENA_MAX_SHIFT
+// Class c holds blocks of 2^(c + ARENA_MIN_SHIFT) bytes.
+static int size_class(size_t size) {
+    if (size <= (1u << ARENA_MIN_SHIFT)) {
+        return 0;
+    }
+    return 64 - __builtin_clzll(size - 1) - ARENA_MIN_SHIFT;
+}
+
+// HAND COUNT BLOCKS OF CLASS c FROM THE CACHE TO THE DEPOT
+static void cache_flush(cache_t *ca, int c, uint64_t count) {
+    pthread_mutex_lock(&depot_lock);
+    for (uint64_t i = 0; i < count && ca->head[c] != NULL; i += 1) {
+        block_t *b = ca->head[c];
+        ca->head[c] = b->next;
+        ca->count[c] -= 1;
+        b->next = depot[c];
+        depot[c] = b;
+    }
+    pthread_mutex_unlock(&depot_lock);
+}
+
+// THREAD EXIT
+// Blocks cached by a finished thread go back to the depot for the others.
+static void cache_release(void *arg) {
+    cache_t *ca = (cache_t *) arg;
+    for (int c = 0; c < ARENA_CLASSES; c += 1) {
+        cache_flush(ca, c, ca->count[c]);
+    }
+}
+
+static void key_init(void) {
+    pthread_key_create(&cache_key, cache_release);
+}
+
+// REGISTER THIS THREAD'S CACHE FOR cache_release ON FIRST USE
+static void cache_attach(void) {
+    if (!cache.attached) {
+        pthread_once(&key_once, key_init);
+        pthread_setspecific(cache_key, &cache);
+        cache.attached = true;
+    }
+}
+
+// ALLOCATE
+// @param size : Bytes wanted
+// Serves the block from this thread's cache, then from the depot, and only
+// then from malloc. Blocks are never returned to the system, so once a
+// workload has seen its largest working set every request is a list pop.
+void *arena_alloc(size_t size) {
+    STAT_ADD(STAT_ARENA_ALLOCS, 1);
+    if (size > (1u << ARENA_MAX_SHIFT)) {
+        STAT_ADD(STAT_MALLOCS, 1);
+        return malloc(size);
+    }
+    int c = size_class(size);
+    cache_attach();
+    if (cache.head[c] == NULL) {
+        // REFILL HALF A CACHE AT A TIME TO KEEP THE LOCK OFF THE FAST PATH
+        pthread_mutex_lock(&depot_lock);
+        for (uint64_t i = 0; i < ARENA_CACHE / 2 && depot[c] != NULL; i += 1) {
+            block_t *b = depot[c];
+            depot[c] = b->next;
+            b->next = cache.head[c];
+            cache.head[c] = b;
+            cache.count[c] += 1;
+        }
+        pthread_mutex_unlock(&depot_lock);
+    }
+    block_t *b = cache.head[c];
+    if (b == NULL) {
+        STAT_ADD(STAT_MALLOCS, 1);
+        return malloc((size_t) 1 << (c + ARENA_MIN_SHIFT));
+    }
+    cache.head[c] = b->next;
+    cache.count[c] -= 1;
+    return b;
+}
+
+// FREE
+// @param p : Block from arena_alloc or arena_realloc
+// @param size : The size it was asked for with
+void arena_free(void *p, size_t size) {
+    if (p == NULL) {
+        return;
+    }
+    if (size > (1u << ARENA_MAX_SHIFT)) {
+        free(p);
+        return;
+    }
+    int c = size_class(size);
+    cache_attach();
+    block_t *b = (block_t *) p;
+    b->next = cache.head[c];
+    cache.head[c] = b;
+    cache.count[c] += 1;
+    if (cache.count[c] > ARENA_CACHE) {
+        cache_flush(&cache, c, ARENA_CACHE / 2);
+    }
+}
+
+// REALLOCATE
+// @param p : Block from arena_alloc
+// @param old : Size it was asked for with
+// @param size : New size
+// Growing within the class keeps the block in place.
+void *arena_realloc(void *p, size_t old, size_t size) {
+    if (p != NULL && old <= (1u << ARENA_MAX_SHIFT) && size <= (1u << ARENA_MAX_SHIFT)
+        && size_class(old) == size_class(size)) {
+        return p;
+    }
+    if (p != NULL && old > (1u << ARENA_MAX_SHIFT) && size > (1u << ARENA_MAX_SHIFT)) {
+        STAT_ADD(STAT_ARENA_ALLOCS, 1);
+        STAT_ADD(STAT_MALLOCS, 1);
+        return realloc(p, size);
+    }
+    void *q = arena_alloc(size);
+    if (p != NULL) {
+        memcpy(q, p, old < size ? old : size);
+        arena_free(p, old);
+    }
+    return q;
+}
+
+// INSTALL AS GMP'S ALLOCATOR
+// Must run before the first mpz variable is initialized, since GMP frees
+// every block with the functions current at the time.
+void arena_install(void) {
+    mp_set_memory_functions(arena_alloc, arena_realloc, arena_free);
+}
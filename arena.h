@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+void *arena_alloc(size_t size);
+
+void *arena_realloc(void *p, size_t old, size_t size);
+
+void arena_free(void *p, size_t size);
+
+void arena_install(void);
@@ -0,0 +1,201 @@
+#include "rsa.h"
+#include "batchgcd.h"
+#include "keystore.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPTIONS "hvt:m:d:f:k:"
+
+void help(char *exec) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "   Finds public keys whose moduli share a prime factor.\n\n"
+        "USAGE\n"
+        "   %s [-hv] [-t threads] [-m megabytes] [-d dir] [-f list] [-k store] [pbfile...]\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -v              Display verbose program output.\n"
+        "   -t threads      Work on each tree level with threads workers (default: 0).\n"
+        "   -m megabytes    Tree levels and remainders kept in memory before spilling\n"
+        "                   levels to disk; one level and two levels of remainders\n"
+        "                   always stay (default: 0, no limit).\n"
+        "   -d dir          Directory for spilled levels (default: system temp directory).\n"
+        "   -f list         File naming one public key file per line.\n"
+        "   -k store        Audit every key in a keystore.\n"
+        "   pbfile          Public key files to audit.\n"
+        "Exits with failure when any modulus shares a factor.\n",
+        exec);
+}
+
+// KEYS BEING AUDITED
+typedef struct {
+    mpz_t *n;
+    char **names;
+    uint64_t count, cap;
+} keys_t;
+
+static void keys_add(keys_t *keys, const mpz_t n, const char *name) {
+    if (keys->count == keys->cap) {
+        keys->cap = keys->cap == 0 ? 1024 : 2 * keys->cap;
+        keys->n = (mpz_t *) realloc(keys->n, keys->cap * sizeof(mpz_t));
+        keys->names = (char **) realloc(keys->names, keys->cap * sizeof(char *));
+    }
+    mpz_init_set(keys->n[keys->count], n);
+    keys->names[keys->count] = strdup(name);
+    keys->count += 1;
+}
+
+// READ ONE PUBLIC KEY FILE
+static bool add_pub(keys_t *keys, const char *path) {
+    FILE *pbfile = fopen(path, "r");
+    if (pbfile == NULL) {
+        fprintf(stderr, "Could not open %s.\n", path);
+        return false;
+    }
+    char username[4096];
+    mpz_t n, e, s;
+    mpz_inits(n, e, s, NULL);
+    rsa_read_pub(n, e, s, username, pbfile);
+    fclose(pbfile);
+    bool ok = mpz_cmp_ui(n, 1) > 0;
+    if (ok) {
+        keys_add(keys, n, path);
+    } else {
+        fprintf(stderr, "No modulus in %s.\n", path);
+    }
+    mpz_clears(n, e, s, NULL);
+    return ok;
+}
+
+// READ A LIST OF PUBLIC KEY FILES
+static bool add_list(keys_t *keys, const char *path) {
+    FILE *list = fopen(path, "r");
+    if (list == NULL) {
+        fprintf(stderr, "Could not open %s.\n", path);
+        return false;
+    }
+    char line[4096];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), list) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0') {
+            ok = add_pub(keys, line);
+        }
+    }
+    fclose(list);
+    return ok;
+}
+
+// READ EVERY KEY OF A KEYSTORE
+static bool add_store(keys_t *keys, const char *path) {
+    keystore_t ks;
+    if (!keystore_open(&ks, path)) {
+        fprintf(stderr, "Could not open keystore %s.\n", path);
+        return false;
+    }
+    char user[KEYSTORE_USER];
+    mpz_t n, e, s;
+    mpz_inits(n, e, s, NULL);
+    for (uint64_t rec = 0; rec < ks.count; rec += 1) {
+        keystore_pub(&ks, rec, n, e, s, user);
+        keys_add(keys, n, user);
+    }
+    mpz_clears(n, e, s, NULL);
+    keystore_close(&ks);
+    return true;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    bool verbose = false;
+    bool ok = true;
+    keys_t keys = { NULL, NULL, 0, 0 };
+    batch_gcd_opts_t opts;
+    batch_gcd_opts_init(&opts);
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 't': opts.threads = atoi(optarg); break;
+        case 'm': opts.budget = strtoull(optarg, NULL, 10) << 20; break;
+        case 'd': opts.dir = optarg; break;
+        case 'f': ok = ok && add_list(&keys, optarg); break;
+        case 'k': ok = ok && add_store(&keys, optarg); break;
+        case 'v': verbose = true; break;
+        case 'h': {
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+        }
+    }
+    for (int i = optind; ok && i < argc; i += 1) {
+        ok = add_pub(&keys, argv[i]);
+    }
+    if (!ok || keys.count == 0) {
+        if (ok) {
+            help(argv[0]);
+        }
+        return EXIT_FAILURE;
+    }
+
+    // Product and remainder trees over every modulus
+    opts.verbose = verbose;
+    mpz_t *g = (mpz_t *) malloc(keys.count * sizeof(mpz_t));
+    for (uint64_t i = 0; i < keys.count; i += 1) {
+        mpz_init(g[i]);
+    }
+    double start = now();
+    if (!batch_gcd(g, keys.n, keys.count, &opts)) {
+        fprintf(stderr, "Could not spill the product tree to disk.\n");
+        return EXIT_FAILURE;
+    }
+    double took = now() - start;
+
+    // Pair up the weak moduli, which are few, with plain gcds
+    uint64_t *weak = (uint64_t *) malloc(keys.count * sizeof(uint64_t));
+    uint64_t nweak = 0;
+    for (uint64_t i = 0; i < keys.count; i += 1) {
+        if (mpz_cmp_ui(g[i], 1) != 0) {
+            weak[nweak++] = i;
+        }
+    }
+    mpz_t d;
+    mpz_init(d);
+    for (uint64_t a = 0; a < nweak; a += 1) {
+        for (uint64_t b = a + 1; b < nweak; b += 1) {
+            mpz_t *na = &keys.n[weak[a]], *nb = &keys.n[weak[b]];
+            mpz_gcd(d, *na, *nb);
+            if (mpz_cmp(*na, *nb) == 0) {
+                printf("%s and %s have the same modulus\n", keys.names[weak[a]], keys.names[weak[b]]);
+            } else if (mpz_cmp_ui(d, 1) != 0) {
+                gmp_printf("%s and %s share a %lu-bit factor %Zx\n", keys.names[weak[a]],
+                    keys.names[weak[b]], mpz_sizeinbase(d, 2), d);
+            }
+        }
+    }
+
+    // If verbose
+    if (verbose) {
+        fprintf(stderr, "%lu moduli, %lu share a factor, batch gcd took %.3f s\n", keys.count,
+            nweak, took);
+    }
+
+    // Clear any mpz_t variables used
+    mpz_clear(d);
+    for (uint64_t i = 0; i < keys.count; i += 1) {
+        mpz_clears(g[i], keys.n[i], NULL);
+        free(keys.names[i]);
+    }
+    free(g);
+    free(weak);
+    free(keys.n);
+    free(keys.names);
+    return nweak == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,315 @@
+#include "batchgcd.h"
+#include "threadpool.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#define CHUNKS_PER_THREAD 4 // TASKS PER WORKER AND LEVEL, SO UNEVEN NODES BALANCE
+
+// ONE LEVEL OF THE PRODUCT TREE
+// A level is either resident in v or written to spill, never both. Level 0
+// is the caller's moduli and is neither owned nor spilled.
+typedef struct {
+    mpz_t *v;
+    uint64_t count;
+    uint64_t bytes;
+    FILE *spill;
+} level_t;
+
+// NODES OF A LEVEL, HANDED OUT IN CHUNKS
+typedef struct tree tree_t;
+
+typedef void (*range_fn)(tree_t *t, uint64_t k, uint64_t lo, uint64_t hi);
+
+struct tree {
+    level_t *levels;
+    uint64_t depth;
+    mpz_t *up, *down; // REMAINDERS OF THE LEVEL ABOVE AND OF THE CURRENT LEVEL
+    mpz_t *g;
+    const batch_gcd_opts_t *opts;
+    pool_t *pool;
+};
+
+typedef struct {
+    tree_t *tree;
+    range_fn fn;
+    uint64_t k, lo, hi;
+} chunk_t;
+
+void batch_gcd_opts_init(batch_gcd_opts_t *opts) {
+    opts->threads = 0;
+    opts->budget = 0;
+    opts->dir = NULL;
+    opts->verbose = false;
+}
+
+static uint64_t mpz_bytes(const mpz_t x) {
+    return mpz_size(x) * sizeof(mp_limb_t);
+}
+
+static void chunk_task(void *arg) {
+    chunk_t *c = (chunk_t *) arg;
+    c->fn(c->tree, c->k, c->lo, c->hi);
+}
+
+// RUN ONE LEVEL
+// @param t : Tree
+// @param fn : Work on nodes [lo, hi) of level k
+// @param k : Level
+// @param count : Nodes in the level
+// Splits the level into chunks for the pool and waits for all of them. The
+// top levels have fewer nodes than workers and run as far as they go wide.
+static void run_level(tree_t *t, range_fn fn, uint64_t k, uint64_t count) {
+    if (t->pool == NULL) {
+        fn(t, k, 0, count);
+        return;
+    }
+    uint64_t chunks = t->opts->threads * CHUNKS_PER_THREAD;
+    chunks = chunks < count ? chunks : count;
+    chunk_t *cs = (chunk_t *) malloc(chunks * sizeof(chunk_t));
+    for (uint64_t c = 0; c < chunks; c += 1) {
+        cs[c] = (chunk_t) { t, fn, k, count * c / chunks, count * (c + 1) / chunks };
+        pool_submit(t->pool, chunk_task, &cs[c]);
+    }
+    pool_wait(t->pool);
+    free(cs);
+}
+
+// PRODUCT NODES
+// Node i of level k is the product of nodes 2i and 2i + 1 below it; an odd
+// node out moves up unchanged.
+static void product_range(tree_t *t, uint64_t k, uint64_t lo, uint64_t hi) {
+    level_t *below = &t->levels[k - 1], *l = &t->levels[k];
+    for (uint64_t i = lo; i < hi; i += 1) {
+        if (2 * i + 1 < below->count) {
+            mpz_mul(l->v[i], below->v[2 * i], below->v[2 * i + 1]);
+        } else {
+            mpz_set(l->v[i], below->v[2 * i]);
+        }
+    }
+}
+
+// REMAINDER NODES
+// Node i of level k is the remainder of its parent modulo its own square.
+// At level 0 that leaves P mod n^2; dividing by n gives (P / n) mod n, and
+// its gcd with n is the part of n shared with the other moduli.
+static void remainder_range(tree_t *t, uint64_t k, uint64_t lo, uint64_t hi) {
+    level_t *l = &t->levels[k];
+    mpz_t sq;
+    mpz_init(sq);
+    for (uint64_t i = lo; i < hi; i += 1) {
+        mpz_mul(sq, l->v[i], l->v[i]);
+        mpz_mod(t->down[i], t->up[i / 2], sq);
+        if (k == 0) {
+            mpz_divexact(t->down[i], t->down[i], l->v[i]);
+            mpz_gcd(t->g[i], t->down[i], l->v[i]);
+        }
+    }
+    mpz_clear(sq);
+}
+
+// SPILL FILE
+// @param dir : Directory, NULL for tmpfile()
+// The file is unlinked at once, so it goes away with the process.
+static FILE *spill_open(const char *dir) {
+    if (dir == NULL) {
+        return tmpfile();
+    }
+    char *path = (char *) malloc(strlen(dir) + 32);
+    sprintf(path, "%s/rsa-bgcd-XXXXXX", dir);
+    int fd = mkstemp(path);
+    FILE *f = NULL;
+    if (fd >= 0) {
+        unlink(path);
+        f = fdopen(fd, "w+");
+    }
+    free(path);
+    return f;
+}
+
+// WRITE LEVEL TO DISK
+static bool spill_level(level_t *l, const char *dir) {
+    l->spill = spill_open(dir);
+    if (l->spill == NULL) {
+        return false;
+    }
+    bool ok = true;
+    for (uint64_t i = 0; i < l->count; i += 1) {
+        ok = ok && mpz_out_raw(l->spill, l->v[i]) != 0;
+        mpz_clear(l->v[i]);
+    }
+    free(l->v);
+    l->v = NULL;
+    return fflush(l->spill) == 0 && ok;
+}
+
+// READ LEVEL BACK
+static bool load_level(level_t *l) {
+    if (l->spill == NULL) {
+        return true;
+    }
+    bool ok = true;
+    rewind(l->spill);
+    l->v = (mpz_t *) malloc(l->count * sizeof(mpz_t));
+    for (uint64_t i = 0; i < l->count; i += 1) {
+        mpz_init(l->v[i]);
+        ok = ok && mpz_inp_raw(l->v[i], l->spill) != 0;
+    }
+    fclose(l->spill);
+    l->spill = NULL;
+    return ok;
+}
+
+static void free_level(level_t *l) {
+    if (l->spill != NULL) {
+        fclose(l->spill);
+        l->spill = NULL;
+    }
+    if (l->v != NULL) {
+        for (uint64_t i = 0; i < l->count; i += 1) {
+            mpz_clear(l->v[i]);
+        }
+        free(l->v);
+        l->v = NULL;
+    }
+}
+
+static mpz_t *alloc_nums(uint64_t count) {
+    mpz_t *v = (mpz_t *) malloc(count * sizeof(mpz_t));
+    for (uint64_t i = 0; i < count; i += 1) {
+        mpz_init(v[i]);
+    }
+    return v;
+}
+
+static void free_nums(mpz_t *v, uint64_t count) {
+    for (uint64_t i = 0; i < count; i += 1) {
+        mpz_clear(v[i]);
+    }
+    free(v);
+}
+
+// BATCH GCD
+// @param g : Initialized outputs, g[i] = gcd(n[i], product of the others)
+// @param n : Moduli
+// @param count : Number of moduli
+// @param opts : Threads, memory budget and spill directory
+// Bernstein's product and remainder trees find every shared factor in
+// quasi-linear time instead of comparing each pair. A g[i] other than 1
+// means n[i] shares a factor; g[i] = n[i] when both of its primes are
+// shared (or the modulus repeats), and the pairs then need sorting out.
+// Once the resident levels pass the budget, the lowest finished ones are
+// written to disk and read back on the way down. The remainders of the
+// descent (mod n^2, so about twice their level) count against the budget
+// too: before each level comes back, lower levels still in memory are
+// spilled to make room for it and its remainders. The level being reduced,
+// the remainders above it, its own remainders and the caller's moduli must
+// be in memory at once, so a budget below that is exceeded by them alone.
+// Returns false when a level cannot be spilled or read back.
+bool batch_gcd(mpz_t g[], mpz_t n[], uint64_t count, const batch_gcd_opts_t *opts) {
+    if (count < 2) {
+        for (uint64_t i = 0; i < count; i += 1) {
+            mpz_set_ui(g[i], 1);
+        }
+        return true;
+    }
+    uint64_t depth = 1;
+    for (uint64_t c = count; c > 1; c = (c + 1) / 2) {
+        depth += 1;
+    }
+    tree_t t = { NULL, depth, NULL, NULL, g, opts, NULL };
+    t.levels = (level_t *) calloc(depth, sizeof(level_t));
+    t.pool = opts->threads > 0 ? pool_create(opts->threads) : NULL;
+    t.levels[0].v = n;
+    t.levels[0].count = count;
+    uint64_t resident = 0;
+    for (uint64_t i = 0; i < count; i += 1) {
+        t.levels[0].bytes += mpz_bytes(n[i]);
+    }
+    resident += t.levels[0].bytes;
+    bool ok = true;
+
+    // PRODUCT TREE, SPILLING THE LOWEST LEVELS THAT ARE NO LONGER NEEDED
+    for (uint64_t k = 1; ok && k < depth; k += 1) {
+        level_t *l = &t.levels[k];
+        l->count = (t.levels[k - 1].count + 1) / 2;
+        l->v = alloc_nums(l->count);
+        run_level(&t, product_range, k, l->count);
+        for (uint64_t i = 0; i < l->count; i += 1) {
+            l->bytes += mpz_bytes(l->v[i]);
+        }
+        resident += l->bytes;
+        for (uint64_t j = 1; ok && j < k && opts->budget > 0 && resident > opts->budget; j += 1) {
+            if (t.levels[j].v != NULL) {
+                ok = spill_level(&t.levels[j], opts->dir);
+                resident -= t.levels[j].bytes;
+            }
+        }
+        if (opts->verbose) {
+            fprintf(stderr, "product level %lu: %lu nodes, %.1f MB, %.1f MB resident\n", k,
+                l->count, l->bytes / 1e6, resident / 1e6);
+        }
+    }
+
+    // REMAINDER TREE, FREEING EACH LEVEL ONCE ITS REMAINDERS ARE DONE
+    uint64_t up_count = 1, up_bytes = 0;
+    if (ok) {
+        t.up = alloc_nums(1);
+        mpz_set(t.up[0], t.levels[depth - 1].v[0]);
+        up_bytes = mpz_bytes(t.up[0]);
+        free_level(&t.levels[depth - 1]);
+        resident -= t.levels[depth - 1].bytes;
+    }
+    for (uint64_t k = depth - 1; ok && k-- > 0;) {
+        level_t *l = &t.levels[k];
+        // ROOM FOR THE LEVEL, IF IT WAS SPILLED, AND ITS REMAINDERS
+        uint64_t need = (l->spill != NULL ? l->bytes : 0) + 2 * l->bytes;
+        for (uint64_t j = 1;
+             ok && j < k && opts->budget > 0 && resident + up_bytes + need > opts->budget; j += 1) {
+            if (t.levels[j].v != NULL) {
+                ok = spill_level(&t.levels[j], opts->dir);
+                resident -= t.levels[j].bytes;
+            }
+        }
+        resident += l->spill != NULL ? l->bytes : 0;
+        ok = ok && load_level(l);
+        if (!ok) {
+            break;
+        }
+        t.down = alloc_nums(l->count);
+        run_level(&t, remainder_range, k, l->count);
+        uint64_t down_bytes = 0;
+        for (uint64_t i = 0; i < l->count; i += 1) {
+            down_bytes += mpz_bytes(t.down[i]);
+        }
+        if (opts->verbose) {
+            fprintf(stderr, "remainder level %lu: %lu nodes, %.1f MB, %.1f MB resident\n", k,
+                l->count, down_bytes / 1e6, (resident + up_bytes + down_bytes) / 1e6);
+        }
+        free_nums(t.up, up_count);
+        t.up = t.down;
+        t.down = NULL;
+        up_count = l->count;
+        up_bytes = down_bytes;
+        if (k > 0) {
+            free_level(l);
+            resident -= l->bytes;
+        }
+    }
+    if (t.up != NULL) {
+        free_nums(t.up, up_count);
+    }
+
+    for (uint64_t k = 1; k < depth; k += 1) {
+        free_level(&t.levels[k]);
+    }
+    free(t.levels);
+    if (t.pool != NULL) {
+        pool_destroy(t.pool);
+    }
+    return ok;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+// BATCH GCD OPTIONS
+// threads : Workers per tree level, 0 runs on the calling thread
+// budget : Bytes of tree levels and remainders kept in memory, 0 for no limit
+// dir : Directory for spilled levels, NULL for the system temporary directory
+// verbose : Report each level on stderr
+typedef struct {
+    uint64_t threads;
+    uint64_t budget;
+    const char *dir;
+    bool verbose;
+} batch_gcd_opts_t;
+
+void batch_gcd_opts_init(batch_gcd_opts_t *opts);
+
+bool batch_gcd(mpz_t g[], mpz_t n[], uint64_t count, const batch_gcd_opts_t *opts);
@@ -0,0 +1,711 @@
+#include "rsa.h"
+#include "numtheory.h"
+#include "multibuf.h"
+#include "randstate.h"
+#include "arena.h"
+#include "stats.h"
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPTIONS "s:r:m:j:h"
+
+void help(char *exec) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "   Benchmarks exponentiation, private key operations, gcd, prime search and file\n"
+        "   throughput.\n\n"
+        "USAGE\n"
+        "   %s [-h] [-s seed] [-r reps] [-m megabytes] [-j json]\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -s seed         Random seed for inputs (default: 2022).\n"
+        "   -r reps         Exponentiations per modulus size (default: 20).\n"
+        "   -m megabytes    Input size for the file throughput runs (default: 1).\n"
+        "   -j json         Also write every row as JSON to this file.\n",
+        exec);
+}
+
+// MONOTONIC CLOCK IN SECONDS
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// JSON RESULTS
+// With -j every table row also becomes one object of the results array:
+// the table, the row key and each column, so runs can be diffed by script.
+static FILE *json = NULL;
+static bool json_rows = false;
+
+static void json_row(const char *table) {
+    if (json) {
+        fprintf(json, "%s\n    { \"table\": \"%s\"", json_rows ? "," : "", table);
+        json_rows = true;
+    }
+}
+
+static void json_num(const char *name, double v) {
+    if (json && isfinite(v)) {
+        fprintf(json, ", \"%s\": %.6g", name, v);
+    } else if (json) {
+        fprintf(json, ", \"%s\": null", name);
+    }
+}
+
+static void json_str(const char *name, const char *v) {
+    if (json) {
+        fprintf(json, ", \"%s\": \"%s\"", name, v);
+    }
+}
+
+static void json_end(void) {
+    if (json) {
+        fprintf(json, " }");
+    }
+}
+
+// REFERENCE RIGHT-TO-LEFT BINARY EXPONENTIATION
+// The loop pow_mod used before the Montgomery engine, kept to measure against.
+static void pow_mod_binary(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
+    mpz_t tmp, v, p, exp;
+    mpz_init_set_ui(v, 1);
+    mpz_init_set(p, a);
+    mpz_init_set(exp, d);
+    mpz_init(tmp);
+    while (mpz_cmp_ui(exp, 0) == 1) {
+        if (mpz_odd_p(exp)) {
+            mpz_mul(tmp, v, p);
+            mpz_mod(v, tmp, n);
+        }
+        mpz_mul(tmp, p, p);
+        mpz_mod(p, tmp, n);
+        mpz_tdiv_q_2exp(exp, exp, 1);
+    }
+    mpz_set(o, v);
+    mpz_clears(tmp, exp, v, p, NULL);
+}
+
+// REFERENCE EUCLIDEAN GCD AND INVERSE
+// The loops gcd and mod_inverse used before Lehmer's method, one full
+// division per quotient.
+static void gcd_euclid(mpz_t g, mpz_t a, mpz_t b) {
+    mpz_t tmp_a, tmp_b, t;
+    mpz_inits(t, tmp_a, tmp_b, NULL);
+    mpz_set(tmp_b, b);
+    mpz_set(tmp_a, a);
+    while (mpz_cmp_ui(tmp_b, 0) != 0) {
+        mpz_set(t, tmp_b);
+        mpz_mod(tmp_b, tmp_a, tmp_b);
+        mpz_set(tmp_a, t);
+    }
+    mpz_set(g, tmp_a);
+    mpz_clears(t, tmp_a, tmp_b, NULL);
+}
+
+static void mod_inverse_euclid(mpz_t o, mpz_t a, mpz_t n) {
+    mpz_t q, t, tP, r, rP, tmp;
+    mpz_inits(q, t, tP, r, rP, tmp, NULL);
+    mpz_set(r, n);
+    mpz_set(rP, a);
+    mpz_set_ui(t, 0);
+    mpz_set_ui(tP, 1);
+    while (mpz_cmp_ui(rP, 0) != 0) {
+        mpz_fdiv_q(q, r, rP);
+        mpz_set(tmp, r);
+        mpz_set(r, rP);
+        mpz_mul(rP, q, rP);
+        mpz_sub(rP, tmp, rP);
+        mpz_set(tmp, t);
+        mpz_set(t, tP);
+        mpz_mul(tP, q, tP);
+        mpz_sub(tP, tmp, tP);
+    }
+    if (mpz_cmp_ui(r, 1) == 1) {
+        mpz_set_ui(t, 0);
+    } else if (mpz_cmp_ui(t, 0) == -1) {
+        mpz_add(t, t, n);
+    }
+    mpz_set(o, t);
+    mpz_clears(q, t, tP, r, rP, tmp, NULL);
+}
+
+// REFERENCE PRIME SEARCH
+// The make_prime loop before sieving: a fresh random draw per candidate,
+// every one of them sent to is_prime.
+static void make_prime_random(mpz_t p, uint64_t bits, uint64_t iters, uint64_t *calls) {
+    do {
+        mpz_urandomb(p, state, bits);
+        *calls += 1;
+    } while (!is_prime(p, iters));
+}
+
+// FILE THROUGHPUT
+// @param key : Private key, its n and e = 65537 encrypt
+// @param e : Public exponent
+// @param plain : Plaintext file to encrypt
+// @param opts : File options under test
+// @param enc,dec : Output throughput in MB/s
+// Encrypts plain into a temporary file, decrypts it back and checks the
+// round trip.
+static bool file_throughput(rsa_priv_t *key, mpz_t e, FILE *plain, rsa_file_opts_t *opts,
+    double *enc, double *dec) {
+    FILE *cipher = tmpfile();
+    FILE *back = tmpfile();
+    rewind(plain);
+    fseek(plain, 0, SEEK_END);
+    double mb = ftell(plain) / 1e6;
+    rewind(plain);
+
+    double t0 = now();
+    rsa_encrypt_file_opts(plain, cipher, key->n, e, opts);
+    fflush(cipher);
+    double t1 = now();
+    rewind(cipher);
+    rsa_decrypt_file_opts(cipher, back, key, opts);
+    fflush(back);
+    double t2 = now();
+    *enc = mb / (t1 - t0);
+    *dec = mb / (t2 - t1);
+
+    bool same = ftell(back) == (long) (mb * 1e6);
+    rewind(plain);
+    rewind(back);
+    for (int a = fgetc(plain), b = fgetc(back); same && a != EOF; a = fgetc(plain), b = fgetc(back)) {
+        same = a == b;
+    }
+    fclose(cipher);
+    fclose(back);
+    return same;
+}
+
+// ALLOCATION ROW
+// @param name : Operation measured
+// @param ops : Operations since the counters were taken
+// @param calls,system : STAT_ARENA_ALLOCS and STAT_MALLOCS before the operations
+static void alloc_row(const char *name, uint64_t ops, uint64_t calls, uint64_t system) {
+    double arena = (double) (STAT_READ(STAT_ARENA_ALLOCS) - calls) / ops;
+    double sys = (double) (STAT_READ(STAT_MALLOCS) - system) / ops;
+    printf("%-16s %14.2f %14.2f\n", name, arena, sys);
+    json_row("alloc");
+    json_str("op", name);
+    json_num("arena_per_op", arena);
+    json_num("malloc_per_op", sys);
+    json_end();
+}
+
+int main(int argc, char **argv) {
+    arena_install(); // BEFORE ANY GMP ALLOCATION
+    int opt = 0;
+    uint64_t seed = 2022;
+    uint64_t reps = 20;
+    uint64_t megabytes = 1;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 's': seed = atoi(optarg); break;
+        case 'r': reps = atoi(optarg); break;
+        case 'm': megabytes = atoi(optarg); break;
+        case 'j': {
+            json = fopen(optarg, "w");
+            if (!json) {
+                fprintf(stderr, "Failed to open %s.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+        case 'h': {
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+        }
+    }
+
+    randstate_init(seed);
+    if (json) {
+        fprintf(json, "{\n  \"seed\": %lu, \"reps\": %lu, \"megabytes\": %lu,\n  \"results\": [", seed,
+            reps, megabytes);
+    }
+    mpz_t n, a, d, o, ref;
+    mpz_inits(n, a, d, o, ref, NULL);
+
+    uint64_t sizes[] = { 1024, 2048, 3072, 4096 };
+    printf("%-6s %14s %14s %14s %8s\n", "bits", "binary (ms)", "pow_mod (ms)", "mpz_powm (ms)",
+        "speedup");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i += 1) {
+        uint64_t bits = sizes[i];
+        mpz_urandomb(n, state, bits);
+        mpz_setbit(n, bits - 1);
+        mpz_setbit(n, 0);
+        mpz_urandomm(a, state, n);
+        mpz_urandomm(d, state, n);
+
+        double t0 = now();
+        for (uint64_t r = 0; r < reps; r += 1) {
+            pow_mod_binary(ref, a, d, n);
+        }
+        double t1 = now();
+        for (uint64_t r = 0; r < reps; r += 1) {
+            pow_mod(o, a, d, n);
+        }
+        double t2 = now();
+        for (uint64_t r = 0; r < reps; r += 1) {
+            mpz_powm(o, a, d, n);
+        }
+        double t3 = now();
+
+        pow_mod(o, a, d, n);
+        if (mpz_cmp(o, ref) != 0) {
+            fprintf(stderr, "pow_mod mismatch at %lu bits\n", bits);
+            return EXIT_FAILURE;
+        }
+        double binary = (t1 - t0) * 1e3 / reps;
+        double mont = (t2 - t1) * 1e3 / reps;
+        double gmp = (t3 - t2) * 1e3 / reps;
+        printf("%-6lu %14.3f %14.3f %14.3f %7.2fx\n", bits, binary, mont, gmp, binary / mont);
+        json_row("pow_mod");
+        json_num("bits", bits);
+        json_num("binary_ms", binary);
+        json_num("pow_mod_ms", mont);
+        json_num("mpz_powm_ms", gmp);
+        json_end();
+    }
+
+    // PRIVATE KEY OPERATIONS: FULL WIDTH VERSUS CRT
+    printf("\n%-6s %14s %14s %8s\n", "bits", "decrypt (ms)", "crt (ms)", "speedup");
+    for (size_t i = 0; i < 2; i += 1) {
+        uint64_t bits = sizes[i];
+        mpz_t p, q, e, priv;
+        mpz_inits(p, q, e, priv, NULL);
+        rsa_priv_t key;
+        rsa_priv_init(&key);
+        rsa_make_pub(p, q, n, e, bits, 20);
+        rsa_make_priv(priv, e, p, q);
+        rsa_make_priv_crt(&key, n, priv, p, q);
+        mpz_urandomm(a, state, n);
+
+        double t0 = now();
+        for (uint64_t r = 0; r < reps; r += 1) {
+            rsa_decrypt(ref, a, priv, n);
+        }
+        double t1 = now();
+        for (uint64_t r = 0; r < reps; r += 1) {
+            rsa_decrypt_crt(o, a, &key);
+        }
+        double t2 = now();
+        if (mpz_cmp(o, ref) != 0) {
+            fprintf(stderr, "rsa_decrypt_crt mismatch at %lu bits\n", bits);
+            return EXIT_FAILURE;
+        }
+        double full = (t1 - t0) * 1e3 / reps;
+        double crt = (t2 - t1) * 1e3 / reps;
+        printf("%-6lu %14.3f %14.3f %7.2fx\n", bits, full, crt, full / crt);
+        json_row("crt");
+        json_num("bits", bits);
+        json_num("decrypt_ms", full);
+        json_num("crt_ms", crt);
+        json_end();
+        rsa_priv_clear(&key);
+        mpz_clears(p, q, e, priv, NULL);
+    }
+
+    // FIXED WIDTH KERNELS AGAINST THE GENERIC PATH, WITH BALANCED PRIMES FOR CRT
+    printf("\n%-6s %14s %14s %8s %14s %14s %8s\n", "bits", "generic (ms)", "fixed (ms)", "speedup",
+        "crt gen (ms)", "crt fix (ms)", "speedup");
+    for (size_t i = 1; i < sizeof(sizes) / sizeof(sizes[0]); i += 1) {
+        uint64_t bits = sizes[i];
+        mpz_t p, q, e, priv;
+        mpz_inits(p, q, e, priv, NULL);
+        mpz_set_ui(e, 65537);
+        do {
+            make_prime(p, bits / 2, MR_ITERS_ADAPTIVE);
+            make_prime(q, bits / 2, MR_ITERS_ADAPTIVE);
+            mpz_mul(n, p, q);
+            rsa_make_priv(priv, e, p, q);
+        } while (mpz_sizeinbase(n, 2) != bits || mpz_sgn(priv) == 0);
+        rsa_priv_t key;
+        rsa_priv_init(&key);
+        rsa_make_priv_crt(&key, n, priv, p, q);
+        mpz_urandomm(a, state, n);
+        mpz_urandomm(d, state, n);
+
+        // BEST OF THREE ALTERNATING ROUNDS, THE CRT HALVES ARE SHORT ENOUGH TO BE NOISY
+        double ms[4] = { 1e9, 1e9, 1e9, 1e9 };
+        for (int round = 0; round < 6; round += 1) {
+            int f = round % 2;
+            mont_fixed = f == 1;
+            double t0 = now();
+            for (uint64_t r = 0; r < reps; r += 1) {
+                pow_mod(o, a, d, n);
+            }
+            double t1 = now();
+            for (uint64_t r = 0; r < reps; r += 1) {
+                rsa_decrypt_crt(o, a, &key);
+            }
+            double t2 = now();
+            double pow = (t1 - t0) * 1e3 / reps, crt = (t2 - t1) * 1e3 / reps;
+            ms[2 * f] = pow < ms[2 * f] ? pow : ms[2 * f];
+            ms[2 * f + 1] = crt < ms[2 * f + 1] ? crt : ms[2 * f + 1];
+        }
+        pow_mod(o, a, d, n);
+        mont_fixed = false;
+        pow_mod(ref, a, d, n);
+        mont_fixed = true;
+        if (mpz_cmp(o, ref) != 0) {
+            fprintf(stderr, "fixed kernel mismatch at %lu bits\n", bits);
+            return EXIT_FAILURE;
+        }
+        printf("%-6lu %14.3f %14.3f %7.2fx %14.3f %14.3f %7.2fx\n", bits, ms[0], ms[2], ms[0] / ms[2],
+            ms[1], ms[3], ms[1] / ms[3]);
+        json_row("kernels");
+        json_num("bits", bits);
+        json_num("generic_ms", ms[0]);
+        json_num("fixed_ms", ms[2]);
+        json_num("crt_generic_ms", ms[1]);
+        json_num("crt_fixed_ms", ms[3]);
+        json_end();
+        rsa_priv_clear(&key);
+        mpz_clears(p, q, e, priv, NULL);
+    }
+
+    // MULTI-PRIME 4096-BIT KEYS, THE POOL RUNS ONE WORKER PER PRIME
+    printf("\n%-6s %14s %14s %14s\n", "primes", "keygen (ms)", "crt (ms)", "pool (ms)");
+    for (uint64_t k = 2; k <= 4; k += 1) {
+        mpz_t r[RSA_MAX_PRIMES], e, priv;
+        mpz_inits(e, priv, NULL);
+        for (uint64_t i = 0; i < k; i += 1) {
+            mpz_init(r[i]);
+        }
+        double t0 = now();
+        for (uint64_t j = 0; j < 3; j += 1) { // KEYGEN TIMES SPREAD WIDELY, AVERAGE A FEW
+            rsa_make_pub_multi(r, k, n, e, 4096, MR_ITERS_ADAPTIVE, 65537, seed + j, 0);
+        }
+        double t1 = now();
+        rsa_make_priv_multi(priv, e, r, k);
+        rsa_priv_t key;
+        rsa_priv_init(&key);
+        rsa_make_priv_crt_multi(&key, n, priv, r, k);
+        pool_t *pool = pool_create(k);
+        mpz_urandomm(a, state, n);
+        double t2 = now();
+        for (uint64_t rep = 0; rep < reps; rep += 1) {
+            rsa_decrypt_crt(o, a, &key);
+        }
+        double t3 = now();
+        for (uint64_t rep = 0; rep < reps; rep += 1) {
+            rsa_decrypt_crt_pool(ref, a, &key, pool);
+        }
+        double t4 = now();
+        rsa_decrypt(d, a, priv, n);
+        if (mpz_cmp(o, d) != 0 || mpz_cmp(ref, d) != 0) {
+            fprintf(stderr, "multi-prime mismatch with %lu primes\n", k);
+            return EXIT_FAILURE;
+        }
+        double keygen = (t1 - t0) * 1e3 / 3;
+        double crt = (t3 - t2) * 1e3 / reps, pooled = (t4 - t3) * 1e3 / reps;
+        printf("%-6lu %14.3f %14.3f %14.3f\n", k, keygen, crt, pooled);
+        json_row("multi_prime");
+        json_num("primes", k);
+        json_num("keygen_ms", keygen);
+        json_num("crt_ms", crt);
+        json_num("pool_ms", pooled);
+        json_end();
+        pool_destroy(pool);
+        rsa_priv_clear(&key);
+        for (uint64_t i = 0; i < k; i += 1) {
+            mpz_clear(r[i]);
+        }
+        mpz_clears(e, priv, NULL);
+    }
+
+    // GCD AND INVERSE: EUCLID VERSUS LEHMER, WITH GMP FOR SCALE
+    printf("\n%-6s %12s %12s %12s %12s %12s %12s\n", "bits", "euclid (us)", "gcd (us)",
+        "mpz_gcd (us)", "inv old (us)", "inverse (us)", "invert (us)");
+    uint64_t gbits[] = { 512, 1024, 2048, 4096, 8192 };
+    for (size_t i = 0; i < sizeof(gbits) / sizeof(gbits[0]); i += 1) {
+        uint64_t bits = gbits[i];
+        uint64_t runs = reps * 100 * 1024 / bits;
+        mpz_urandomb(n, state, bits);
+        mpz_setbit(n, bits - 1);
+        mpz_setbit(n, 0);
+        mpz_urandomm(a, state, n);
+        double t[7];
+        t[0] = now();
+        for (uint64_t r = 0; r < runs; r += 1) {
+            gcd_euclid(ref, a, n);
+        }
+        t[1] = now();
+        for (uint64_t r = 0; r < runs; r += 1) {
+            gcd(o, a, n);
+        }
+        t[2] = now();
+        for (uint64_t r = 0; r < runs; r += 1) {
+            mpz_gcd(o, a, n);
+        }
+        t[3] = now();
+        if (mpz_cmp(o, ref) != 0) {
+            fprintf(stderr, "gcd mismatch at %lu bits\n", bits);
+            return EXIT_FAILURE;
+        }
+        for (uint64_t r = 0; r < runs; r += 1) {
+            mod_inverse_euclid(ref, a, n);
+        }
+        t[4] = now();
+        for (uint64_t r = 0; r < runs; r += 1) {
+            mod_inverse(o, a, n);
+        }
+        t[5] = now();
+        if (mpz_cmp(o, ref) != 0) {
+            fprintf(stderr, "mod_inverse mismatch at %lu bits\n", bits);
+            return EXIT_FAILURE;
+        }
+        for (uint64_t r = 0; r < runs; r += 1) {
+            mpz_invert(o, a, n);
+        }
+        t[6] = now();
+        const char *cols[] = { "euclid_us", "gcd_us", "mpz_gcd_us", "inverse_euclid_us",
+            "mod_inverse_us", "mpz_invert_us" };
+        printf("%-6lu", bits);
+        json_row("gcd");
+        json_num("bits", bits);
+        for (int k = 0; k < 6; k += 1) {
+            printf(" %12.2f", (t[k + 1] - t[k]) * 1e6 / runs);
+            json_num(cols[k], (t[k + 1] - t[k]) * 1e6 / runs);
+        }
+        printf("\n");
+        json_end();
+    }
+
+    // PRIME SEARCH: RANDOM DRAWS VERSUS THE INCREMENTAL SIEVE
+    printf("\n%-6s %14s %14s %14s %14s %8s\n", "bits", "random (ms)", "random MR", "sieve (ms)",
+        "sieve MR", "speedup");
+    uint64_t pbits[] = { 512, 1024, 2048 };
+    for (size_t i = 0; i < sizeof(pbits) / sizeof(pbits[0]); i += 1) {
+        uint64_t bits = pbits[i];
+        uint64_t primes = reps / 4 + 1;
+        uint64_t calls = 0;
+        double t0 = now();
+        for (uint64_t r = 0; r < primes; r += 1) {
+            make_prime_random(o, bits, 50, &calls);
+        }
+        double t1 = now();
+        uint64_t survivors = STAT_READ(STAT_SIEVE_SURVIVORS);
+        for (uint64_t r = 0; r < primes; r += 1) {
+            make_prime(o, bits, 50);
+        }
+        double t2 = now();
+        double random = (t1 - t0) * 1e3 / primes;
+        double sieve = (t2 - t1) * 1e3 / primes;
+        survivors = STAT_READ(STAT_SIEVE_SURVIVORS) - survivors;
+        printf("%-6lu %14.3f %14.1f %14.3f %14.1f %7.2fx\n", bits, random,
+            (double) calls / primes, sieve, (double) survivors / primes, random / sieve);
+        json_row("make_prime");
+        json_num("bits", bits);
+        json_num("random_ms", random);
+        json_num("random_mr", (double) calls / primes);
+        json_num("sieve_ms", sieve);
+        json_num("sieve_mr", (double) survivors / primes);
+        json_end();
+    }
+
+    // PRIMALITY MODES ON THE SIEVED SEARCH
+    printf("\n%-6s %14s %14s %14s\n", "bits", "50 MR (ms)", "adaptive (ms)", "bpsw (ms)");
+    uint64_t modes[] = { 50, MR_ITERS_ADAPTIVE, MR_ITERS_BPSW };
+    const char *mode_cols[] = { "mr50_ms", "adaptive_ms", "bpsw_ms" };
+    for (size_t i = 0; i < sizeof(pbits) / sizeof(pbits[0]); i += 1) {
+        uint64_t bits = pbits[i];
+        uint64_t primes = reps / 4 + 1;
+        double ms[3];
+        for (size_t m = 0; m < 3; m += 1) {
+            double t0 = now();
+            for (uint64_t r = 0; r < primes; r += 1) {
+                make_prime(o, bits, modes[m]);
+            }
+            ms[m] = (now() - t0) * 1e3 / primes;
+        }
+        printf("%-6lu %14.3f %14.3f %14.3f\n", bits, ms[0], ms[1], ms[2]);
+        json_row("primality");
+        json_num("bits", bits);
+        for (size_t m = 0; m < 3; m += 1) {
+            json_num(mode_cols[m], ms[m]);
+        }
+        json_end();
+    }
+
+    // IS_PRIME ON A PRIME, THE FULL PRICE PAID BY EVERY CANDIDATE THAT SURVIVES
+    printf("\n%-6s %14s %14s %14s\n", "bits", "50 MR (ms)", "adaptive (ms)", "bpsw (ms)");
+    for (size_t i = 0; i < sizeof(pbits) / sizeof(pbits[0]); i += 1) {
+        uint64_t bits = pbits[i];
+        uint64_t runs = reps;
+        make_prime(a, bits, MR_ITERS_ADAPTIVE);
+        double ms[3];
+        for (size_t m = 0; m < 3; m += 1) {
+            double t0 = now();
+            for (uint64_t r = 0; r < runs; r += 1) {
+                if (!is_prime(a, modes[m])) {
+                    fprintf(stderr, "is_prime rejected a prime at %lu bits\n", bits);
+                    return EXIT_FAILURE;
+                }
+            }
+            ms[m] = (now() - t0) * 1e3 / runs;
+        }
+        printf("%-6lu %14.3f %14.3f %14.3f\n", bits, ms[0], ms[1], ms[2]);
+        json_row("is_prime");
+        json_num("bits", bits);
+        for (size_t m = 0; m < 3; m += 1) {
+            json_num(mode_cols[m], ms[m]);
+        }
+        json_end();
+    }
+
+    // FILE THROUGHPUT: HEX LINES, THE BINARY CONTAINER AND HYBRID MODE
+    {
+        mpz_t p, q, e, priv;
+        mpz_inits(p, q, e, priv, NULL);
+        rsa_priv_t key;
+        rsa_priv_init(&key);
+        rsa_make_pub_fixed(p, q, n, e, 2048, MR_ITERS_ADAPTIVE, 65537);
+        rsa_make_priv(priv, e, p, q);
+        rsa_make_priv_crt(&key, n, priv, p, q);
+
+        FILE *plain = tmpfile();
+        for (uint64_t i = 0; i < megabytes * 1000000; i += 1) {
+            fputc(gmp_urandomb_ui(state, 8), plain);
+        }
+
+        printf("\n%-8s %16s %16s\n", "format", "encrypt (MB/s)", "decrypt (MB/s)");
+        const char *names[] = { "hex", "binary", "hybrid" };
+        for (int b = 0; b < 3; b += 1) {
+            rsa_file_opts_t opts;
+            rsa_file_opts_init(&opts);
+            opts.binary = b == 1;
+            opts.hybrid = b == 2;
+            double enc = 0, dec = 0;
+            if (!file_throughput(&key, e, plain, &opts, &enc, &dec)) {
+                fprintf(stderr, "%s file round trip mismatch\n", names[b]);
+                return EXIT_FAILURE;
+            }
+            printf("%-8s %16.3f %16.3f\n", names[b], enc, dec);
+            json_row("file");
+            json_str("format", names[b]);
+            json_num("encrypt_mbps", enc);
+            json_num("decrypt_mbps", dec);
+            json_end();
+        }
+
+        // MULTI-BUFFER LANES AGAINST ONE BLOCK AT A TIME, ON A QUARTER OF THE INPUT
+        mb_ctx_t probe;
+        if (!mb_init(&probe, key.n)) {
+            printf("\nmulti-buffer lanes unavailable on this CPU\n");
+        } else {
+            mb_clear(&probe);
+            FILE *part = tmpfile();
+            rewind(plain);
+            for (uint64_t i = 0; i < megabytes * 250000; i += 1) {
+                fputc(fgetc(plain), part);
+            }
+            printf("\n%-6s %14s %14s %8s %14s %14s %8s\n", "bits", "enc (MB/s)", "enc mb (MB/s)",
+                "speedup", "dec (MB/s)", "dec mb (MB/s)", "speedup");
+            for (size_t i = 1; i < sizeof(sizes) / sizeof(sizes[0]); i += 1) {
+                rsa_priv_t wide;
+                rsa_priv_init(&wide);
+                mpz_t wp, wq, wn, wd;
+                mpz_inits(wp, wq, wn, wd, NULL);
+                rsa_make_pub_fixed(wp, wq, wn, e, sizes[i], MR_ITERS_ADAPTIVE, 65537);
+                rsa_make_priv(wd, e, wp, wq);
+                rsa_make_priv_crt(&wide, wn, wd, wp, wq);
+                rsa_file_opts_t opts;
+                rsa_file_opts_init(&opts);
+                opts.binary = true;
+                double rate[4];
+                for (int l = 0; l < 2; l += 1) {
+                    mb_enabled = l == 1;
+                    if (!file_throughput(&wide, e, part, &opts, &rate[l], &rate[2 + l])) {
+                        fprintf(stderr, "multi-buffer round trip mismatch at %lu bits\n", sizes[i]);
+                        return EXIT_FAILURE;
+                    }
+                }
+                printf("%-6lu %14.3f %14.3f %7.2fx %14.3f %14.3f %7.2fx\n", sizes[i], rate[0], rate[1],
+                    rate[1] / rate[0], rate[2], rate[3], rate[3] / rate[2]);
+                json_row("multi_buffer");
+                json_num("bits", sizes[i]);
+                json_num("encrypt_mbps", rate[0]);
+                json_num("encrypt_mb_mbps", rate[1]);
+                json_num("decrypt_mbps", rate[2]);
+                json_num("decrypt_mb_mbps", rate[3]);
+                json_end();
+                rsa_priv_clear(&wide);
+                mpz_clears(wp, wq, wn, wd, NULL);
+            }
+            fclose(part);
+        }
+
+        // ALLOCATIONS PER OPERATION ONCE THE WORKSPACES HAVE SEEN EVERY SIZE
+        printf("\n%-16s %14s %14s\n", "2048-bit op", "arena / op", "malloc / op");
+        uint64_t ops = reps * 10;
+        mpz_urandomm(a, state, n);
+        for (int w = 0; w < 2; w += 1) {
+            rsa_encrypt(o, a, e, n);
+            rsa_decrypt_crt(ref, o, &key);
+        }
+        uint64_t calls = STAT_READ(STAT_ARENA_ALLOCS), system = STAT_READ(STAT_MALLOCS);
+        for (uint64_t r = 0; r < ops; r += 1) {
+            rsa_encrypt(o, a, e, n);
+        }
+        alloc_row("encrypt", ops, calls, system);
+        calls = STAT_READ(STAT_ARENA_ALLOCS), system = STAT_READ(STAT_MALLOCS);
+        for (uint64_t r = 0; r < ops; r += 1) {
+            rsa_decrypt_crt(ref, o, &key);
+        }
+        alloc_row("decrypt crt", ops, calls, system);
+        calls = STAT_READ(STAT_ARENA_ALLOCS), system = STAT_READ(STAT_MALLOCS);
+        for (uint64_t r = 0; r < ops; r += 1) {
+            mod_inverse(o, a, n);
+        }
+        alloc_row("mod_inverse", ops, calls, system);
+
+        // PRIME CANDIDATES: ODD 1024-BIT NUMBERS, MOSTLY COMPOSITE
+        mpz_t c;
+        mpz_init2(c, 1024);
+        for (uint64_t r = 0; r < 2 * ops; r += 1) {
+            mpz_urandomb(c, state, 1024);
+            mpz_setbit(c, 1023);
+            mpz_setbit(c, 0);
+            is_prime(c, MR_ITERS_BPSW);
+            if (r + 1 == ops) {
+                calls = STAT_READ(STAT_ARENA_ALLOCS), system = STAT_READ(STAT_MALLOCS);
+            }
+        }
+        alloc_row("prime candidate", ops, calls, system);
+        mpz_clear(c);
+
+        // FILE BLOCKS: THE BINARY CONTAINER HOLDS ONE modbytes BLOCK PER RSA OPERATION
+        rsa_file_opts_t opts;
+        rsa_file_opts_init(&opts);
+        opts.binary = true;
+        double enc = 0, dec = 0;
+        file_throughput(&key, e, plain, &opts, &enc, &dec);
+        FILE *cipher = tmpfile();
+        rewind(plain);
+        calls = STAT_READ(STAT_ARENA_ALLOCS), system = STAT_READ(STAT_MALLOCS);
+        rsa_encrypt_file_opts(plain, cipher, key.n, e, &opts);
+        fflush(cipher);
+        uint64_t blocks = (ftell(cipher) - RSA_BIN_HEADER) / mpz_sizeinbase(key.n, 256);
+        alloc_row("file block", blocks, calls, system);
+        fclose(cipher);
+
+        fclose(plain);
+        rsa_priv_clear(&key);
+        mpz_clears(p, q, e, priv, NULL);
+    }
+
+    if (json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    mpz_clears(n, a, d, o, ref, NULL);
+    randstate_clear();
+    return EXIT_SUCCESS;
+}
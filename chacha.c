@@ -0,0 +1,322 @@
+#include "chacha.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// CHACHA20-POLY1305 (RFC 8439)
+// The keystream is produced sixteen blocks at a time with one vector lane
+// per block. On x86-64 the kernel is also built for AVX2 and AVX-512 and the
+// loader picks the widest one the CPU runs; elsewhere the compiler lowers
+// the vectors to whatever the target has.
+
+#define LANES 16
+
+typedef uint32_t lanes_t __attribute__((vector_size(4 * LANES)));
+
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define CHACHA_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef CHACHA_CLONES
+#define CHACHA_CLONES
+#endif
+
+static uint32_t load32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t load64(const uint8_t *p) {
+    return (uint64_t) load32(p) | (uint64_t) load32(p + 4) << 32;
+}
+
+static void store64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i += 1) {
+        p[i] = v >> (8 * i);
+    }
+}
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QUARTER(a, b, c, d)                                                                        \
+    a += b;                                                                                        \
+    d ^= a;                                                                                        \
+    d = ROTL(d, 16);                                                                               \
+    c += d;                                                                                        \
+    b ^= c;                                                                                        \
+    b = ROTL(b, 12);                                                                               \
+    a += b;                                                                                        \
+    d ^= a;                                                                                        \
+    d = ROTL(d, 8);                                                                                \
+    c += d;                                                                                        \
+    b ^= c;                                                                                        \
+    b = ROTL(b, 7);
+
+// SIXTEEN CHACHA20 BLOCKS
+// @param out, in : Up to 16 * 64 bytes to XOR with the keystream
+// @param len : Bytes to process
+// @param input : Block state, word 12 is the counter of the first block
+static CHACHA_CLONES void chacha_blocks(
+    uint8_t *out, const uint8_t *in, size_t len, const uint32_t input[16]) {
+    lanes_t x[16], s[16];
+    for (int w = 0; w < 16; w += 1) {
+        s[w] = input[w] + (lanes_t) { 0 };
+    }
+    s[12] += (lanes_t) { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+    memcpy(x, s, sizeof(x));
+    for (int round = 0; round < 10; round += 1) {
+        QUARTER(x[0], x[4], x[8], x[12]);
+        QUARTER(x[1], x[5], x[9], x[13]);
+        QUARTER(x[2], x[6], x[10], x[14]);
+        QUARTER(x[3], x[7], x[11], x[15]);
+        QUARTER(x[0], x[5], x[10], x[15]);
+        QUARTER(x[1], x[6], x[11], x[12]);
+        QUARTER(x[2], x[7], x[8], x[13]);
+        QUARTER(x[3], x[4], x[9], x[14]);
+    }
+    // TRANSPOSE LANES BACK INTO LITTLE-ENDIAN BLOCKS
+    uint8_t stream[64 * LANES];
+    for (int w = 0; w < 16; w += 1) {
+        lanes_t v = x[w] + s[w];
+        for (int l = 0; l < LANES; l += 1) {
+            uint8_t *p = stream + 64 * l + 4 * w;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            uint32_t word = v[l];
+            memcpy(p, &word, 4);
+#else
+            p[0] = v[l];
+            p[1] = v[l] >> 8;
+            p[2] = v[l] >> 16;
+            p[3] = v[l] >> 24;
+#endif
+        }
+    }
+    for (size_t i = 0; i < len; i += 1) {
+        out[i] = in[i] ^ stream[i];
+    }
+}
+
+// CHACHA20 STREAM
+// @param out, in : Buffers of len bytes, may be the same
+// @param key : 256 bit key
+// @param nonce : 96 bit nonce
+// @param counter : Block counter of the first 64 bytes
+void chacha20_xor(uint8_t *out, const uint8_t *in, size_t len, const uint8_t key[CHACHA_KEY],
+    const uint8_t nonce[CHACHA_NONCE], uint32_t counter) {
+    uint32_t input[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+    for (int i = 0; i < 8; i += 1) {
+        input[4 + i] = load32(key + 4 * i);
+    }
+    input[12] = counter;
+    for (int i = 0; i < 3; i += 1) {
+        input[13 + i] = load32(nonce + 4 * i);
+    }
+    while (len > 0) {
+        size_t n = len < 64 * LANES ? len : 64 * LANES;
+        chacha_blocks(out, in, n, input);
+        input[12] += LANES;
+        out += n;
+        in += n;
+        len -= n;
+    }
+}
+
+// POLY1305 STATE
+// 130 bit accumulator and key in 44 + 44 + 42 bit limbs.
+__extension__ typedef unsigned __int128 u128_t;
+
+typedef struct {
+    uint64_t r[3], h[3], pad[2];
+    uint8_t buf[16];
+    size_t left;
+} poly1305_t;
+
+#define M44 0xfffffffffffULL
+#define M42 0x3ffffffffffULL
+
+static void poly1305_init(poly1305_t *st, const uint8_t key[32]) {
+    uint64_t t0 = load64(key), t1 = load64(key + 8);
+    st->r[0] = t0 & 0xffc0fffffffULL;
+    st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+    st->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+    st->h[0] = st->h[1] = st->h[2] = 0;
+    st->pad[0] = load64(key + 16);
+    st->pad[1] = load64(key + 24);
+    st->left = 0;
+}
+
+static void poly1305_blocks(poly1305_t *st, const uint8_t *m, size_t bytes, uint64_t hibit) {
+    uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+    uint64_t s1 = r1 * 20, s2 = r2 * 20;
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+    while (bytes >= 16) {
+        uint64_t t0 = load64(m), t1 = load64(m + 8);
+        h0 += t0 & M44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & M44;
+        h2 += ((t1 >> 24) & M42) | hibit;
+        u128_t d0 = (u128_t) h0 * r0 + (u128_t) h1 * s2 + (u128_t) h2 * s1;
+        u128_t d1 = (u128_t) h0 * r1 + (u128_t) h1 * r0 + (u128_t) h2 * s2;
+        u128_t d2 = (u128_t) h0 * r2 + (u128_t) h1 * r1 + (u128_t) h2 * r0;
+        uint64_t c = (uint64_t) (d0 >> 44);
+        h0 = (uint64_t) d0 & M44;
+        d1 += c;
+        c = (uint64_t) (d1 >> 44);
+        h1 = (uint64_t) d1 & M44;
+        d2 += c;
+        c = (uint64_t) (d2 >> 42);
+        h2 = (uint64_t) d2 & M42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= M44;
+        h1 += c;
+        m += 16;
+        bytes -= 16;
+    }
+    st->h[0] = h0;
+    st->h[1] = h1;
+    st->h[2] = h2;
+}
+
+static void poly1305_update(poly1305_t *st, const uint8_t *m, size_t bytes) {
+    if (st->left > 0) {
+        size_t want = 16 - st->left < bytes ? 16 - st->left : bytes;
+        memcpy(st->buf + st->left, m, want);
+        st->left += want;
+        m += want;
+        bytes -= want;
+        if (st->left < 16) {
+            return;
+        }
+        poly1305_blocks(st, st->buf, 16, 1ULL << 40);
+        st->left = 0;
+    }
+    size_t full = bytes & ~(size_t) 15;
+    poly1305_blocks(st, m, full, 1ULL << 40);
+    memcpy(st->buf, m + full, bytes - full);
+    st->left = bytes - full;
+}
+
+// PAD THE MESSAGE SO FAR TO A 16 BYTE BOUNDARY WITH ZEROS (RFC 8439 2.8)
+static void poly1305_pad16(poly1305_t *st) {
+    if (st->left > 0) {
+        memset(st->buf + st->left, 0, 16 - st->left);
+        poly1305_blocks(st, st->buf, 16, 1ULL << 40);
+        st->left = 0;
+    }
+}
+
+static void poly1305_finish(poly1305_t *st, uint8_t tag[POLY1305_TAG]) {
+    if (st->left > 0) {
+        st->buf[st->left] = 1;
+        memset(st->buf + st->left + 1, 0, 15 - st->left);
+        poly1305_blocks(st, st->buf, 16, 0);
+    }
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], c;
+    c = h1 >> 44;
+    h1 &= M44;
+    h2 += c;
+    c = h2 >> 42;
+    h2 &= M42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= M44;
+    h1 += c;
+    c = h1 >> 44;
+    h1 &= M44;
+    h2 += c;
+    c = h2 >> 42;
+    h2 &= M42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= M44;
+    h1 += c;
+
+    // h - p, KEPT WHEN IT DOES NOT BORROW (CONSTANT TIME SELECT)
+    uint64_t g0 = h0 + 5;
+    c = g0 >> 44;
+    g0 &= M44;
+    uint64_t g1 = h1 + c;
+    c = g1 >> 44;
+    g1 &= M44;
+    uint64_t g2 = h2 + c - (1ULL << 42);
+    uint64_t mask = (g2 >> 63) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+
+    uint64_t t0 = st->pad[0], t1 = st->pad[1];
+    h0 += t0 & M44;
+    c = h0 >> 44;
+    h0 &= M44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & M44) + c;
+    c = h1 >> 44;
+    h1 &= M44;
+    h2 += ((t1 >> 24) & M42) + c;
+    h2 &= M42;
+    store64(tag, h0 | (h1 << 44));
+    store64(tag + 8, (h1 >> 20) | (h2 << 24));
+}
+
+// POLY1305 MAC
+// @param tag : Receives the 16 byte tag
+// @param msg : Message of len bytes
+// @param key : One-time 256 bit key
+void poly1305_mac(uint8_t tag[POLY1305_TAG], const uint8_t *msg, size_t len, const uint8_t key[32]) {
+    poly1305_t st;
+    poly1305_init(&st, key);
+    poly1305_update(&st, msg, len);
+    poly1305_finish(&st, tag);
+}
+
+// AEAD TAG OVER AAD AND CIPHERTEXT
+static void aead_tag(uint8_t tag[POLY1305_TAG], const uint8_t *ct, size_t len, const uint8_t *aad,
+    size_t aadlen, const uint8_t key[CHACHA_KEY], const uint8_t nonce[CHACHA_NONCE]) {
+    uint8_t otk[64] = { 0 };
+    chacha20_xor(otk, otk, sizeof(otk), key, nonce, 0);
+    poly1305_t st;
+    poly1305_init(&st, otk);
+    poly1305_update(&st, aad, aadlen);
+    poly1305_pad16(&st);
+    poly1305_update(&st, ct, len);
+    poly1305_pad16(&st);
+    uint8_t lengths[16];
+    store64(lengths, aadlen);
+    store64(lengths + 8, len);
+    poly1305_update(&st, lengths, sizeof(lengths));
+    poly1305_finish(&st, tag);
+}
+
+// AEAD SEAL
+// @param out : Receives len bytes of ciphertext, may equal in
+// @param tag : Receives the authentication tag
+// @param in : Plaintext of len bytes
+// @param aad : Additional data that is authenticated but not encrypted
+// @param key, nonce : Key and a nonce never used with it before
+void aead_seal(uint8_t *out, uint8_t tag[POLY1305_TAG], const uint8_t *in, size_t len,
+    const uint8_t *aad, size_t aadlen, const uint8_t key[CHACHA_KEY],
+    const uint8_t nonce[CHACHA_NONCE]) {
+    chacha20_xor(out, in, len, key, nonce, 1);
+    aead_tag(tag, out, len, aad, aadlen, key, nonce);
+}
+
+// AEAD OPEN
+// @param out : Receives len bytes of plaintext, may equal in
+// @param in : Ciphertext of len bytes
+// @param tag : Tag to check
+// Returns false, without decrypting, when the tag does not match.
+bool aead_open(uint8_t *out, const uint8_t *in, size_t len, const uint8_t tag[POLY1305_TAG],
+    const uint8_t *aad, size_t aadlen, const uint8_t key[CHACHA_KEY],
+    const uint8_t nonce[CHACHA_NONCE]) {
+    uint8_t expect[POLY1305_TAG];
+    aead_tag(expect, in, len, aad, aadlen, key, nonce);
+    uint8_t diff = 0;
+    for (int i = 0; i < POLY1305_TAG; i += 1) {
+        diff |= expect[i] ^ tag[i];
+    }
+    if (diff != 0) {
+        return false;
+    }
+    chacha20_xor(out, in, len, key, nonce, 1);
+    return true;
+}
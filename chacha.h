@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CHACHA_KEY   32
+#define CHACHA_NONCE 12
+#define POLY1305_TAG 16
+
+void chacha20_xor(uint8_t *out, const uint8_t *in, size_t len, const uint8_t key[CHACHA_KEY],
+    const uint8_t nonce[CHACHA_NONCE], uint32_t counter);
+
+void poly1305_mac(uint8_t tag[POLY1305_TAG], const uint8_t *msg, size_t len, const uint8_t key[32]);
+
+void aead_seal(uint8_t *out, uint8_t tag[POLY1305_TAG], const uint8_t *in, size_t len,
+    const uint8_t *aad, size_t aadlen, const uint8_t key[CHACHA_KEY],
+    const uint8_t nonce[CHACHA_NONCE]);
+
+bool aead_open(uint8_t *out, const uint8_t *in, size_t len, const uint8_t tag[POLY1305_TAG],
+    const uint8_t *aad, size_t aadlen, const uint8_t key[CHACHA_KEY],
+    const uint8_t nonce[CHACHA_NONCE]);
@@ -1,65 +1,216 @@
 #include "rsa.h"
+#include "keystore.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "arena.h"
+#include "stats.h"
+#include "tune.h"
+#include "montgomery.h"
+#include <fcntl.h>
+#include <getopt.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#define OPTIONS "hvi:o:n:"
+#define OPTIONS "hvi:o:n:t:q:z:k:u:"
+
+static const struct option LONG_OPTIONS[] = {
+    { "range", required_argument, NULL, 'r' },
+    { "stats", no_argument, NULL, 'S' },
+    { "tune", no_argument, NULL, 'T' },
+    { "profile", required_argument, NULL, 'P' },
+    { NULL, 0, NULL, 0 },
+};
 
 void help(char *exec) {
     fprintf(stderr,
         "SYNOPSIS\n"
         "   Decrypts a file from input to output.\n\n"
         "USAGE\n"
-        "   %s [-hv] [-n privkey] [-i input file] [-o output file]\n"
+        "   %s [-hv] [-n privkey] [-i input file] [-o output file] [-t threads]\n"
+        "          [-q depth] [-z blocks] [-k store -u user] [--range start:len] [--stats]\n"
+        "          [--tune] [--profile file]\n"
         "OPTIONS"
         "   -h              Display program help and usage.\n"
         "   -v              Display verbose program output.\n"
         "   -i infile       Specifies the input file to decrypt ( default: stdin).\n"
         "   -o outfile      Specifies the output file to decrypt ( default: stdout).\n"
-        "   -n privfile     Private key file (default: rsa.priv).\n",
+        "   -n privfile     Private key file (default: rsa.priv).\n"
+        "   -k store        Keystore to take the key from with -u (default: rsa.store).\n"
+        "   -u user         Decrypt with the private key of user in the keystore.\n"
+        "   -t threads      Decrypt blocks on threads workers (default: 0, single threaded).\n"
+        "   -q depth        Batches buffered between the read, decrypt and write stages\n"
+        "                   (default: 4, or 4 per thread).\n"
+        "   -z blocks       Blocks per batch (default: 16).\n"
+        "   --range start:len\n"
+        "                   Decrypt only len bytes from start of a binary container file.\n"
+        "                   Sizes take a K, M or G suffix, a negative start counts from\n"
+        "                   the end and an empty len runs to the end.\n"
+        "   --stats         Print engine counters and stage timers as JSON to stderr.\n"
+        "   --tune          Time the window, threads and batch sizes for this key now and\n"
+        "                   save the fastest to the profile.\n"
+        "   --profile file  Tuning profile, used when it exists and tuned again on a new\n"
+        "                   CPU or key size; -t and -z override it (default: rsa.tune).\n",
         exec);
 }
 
+// PARSE SIZE
+// @param s : Decimal number with an optional K, M or G suffix
+// @param end : Receives the first character after it
+static uint64_t parse_size(const char *s, char **end) {
+    uint64_t v = strtoull(s, end, 10);
+    switch (**end) {
+    case 'G': v <<= 10; // FALLTHROUGH
+    case 'M': v <<= 10; // FALLTHROUGH
+    case 'K':
+        v <<= 10;
+        *end += 1;
+        break;
+    }
+    return v;
+}
+
+// PARSE RANGE
+// @param arg : start:len as given to --range
+// @param start : Receives the start, negative from the end
+// @param len : Receives the length, UINT64_MAX when empty
+static bool parse_range(const char *arg, int64_t *start, uint64_t *len) {
+    char *end;
+    bool back = arg[0] == '-';
+    uint64_t v = parse_size(arg + back, &end);
+    if (end == arg + back || *end != ':' || v > INT64_MAX) {
+        return false;
+    }
+    *start = back ? -(int64_t) v : (int64_t) v;
+    if (end[1] == '\0') {
+        *len = UINT64_MAX;
+        return true;
+    }
+    const char *l = end + 1;
+    *len = parse_size(l, &end);
+    return end != l && *end == '\0';
+}
+
 int main(int argc, char **argv) {
-    FILE *pvfile = fopen("rsa.priv", "r");
+    arena_install(); // BEFORE ANY GMP ALLOCATION
+    FILE *pvfile = NULL;
+    const char *pvpath = "rsa.priv";
+    const char *store = KEYSTORE_DEFAULT;
+    const char *user = NULL;
     FILE *infile = stdin;
     FILE *outfile = stdout;
     int opt = 0;
     bool verbose = false;
+    bool range = false;
+    bool stats = false;
+    bool tune = false, threads_set = false, batch_set = false;
+    const char *profile = TUNE_DEFAULT;
+    int64_t start = 0;
+    uint64_t len = UINT64_MAX;
+    rsa_file_opts_t opts;
+    rsa_file_opts_init(&opts);
 
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, LONG_OPTIONS, NULL)) != -1) {
         switch (opt) {
-        case 'n': pvfile = fopen(optarg, "r"); break;
+        case 'n': pvpath = optarg; break;
+        case 'k': store = optarg; break;
+        case 'u': user = optarg; break;
         case 'i': infile = fopen(optarg, "r"); break;
-        case 'o': outfile = fopen(optarg, "w"); break;
+        case 'o': outfile = fopen(optarg, "w+"); break;
+        case 't': {
+            opts.threads = atoi(optarg);
+            threads_set = true;
+            break;
+        }
+        case 'q': opts.window = atoi(optarg); break;
+        case 'z': {
+            opts.batch = atoi(optarg);
+            batch_set = true;
+            break;
+        }
         case 'v': verbose = true; break;
+        case 'S': stats = true; break;
+        case 'T': tune = true; break;
+        case 'P': profile = optarg; break;
+        case 'r': {
+            range = true;
+            if (!parse_range(optarg, &start, &len)) {
+                fprintf(stderr, "Range must be start:len, for example 0:4K or -1M:.\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        }
         case 'h': {
             help(argv[0]);
             return EXIT_FAILURE;
         }
         }
     }
-    // Read Private Key
-    mpz_t n, e;
-    mpz_inits(n, e, NULL);
-    rsa_read_priv(n, e, pvfile);
+    // Read Private Key, with CRT values when the file carries them
+    rsa_priv_t key;
+    rsa_priv_init(&key);
+    if (user != NULL) {
+        keystore_t ks;
+        int64_t rec = -1;
+        if (!keystore_open(&ks, store) || (rec = keystore_find(&ks, user)) < 0
+            || !keystore_priv(&ks, rec, &key)) {
+            fprintf(stderr, "No private key for %s in %s.\n", user, store);
+            keystore_close(&ks);
+            rsa_priv_clear(&key);
+            return EXIT_FAILURE;
+        }
+        keystore_close(&ks);
+    } else {
+        pvfile = fopen(pvpath, "r");
+        rsa_read_priv_crt(&key, pvfile);
+        fclose(pvfile);
+    }
 
     // If verbose
     if (verbose) {
         // mod n
-        gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
+        gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(key.n, 2), key.n);
         // exp e
-        gmp_printf("e (%d bits) = %Zd\n", mpz_sizeinbase(e, 2), e);
+        gmp_printf("e (%d bits) = %Zd\n", mpz_sizeinbase(key.d, 2), key.d);
+    }
+
+    // Settings from the tuning profile, unless given on the command line
+    tune_t t;
+    if (tune_setup(&t, profile, tune, key.n, NULL, &key)) {
+        mont_window_bias = t.bias;
+        opts.threads = threads_set ? opts.threads : t.threads;
+        opts.batch = batch_set ? opts.batch : t.batch;
+        if (verbose) {
+            fprintf(stderr, "tuned: window bias %ld, %lu threads, %lu blocks per batch\n", t.bias,
+                t.threads, t.batch);
+        }
     }
 
-    // Encrypt using rsa_encrypt_file()
-    rsa_decrypt_file(infile, outfile, n, e);
+    // Where this run's plaintext starts in a regular outfile, so a failure
+    // drops it and nothing that was there before (an appended log, say)
+    struct stat st;
+    int fd = fileno(outfile);
+    off_t origin = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        origin = fcntl(fd, F_GETFL) & O_APPEND ? st.st_size : lseek(fd, 0, SEEK_CUR);
+    }
+
+    // Decrypt using rsa_decrypt_file(), or only the range asked for
+    bool ok = range ? rsa_decrypt_range(infile, outfile, &key, start, len, &opts)
+                    : rsa_decrypt_file_opts(infile, outfile, &key, &opts);
+    if (stats) {
+        stats_json(stderr);
+    }
+
+    // A failed decryption leaves no plaintext behind in a regular outfile
+    fflush(outfile);
+    if (!ok && origin >= 0 && ftruncate(fd, origin) != 0) {
+        fprintf(stderr, "Failed to discard the output.\n");
+    }
 
     // Close public key file and clear any mpz_t vairables used
-    mpz_clears(n, e, NULL);
+    rsa_priv_clear(&key);
     fclose(infile);
     fclose(outfile);
-    fclose(pvfile);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -1,59 +1,159 @@
 #include "rsa.h"
+#include "keystore.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "arena.h"
+#include "stats.h"
+#include "tune.h"
+#include "montgomery.h"
+#include <getopt.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#define OPTIONS "hvi:o:n:"
+#define OPTIONS "hvbxcri:o:n:t:q:z:k:u:"
+
+static const struct option LONG_OPTIONS[] = {
+    { "stats", no_argument, NULL, 'S' },
+    { "tune", no_argument, NULL, 'T' },
+    { "profile", required_argument, NULL, 'P' },
+    { NULL, 0, NULL, 0 },
+};
 
 void help(char *exec) {
     fprintf(stderr,
         "SYNOPSIS\n"
         "   Excryptes a file from input to output.\n\n"
         "USAGE\n"
-        "   %s [-hv] [-n pbfile] [-i input file] [-o output file]\n"
+        "   %s [-hvbxcr] [-n pbfile] [-i input file] [-o output file] [-t threads]\n"
+        "          [-q depth] [-z blocks] [-k store -u user] [--stats] [--tune]\n"
+        "          [--profile file]\n"
         "OPTIONS"
         "   -h              Display program help and usage.\n"
         "   -v              Display verbose program output.\n"
+        "   -b              Write the binary ciphertext container instead of hex lines.\n"
+        "   -x              Hybrid mode: wrap a session key with RSA and stream the file\n"
+        "                   through ChaCha20-Poly1305 in the binary container.\n"
+        "   -c              Compress before block encryption (binary container, not with -x).\n"
+        "   -r              End the binary container in a batch index for decrypt --range\n"
+        "                   (not with -x, whose chunks are found without one).\n"
         "   -i infile       Specifies the input file to encrypt ( default: stdin).\n"
         "   -o outfile      Specifies the output file to decrypt ( default: stdout).\n"
-        "   -n pbfile       Public key file (default: rsa.pub).\n",
+        "   -n pbfile       Public key file (default: rsa.pub).\n"
+        "   -k store        Keystore to take the key from with -u (default: rsa.store).\n"
+        "   -u user         Encrypt to the key of user in the keystore instead of pbfile.\n"
+        "   -t threads      Encrypt blocks on threads workers (default: 0, single threaded).\n"
+        "   -q depth        Batches buffered between the read, encrypt and write stages\n"
+        "                   (default: 4, or 4 per thread).\n"
+        "   -z blocks       Blocks per batch (default: 16).\n"
+        "   --stats         Print engine counters and stage timers as JSON to stderr.\n"
+        "   --tune          Time threads and batch sizes (and the window, for an e wider\n"
+        "                   than a word) for this key now and save the fastest to the\n"
+        "                   profile.\n"
+        "   --profile file  Tuning profile, used when it exists and tuned again on a new\n"
+        "                   CPU or key size; -t and -z override it (default: rsa.tune).\n",
         exec);
 }
 
 int main(int argc, char **argv) {
-    FILE *pbfile = fopen("rsa.pub", "r");
+    arena_install(); // BEFORE ANY GMP ALLOCATION
+    FILE *pbfile = NULL;
+    const char *pbpath = "rsa.pub";
+    const char *store = KEYSTORE_DEFAULT;
+    const char *user = NULL;
     FILE *infile = stdin;
     FILE *outfile = stdout;
     int opt = 0;
     bool verbose = false;
+    bool stats = false;
+    bool tune = false, threads_set = false, batch_set = false;
+    const char *profile = TUNE_DEFAULT;
+    rsa_file_opts_t opts;
+    rsa_file_opts_init(&opts);
 
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, LONG_OPTIONS, NULL)) != -1) {
         switch (opt) {
-        case 'n': pbfile = fopen(optarg, "r"); break;
+        case 'n': pbpath = optarg; break;
+        case 'k': store = optarg; break;
+        case 'u': user = optarg; break;
         case 'i': infile = fopen(optarg, "r"); break;
         case 'o': outfile = fopen(optarg, "w+"); break;
+        case 'b': opts.binary = true; break;
+        case 'x': opts.hybrid = true; break;
+        case 'c': opts.compress = true; break;
+        case 'r': opts.index = true; break;
+        case 't': {
+            opts.threads = atoi(optarg);
+            threads_set = true;
+            break;
+        }
+        case 'q': opts.window = atoi(optarg); break;
+        case 'z': {
+            opts.batch = atoi(optarg);
+            batch_set = true;
+            break;
+        }
         case 'v': verbose = true; break;
+        case 'S': stats = true; break;
+        case 'T': tune = true; break;
+        case 'P': profile = optarg; break;
         case 'h': {
             help(argv[0]);
             return EXIT_FAILURE;
         }
         }
     }
-    // Read Public Key
+    if (opts.hybrid && (opts.compress || opts.index)) {
+        fprintf(stderr, "Hybrid mode (-x) cannot be combined with -c or -r.\n");
+        return EXIT_FAILURE;
+    }
+    // Read Public Key, from the keystore when a user is named
     char *username = NULL;
     username = malloc(sizeof(char) * 100);
     mpz_t n, e, s, mpz_username;
     mpz_inits(n, e, s, mpz_username, NULL);
-    rsa_read_pub(n, e, s, username, pbfile);
+    if (user != NULL) {
+        keystore_t ks;
+        int64_t rec = -1;
+        if (!keystore_open(&ks, store) || (rec = keystore_find(&ks, user)) < 0) {
+            fprintf(stderr, "No key for %s in %s.\n", user, store);
+            keystore_close(&ks);
+            mpz_clears(n, e, s, mpz_username, NULL);
+            free(username);
+            return EXIT_FAILURE;
+        }
+        keystore_pub(&ks, rec, n, e, s, username);
+        keystore_close(&ks);
+    } else {
+        pbfile = fopen(pbpath, "r");
+        rsa_read_pub(n, e, s, username, pbfile);
+        fclose(pbfile);
+    }
 
     // Convert username to mpz_t, verify using rsa_verify()
     mpz_set_str(mpz_username, username, 62);
     rsa_verify(mpz_username, s, e, n);
 
+    // Settings from the tuning profile, unless given on the command line
+    tune_t t;
+    if (tune_setup(&t, profile, tune, n, e, NULL)) {
+        mont_window_bias = t.bias;
+        opts.threads = threads_set ? opts.threads : t.threads;
+        opts.batch = batch_set ? opts.batch : t.batch;
+        if (verbose) {
+            fprintf(stderr, "tuned: window bias %ld, %lu threads, %lu blocks per batch\n", t.bias,
+                t.threads, t.batch);
+        }
+    }
+
     // Encrypt using rsa_encrypt_file()
-    rsa_encrypt_file(infile, outfile, n, e);
+    bool ok = false;
+    if (opts.hybrid && mpz_sizeinbase(n, 2) < RSA_HYBRID_MIN_BITS) {
+        fprintf(stderr, "A %lu-bit key is too small for hybrid mode, which needs %d bits.\n",
+            mpz_sizeinbase(n, 2), RSA_HYBRID_MIN_BITS);
+    } else {
+        ok = rsa_encrypt_file_opts(infile, outfile, n, e, &opts);
+    }
 
     // If verbose
     if (verbose) {
@@ -66,11 +166,14 @@ int main(int argc, char **argv) {
         // exp e
         gmp_printf("e (%d bits) = %Zd\n", mpz_sizeinbase(e, 2), e);
     }
+    if (stats) {
+        stats_json(stderr);
+    }
 
     // Close public key file and clear any mpz_t vairables used
     mpz_clears(n, e, s, mpz_username, NULL);
     fclose(infile);
     fclose(outfile);
-    fclose(pbfile);
     free(username);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -2,46 +2,72 @@
 #include "numtheory.h"
 #include "randstate.h"
 #include <stdlib.h>
+#include <string.h>
 #include "unistd.h"
 #include "time.h"
 #include "sys/stat.h"
+#include "arena.h"
+#include "stats.h"
+#include <getopt.h>
 
-#define OPTIONS "b:i:n:d:s:c:vh"
+#define OPTIONS "b:i:n:d:s:c:e:t:k:pvh"
+
+static const struct option LONG_OPTIONS[] = {
+    { "stats", no_argument, NULL, 'S' },
+    { NULL, 0, NULL, 0 },
+};
 
 void help(char *exec) {
     fprintf(stderr,
         "SYNOPSIS\n"
         "   Generates an RSA public/private pair.\n\n"
         "USAGE\n"
-        "   %s [-hv] [-s seed] [-c confidence] [-b bits] [-n pbfile] [-d pvfile]\n"
+        "   %s [-hvp] [-s seed] [-c confidence] [-b bits] [-e exponent] [-t threads]\n"
+        "   %*s [-k primes] [-n pbfile] [-d pvfile] [--stats]\n"
         "OPTIONS\n"
         "   -h              Display program help and usage.\n"
         "   -v              Display verbose program output.\n"
         "   -b bits         Minimum bits needed for public key n (default: 256).\n"
-        "   -c confidence   Miller-Rabin iterations for testing primes (default: 50).\n"
+        "   -c confidence   Miller-Rabin iterations for testing primes, 0 to pick the\n"
+        "                   count from the prime size (default: 50).\n"
+        "   -p              Test primes with Baillie-PSW instead of Miller-Rabin.\n"
+        "   -t threads      Search for p and q in parallel on threads workers.\n"
+        "   -k primes       Build n from this many balanced primes, 2 to %d (default: 2).\n"
+        "   -e exponent     Odd public exponent, 0 for a random nbits exponent (default: 65537).\n"
         "   -n pbfile       Public key file (default: rsa.pub).\n"
         "   -d pvfile       Private key file (default: rsa.priv).\n"
-        "   -s seed         Random seed for testing (default: time(NULL)).\n",
-        exec);
+        "   -s seed         Random seed for testing (default: time(NULL)).\n"
+        "   --stats         Print prime search counters and timers as JSON to stderr.\n",
+        exec, (int) strlen(exec), "", RSA_MAX_PRIMES);
 }
 
 int main(int argc, char **argv) {
+    arena_install(); // BEFORE ANY GMP ALLOCATION
     FILE *pbfile = fopen("rsa.pub", "w+");
     FILE *pvfile = fopen("rsa.priv", "w+");
     int opt = 0;
     uint64_t nbits = 256;
     uint64_t iters = 50;
+    uint64_t pubexp = 65537;
+    uint64_t threads = 0;
+    uint64_t primes = 2;
     uint64_t seed = time(NULL); // time(NULL) Default Seed
     bool verbose = false;
+    bool stats = false;
 
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, LONG_OPTIONS, NULL)) != -1) {
         switch (opt) {
         case 'b': nbits = atoi(optarg); break;
         case 'c': iters = atoi(optarg); break;
+        case 'e': pubexp = strtoull(optarg, NULL, 10); break;
+        case 'p': iters = MR_ITERS_BPSW; break;
+        case 't': threads = atoi(optarg); break;
+        case 'k': primes = atoi(optarg); break;
         case 'n': pbfile = fopen(optarg, "w+"); break;
         case 'd': pvfile = fopen(optarg, "w+"); break;
         case 's': seed = atoi(optarg); break;
         case 'v': verbose = true; break;
+        case 'S': stats = true; break;
         case 'h': {
             help(argv[0]);
             return EXIT_FAILURE;
@@ -49,6 +75,19 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (pubexp != 0 && (pubexp < 3 || pubexp % 2 == 0)) {
+        fprintf(stderr, "Public exponent must be odd and at least 3.\n");
+        return EXIT_FAILURE;
+    }
+    if (primes < 2 || primes > RSA_MAX_PRIMES || nbits / primes < 64) {
+        fprintf(stderr, "Keys take 2 to %d primes of at least 64 bits each.\n", RSA_MAX_PRIMES);
+        return EXIT_FAILURE;
+    }
+    if (primes > 2 && pubexp == 0) {
+        fprintf(stderr, "Multi-prime keys need a fixed public exponent.\n");
+        return EXIT_FAILURE;
+    }
+
     // fchmod() and filno() to set pvfile permissions to 0600
     // indicating read and write permissions for the user
     // and no permissions for anyone else
@@ -61,8 +100,30 @@ int main(int argc, char **argv) {
     // make the public and private keys
     mpz_t p, q, n, e, d, mpz_username, s;
     mpz_inits(p, q, n, e, d, mpz_username, s, NULL);
-    rsa_make_pub(p, q, n, e, nbits, iters);
-    rsa_make_priv(d, e, p, q);
+    mpz_t r[RSA_MAX_PRIMES];
+    for (uint64_t i = 0; i < primes; i += 1) {
+        mpz_init(r[i]);
+    }
+    if (primes > 2) {
+        rsa_make_pub_multi(r, primes, n, e, nbits, iters, pubexp, seed, threads);
+        mpz_set(p, r[0]);
+        mpz_set(q, r[1]);
+    } else if (threads > 0) {
+        rsa_make_pub_parallel(p, q, n, e, nbits, iters, pubexp, seed, threads);
+    } else if (pubexp == 0) {
+        rsa_make_pub(p, q, n, e, nbits, iters);
+    } else {
+        rsa_make_pub_fixed(p, q, n, e, nbits, iters, pubexp);
+    }
+    rsa_priv_t key;
+    rsa_priv_init(&key);
+    if (primes > 2) {
+        rsa_make_priv_multi(d, e, r, primes);
+        rsa_make_priv_crt_multi(&key, n, d, r, primes);
+    } else {
+        rsa_make_priv(d, e, p, q);
+        rsa_make_priv_crt(&key, n, d, p, q);
+    }
 
     // get the current users name as a string using getenv()
     char *username = getenv("USER");
@@ -71,11 +132,11 @@ int main(int argc, char **argv) {
     // specifying the base as 62
     // use rsa_sign() to compute the signature of the username
     mpz_set_str(mpz_username, username, 62);
-    rsa_sign(s, mpz_username, d, n);
+    rsa_sign_crt(s, mpz_username, &key);
 
     // write the keys to their respective files
     rsa_write_pub(n, e, s, username, pbfile);
-    rsa_write_priv(n, d, pvfile);
+    rsa_write_priv_crt(&key, pvfile);
 
     // if verbose printing is enabled print on trailing newlines
     // printed with information about the number of bits that consitute them
@@ -89,6 +150,10 @@ int main(int argc, char **argv) {
         gmp_printf("p (%d bits) = %Zd\n", mpz_sizeinbase(p, 2), p);
         //  second large prime q
         gmp_printf("q (%d bits) = %Zd\n", mpz_sizeinbase(q, 2), q);
+        //  further primes of a multi-prime key
+        for (uint64_t i = 2; i < primes; i += 1) {
+            gmp_printf("r%lu (%d bits) = %Zd\n", i + 1, mpz_sizeinbase(r[i], 2), r[i]);
+        }
         //  public mod n
         gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
         //  public mod e
@@ -96,10 +161,17 @@ int main(int argc, char **argv) {
         //  private key d
         gmp_printf("d (%d bits) = %Zd\n", mpz_sizeinbase(d, 2), d);
     }
+    if (stats) {
+        stats_json(stderr);
+    }
 
     // close files and use randstate_clear() and clear any used mpz_t
     fclose(pbfile);
     fclose(pvfile);
     randstate_clear();
+    rsa_priv_clear(&key);
+    for (uint64_t i = 0; i < primes; i += 1) {
+        mpz_clear(r[i]);
+    }
     mpz_clears(p, q, n, e, d, mpz_username, s, NULL);
 }
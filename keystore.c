@@ -0,0 +1,267 @@
+#include "keystore.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#define PUB_FIELDS  3 // n, e, s
+#define PRIV_FIELDS 9 // AND d, p, q, dP, dQ, qInv
+
+// LITTLE-ENDIAN WORD HELPERS
+static void put_le(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i += 1) {
+        p[i] = v & 0xFF;
+        v >>= 8;
+    }
+}
+
+static uint64_t get_le(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i -= 1) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// FNV-1a HASH OF A USERNAME
+static uint64_t hash_user(const char *user) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (const uint8_t *p = (const uint8_t *) user; *p != '\0'; p += 1) {
+        h = (h ^ *p) * 0x100000001b3;
+    }
+    return h;
+}
+
+// WORDS IN A NUMBER
+static uint64_t words(const mpz_t x) {
+    return (mpz_sizeinbase(x, 2) + 63) / 64;
+}
+
+// OPEN KEYSTORE
+// @param ks : Receives the mapped store
+// @param path : Keystore file
+// Maps the file read-only and checks that both tables fit in it, so
+// lookups never leave the mapping.
+bool keystore_open(keystore_t *ks, const char *path) {
+    struct stat st;
+    ks->base = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < KEYSTORE_HEADER) {
+        close(fd);
+        return false;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    const uint8_t *h = (const uint8_t *) base;
+    ks->base = h;
+    ks->size = st.st_size;
+    ks->count = get_le(h + 16);
+    ks->buckets = get_le(h + 24);
+    ks->limbs = get_le(h + 32);
+    ks->record = get_le(h + 40);
+    ks->flags = get_le(h + 48);
+    uint64_t index = get_le(h + 56), records = get_le(h + 64);
+    uint64_t fields = ks->flags & KEYSTORE_PRIVATE ? PRIV_FIELDS : PUB_FIELDS;
+    uint64_t size = st.st_size;
+    bool ok = memcmp(h, KEYSTORE_MAGIC, 8) == 0 && get_le(h + 8) == KEYSTORE_VERSION
+        && ks->buckets > 0 && (ks->buckets & (ks->buckets - 1)) == 0 && ks->count < ks->buckets
+        && ks->limbs < (1 << 16)
+        && ks->record == KEYSTORE_USER + 8 + 8 * fields + 8 * fields * ks->limbs
+        && index <= size && ks->buckets <= (size - index) / 8 && records <= size
+        && (ks->count == 0 || ks->count <= (size - records) / ks->record);
+    if (!ok) {
+        keystore_close(ks);
+        return false;
+    }
+    ks->index = h + index;
+    ks->records = h + records;
+    return true;
+}
+
+// CLOSE KEYSTORE
+void keystore_close(keystore_t *ks) {
+    if (ks->base != NULL) {
+        munmap((void *) ks->base, ks->size);
+    }
+    ks->base = NULL;
+}
+
+// FIND USER
+// @param ks : Open keystore
+// @param user : Username to look up
+// Returns the record number, or -1 when the user has no record. With the
+// index at most half full a lookup touches about two slots on average.
+int64_t keystore_find(const keystore_t *ks, const char *user) {
+    uint64_t mask = ks->buckets - 1;
+    uint64_t slot = hash_user(user) & mask;
+    for (uint64_t probe = 0; probe < ks->buckets; probe += 1) {
+        uint64_t rec = get_le(ks->index + 8 * slot);
+        if (rec == 0 || rec > ks->count) {
+            return -1;
+        }
+        const char *name = (const char *) ks->records + (rec - 1) * ks->record;
+        if (strncmp(name, user, KEYSTORE_USER) == 0) {
+            return rec - 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+// LOAD ONE NUMBER OF A RECORD
+// @param o : Receives the number
+// @param ks : Open keystore
+// @param rec : Record start
+// @param field : Field number in record order
+static void load_field(mpz_t o, const keystore_t *ks, const uint8_t *rec, int field) {
+    uint64_t fields = ks->flags & KEYSTORE_PRIVATE ? PRIV_FIELDS : PUB_FIELDS;
+    uint64_t used = get_le(rec + KEYSTORE_USER + 8 + 8 * field);
+    used = used < ks->limbs ? used : ks->limbs;
+    const uint8_t *limbs = rec + KEYSTORE_USER + 8 + 8 * fields + 8 * field * ks->limbs;
+    mpz_import(o, used, -1, 8, -1, 0, limbs);
+}
+
+// READ PUBLIC KEY FROM KEYSTORE
+// @param ks : Open keystore
+// @param rec : Record number from keystore_find
+// @param n : mod n
+// @param e : public exponent e
+// @param s : signature s
+// @param user : Receives the username, KEYSTORE_USER bytes
+void keystore_pub(const keystore_t *ks, int64_t rec, mpz_t n, mpz_t e, mpz_t s, char user[]) {
+    const uint8_t *r = ks->records + rec * ks->record;
+    memcpy(user, r, KEYSTORE_USER);
+    user[KEYSTORE_USER - 1] = '\0';
+    load_field(n, ks, r, 0);
+    load_field(e, ks, r, 1);
+    load_field(s, ks, r, 2);
+}
+
+// READ PRIVATE KEY FROM KEYSTORE
+// @param ks : Open keystore
+// @param rec : Record number from keystore_find
+// @param key : Initialized private key to fill
+// Returns false when the record has no private key.
+bool keystore_priv(const keystore_t *ks, int64_t rec, rsa_priv_t *key) {
+    const uint8_t *r = ks->records + rec * ks->record;
+    uint64_t flags = get_le(r + KEYSTORE_USER);
+    if (!(ks->flags & KEYSTORE_PRIVATE) || !(flags & KEYSTORE_REC_PRIV)) {
+        return false;
+    }
+    load_field(key->n, ks, r, 0);
+    load_field(key->d, ks, r, 3);
+    key->crt = flags & KEYSTORE_REC_CRT;
+    key->extra = 0;
+    if (key->crt) {
+        load_field(key->p, ks, r, 4);
+        load_field(key->q, ks, r, 5);
+        load_field(key->dp, ks, r, 6);
+        load_field(key->dq, ks, r, 7);
+        load_field(key->qinv, ks, r, 8);
+    }
+    return true;
+}
+
+// STORE ONE NUMBER OF A RECORD
+static void store_field(uint8_t *rec, uint64_t fields, uint64_t limbs, int field, const mpz_t x) {
+    size_t used = 0;
+    mpz_export(rec + KEYSTORE_USER + 8 + 8 * fields + 8 * field * limbs, &used, -1, 8, -1, 0, x);
+    put_le(rec + KEYSTORE_USER + 8 + 8 * field, used);
+}
+
+// WRITE KEYSTORE
+// @param outfile : File to write the store to
+// @param entries : Key pairs to store
+// @param count : Number of entries
+// Numbers are padded to the widest one in the store. Private keys are
+// stored when any entry carries one. Returns false on a username that is
+// empty, too long or repeated.
+bool keystore_write(FILE *outfile, keystore_entry_t *entries, uint64_t count) {
+    bool priv = false;
+    uint64_t limbs = 1;
+    for (uint64_t i = 0; i < count; i += 1) {
+        keystore_entry_t *en = &entries[i];
+        priv = priv || en->priv;
+        mpz_srcptr nums[PRIV_FIELDS] = { en->n, en->e, en->s, en->key.d, en->key.p, en->key.q,
+            en->key.dp, en->key.dq, en->key.qinv };
+        for (int f = 0; f < (en->priv ? PRIV_FIELDS : PUB_FIELDS); f += 1) {
+            limbs = words(nums[f]) > limbs ? words(nums[f]) : limbs;
+        }
+    }
+    uint64_t fields = priv ? PRIV_FIELDS : PUB_FIELDS;
+    uint64_t record = KEYSTORE_USER + 8 + 8 * fields + 8 * fields * limbs;
+    uint64_t buckets = 2;
+    while (buckets < 2 * count) {
+        buckets *= 2;
+    }
+
+    // BUILD THE INDEX, REJECTING BAD AND REPEATED NAMES
+    uint8_t *index = (uint8_t *) calloc(buckets, 8);
+    for (uint64_t i = 0; i < count; i += 1) {
+        const char *user = entries[i].user;
+        if (user[0] == '\0' || memchr(user, '\0', KEYSTORE_USER) == NULL) {
+            free(index);
+            return false;
+        }
+        uint64_t slot = hash_user(user) & (buckets - 1);
+        for (uint64_t rec; (rec = get_le(index + 8 * slot)) != 0; slot = (slot + 1) & (buckets - 1)) {
+            if (strcmp(entries[rec - 1].user, user) == 0) {
+                free(index);
+                return false;
+            }
+        }
+        put_le(index + 8 * slot, i + 1);
+    }
+
+    uint8_t header[KEYSTORE_HEADER];
+    memset(header, 0, KEYSTORE_HEADER);
+    memcpy(header, KEYSTORE_MAGIC, 8);
+    put_le(header + 8, KEYSTORE_VERSION);
+    put_le(header + 16, count);
+    put_le(header + 24, buckets);
+    put_le(header + 32, limbs);
+    put_le(header + 40, record);
+    put_le(header + 48, priv ? KEYSTORE_PRIVATE : 0);
+    put_le(header + 56, KEYSTORE_HEADER);
+    put_le(header + 64, KEYSTORE_HEADER + 8 * buckets);
+    fwrite(header, sizeof(uint8_t), KEYSTORE_HEADER, outfile);
+    fwrite(index, sizeof(uint8_t), 8 * buckets, outfile);
+    free(index);
+
+    uint8_t *rec = (uint8_t *) malloc(record);
+    for (uint64_t i = 0; i < count; i += 1) {
+        keystore_entry_t *en = &entries[i];
+        memset(rec, 0, record);
+        strcpy((char *) rec, en->user);
+        store_field(rec, fields, limbs, 0, en->n);
+        store_field(rec, fields, limbs, 1, en->e);
+        store_field(rec, fields, limbs, 2, en->s);
+        if (en->priv) {
+            bool crt = en->key.crt && en->key.extra == 0; // NO ROOM FOR EXTRA PRIMES
+            put_le(rec + KEYSTORE_USER, KEYSTORE_REC_PRIV | (crt ? KEYSTORE_REC_CRT : 0));
+            store_field(rec, fields, limbs, 3, en->key.d);
+            if (crt) {
+                store_field(rec, fields, limbs, 4, en->key.p);
+                store_field(rec, fields, limbs, 5, en->key.q);
+                store_field(rec, fields, limbs, 6, en->key.dp);
+                store_field(rec, fields, limbs, 7, en->key.dq);
+                store_field(rec, fields, limbs, 8, en->key.qinv);
+            }
+        }
+        fwrite(rec, sizeof(uint8_t), record, outfile);
+    }
+    free(rec);
+    return !ferror(outfile);
+}
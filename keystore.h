@@ -0,0 +1,63 @@
+#pragma once
+
+#include "rsa.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+// KEYSTORE FILE
+// Many key pairs in one file made to be mapped and used in place. All
+// integers are 64-bit little-endian words. The header:
+//   magic[8]  0x89 'R' 'S' 'A' 'K' 'E' 'Y' 'S'
+//   version, count (records), buckets (index slots, a power of two at
+//   least twice count), limbs (words per number), record (bytes per
+//   record), flags (KEYSTORE_PRIVATE when records carry private keys),
+//   index and records (file offsets of both tables)
+// The index holds buckets words, each 0 for an empty slot or one more than
+// a record number. A username starts probing at its FNV-1a hash and walks
+// forward until it meets its record or an empty slot.
+// Every record has the same layout, so record i sits at records + i * record:
+//   user[KEYSTORE_USER]  username, NUL padded
+//   flags                KEYSTORE_REC_PRIV when d is set, KEYSTORE_REC_CRT
+//                        when p, q, dP, dQ and qInv are set too; multi-prime
+//                        keys are stored with d alone
+//   used[fields]         words in use of each number
+//   numbers              n, e, s, then d, p, q, dP, dQ, qInv in private
+//                        stores, limbs words each, least significant first
+#define KEYSTORE_MAGIC    "\x89RSAKEYS"
+#define KEYSTORE_VERSION  1
+#define KEYSTORE_HEADER   80
+#define KEYSTORE_USER     64
+#define KEYSTORE_PRIVATE  0x01
+#define KEYSTORE_REC_CRT  0x01
+#define KEYSTORE_REC_PRIV 0x02
+#define KEYSTORE_DEFAULT  "rsa.store"
+
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    uint64_t count, buckets, limbs, record, flags;
+    const uint8_t *index, *records;
+} keystore_t;
+
+// ONE KEY PAIR TO STORE
+// key is only read when priv is set.
+typedef struct {
+    char user[KEYSTORE_USER];
+    mpz_t n, e, s;
+    bool priv;
+    rsa_priv_t key;
+} keystore_entry_t;
+
+bool keystore_open(keystore_t *ks, const char *path);
+
+void keystore_close(keystore_t *ks);
+
+int64_t keystore_find(const keystore_t *ks, const char *user);
+
+void keystore_pub(const keystore_t *ks, int64_t rec, mpz_t n, mpz_t e, mpz_t s, char user[]);
+
+bool keystore_priv(const keystore_t *ks, int64_t rec, rsa_priv_t *key);
+
+bool keystore_write(FILE *outfile, keystore_entry_t *entries, uint64_t count);
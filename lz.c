@@ -0,0 +1,152 @@
+#include "lz.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// LZ77 BLOCK CODEC
+// The LZ4 sequence layout: a token whose high nibble is the literal count
+// and low nibble the match length minus 4, each extended by 255-runs when
+// it is 15, the literals, then a 16 bit little-endian match offset. The
+// last sequence has literals only. Matches are found greedily through a
+// hash of the next four bytes, so memory is the table plus the buffers.
+
+#define HASH_BITS  14
+#define MIN_MATCH  4
+#define LAST_LITS  5 // THE LAST BYTES ARE ALWAYS LITERALS
+#define MATCH_STOP 12 // NO MATCH STARTS THIS CLOSE TO THE END
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash32(uint32_t v) {
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+// EMIT ONE SEQUENCE
+// @param op : Output position
+// @param lit, litlen : Literals before the match
+// @param offset, mlen : Match, mlen = 0 for the closing sequence
+static uint8_t *put_sequence(
+    uint8_t *op, const uint8_t *lit, size_t litlen, size_t offset, size_t mlen) {
+    uint8_t *token = op++;
+    *token = (litlen < 15 ? litlen : 15) << 4;
+    if (litlen >= 15) {
+        op = put_length(op, litlen - 15);
+    }
+    memcpy(op, lit, litlen);
+    op += litlen;
+    if (mlen == 0) {
+        return op;
+    }
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    mlen -= MIN_MATCH;
+    *token |= mlen < 15 ? mlen : 15;
+    if (mlen >= 15) {
+        op = put_length(op, mlen - 15);
+    }
+    return op;
+}
+
+// COMPRESS ONE FRAME
+// @param dst : At least LZ_BOUND(len) bytes
+// @param src : Input of len bytes, at most LZ_FRAME
+// Returns the compressed size, which can exceed len for data that does not
+// compress.
+size_t lz_compress(uint8_t *dst, const uint8_t *src, size_t len) {
+    uint8_t *op = dst;
+    size_t anchor = 0;
+    if (len > MATCH_STOP) {
+        uint32_t *table = (uint32_t *) calloc(1 << HASH_BITS, sizeof(uint32_t));
+        size_t limit = len - MATCH_STOP;
+        size_t ip = 0;
+        while (ip < limit) {
+            uint32_t h = hash32(read32(src + ip));
+            size_t ref = table[h];
+            table[h] = ip;
+            if (ref >= ip || ip - ref > 0xFFFF || read32(src + ref) != read32(src + ip)) {
+                ip += 1;
+                continue;
+            }
+            size_t mlen = MIN_MATCH;
+            while (ip + mlen < len - LAST_LITS && src[ref + mlen] == src[ip + mlen]) {
+                mlen += 1;
+            }
+            op = put_sequence(op, src + anchor, ip - anchor, ip - ref, mlen);
+            ip += mlen;
+            anchor = ip;
+        }
+        free(table);
+    }
+    op = put_sequence(op, src + anchor, len - anchor, 0, 0);
+    return op - dst;
+}
+
+static bool get_length(const uint8_t *src, size_t slen, size_t *ip, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= slen) {
+            return false;
+        }
+        b = src[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+// DECOMPRESS ONE FRAME
+// @param dst : Receives exactly dlen bytes
+// @param src : Compressed frame of slen bytes
+// Returns false for input that is malformed or does not decode to dlen
+// bytes; nothing is ever written or read out of bounds.
+bool lz_decompress(uint8_t *dst, size_t dlen, const uint8_t *src, size_t slen) {
+    size_t ip = 0, op = 0;
+    while (ip < slen) {
+        uint8_t token = src[ip++];
+        size_t lit = token >> 4;
+        if (lit == 15 && !get_length(src, slen, &ip, &lit)) {
+            return false;
+        }
+        if (lit > slen - ip || lit > dlen - op) {
+            return false;
+        }
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == slen) {
+            break; // THE CLOSING SEQUENCE HAS NO MATCH
+        }
+        if (slen - ip < 2) {
+            return false;
+        }
+        size_t offset = src[ip] | (size_t) src[ip + 1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && !get_length(src, slen, &ip, &mlen)) {
+            return false;
+        }
+        mlen += MIN_MATCH;
+        if (offset == 0 || offset > op || mlen > dlen - op) {
+            return false;
+        }
+        for (size_t i = 0; i < mlen; i += 1) { // MATCHES MAY OVERLAP THEIR OWN OUTPUT
+            dst[op + i] = dst[op + i - offset];
+        }
+        op += mlen;
+    }
+    return op == dlen;
+}
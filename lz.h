@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LZ_FRAME 65536 // LARGEST INPUT lz_compress TAKES, MATCH OFFSETS FIT 16 BITS
+
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+size_t lz_compress(uint8_t *dst, const uint8_t *src, size_t len);
+
+bool lz_decompress(uint8_t *dst, size_t dlen, const uint8_t *src, size_t slen);
@@ -0,0 +1,129 @@
+#include "rsa.h"
+#include "keystore.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OPTIONS "hvpo:"
+
+void help(char *exec) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "   Builds a keystore from public and private key files.\n\n"
+        "USAGE\n"
+        "   %s [-hvp] [-o store] key...\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -v              Display verbose program output.\n"
+        "   -p              Also store key.priv for every key that has one.\n"
+        "   -o store        Keystore file to write (default: rsa.store).\n"
+        "   key             Reads key.pub; the username in it names the record.\n",
+        exec);
+}
+
+int main(int argc, char **argv) {
+    const char *path = KEYSTORE_DEFAULT;
+    int opt = 0;
+    bool verbose = false;
+    bool priv = false;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'o': path = optarg; break;
+        case 'p': priv = true; break;
+        case 'v': verbose = true; break;
+        case 'h': {
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+        }
+    }
+    uint64_t count = argc - optind;
+    if (count == 0) {
+        help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Read every key pair
+    keystore_entry_t *entries = (keystore_entry_t *) calloc(count, sizeof(keystore_entry_t));
+    char *file = (char *) malloc(strlen(argv[optind]) + 16);
+    char username[4096];
+    bool ok = true;
+    uint64_t done = 0, privs = 0;
+    for (; ok && done < count; done += 1) {
+        const char *name = argv[optind + done];
+        keystore_entry_t *en = &entries[done];
+        mpz_inits(en->n, en->e, en->s, NULL);
+        rsa_priv_init(&en->key);
+        file = (char *) realloc(file, strlen(name) + 16);
+        sprintf(file, "%s.pub", name);
+        FILE *pbfile = fopen(file, "r");
+        if (pbfile == NULL) {
+            fprintf(stderr, "Could not open %s.\n", file);
+            ok = false;
+            continue;
+        }
+        username[0] = '\0';
+        rsa_read_pub(en->n, en->e, en->s, username, pbfile);
+        fclose(pbfile);
+        if (strlen(username) >= KEYSTORE_USER) {
+            fprintf(stderr, "Username in %s is longer than %d bytes.\n", file, KEYSTORE_USER - 1);
+            ok = false;
+            continue;
+        }
+        strcpy(en->user, username);
+        sprintf(file, "%s.priv", name);
+        FILE *pvfile = priv ? fopen(file, "r") : NULL;
+        if (pvfile != NULL) {
+            rsa_read_priv_crt(&en->key, pvfile);
+            fclose(pvfile);
+            if (mpz_cmp(en->key.n, en->n) != 0) {
+                fprintf(stderr, "%s does not match %s.pub.\n", file, name);
+                ok = false;
+                continue;
+            }
+            en->priv = true;
+            privs += 1;
+        }
+    }
+
+    // Write the store with its index next to path, replacing path only once
+    // the whole store is on disk, so a rejected or failed write keeps the old
+    // one. Anything but a regular file (a device, a pipe) is written in place.
+    if (ok) {
+        struct stat st;
+        bool replace = stat(path, &st) != 0 || S_ISREG(st.st_mode);
+        char *tmp = (char *) malloc(strlen(path) + 8);
+        sprintf(tmp, "%s.tmp", path);
+        FILE *outfile = fopen(replace ? tmp : path, "w");
+        ok = outfile != NULL && keystore_write(outfile, entries, count);
+        if (outfile != NULL && fclose(outfile) != 0) {
+            ok = false;
+        }
+        if (ok && replace && rename(tmp, path) != 0) {
+            ok = false;
+        }
+        if (!ok) {
+            if (replace) {
+                unlink(tmp);
+            }
+            fprintf(stderr, "Could not write %s; usernames must be unique and not empty.\n", path);
+        }
+        free(tmp);
+    }
+
+    // If verbose
+    if (ok && verbose) {
+        fprintf(stderr, "%lu keys, %lu with private keys, written to %s\n", count, privs, path);
+    }
+
+    // Clear any mpz_t variables used
+    for (uint64_t i = 0; i < done; i += 1) {
+        mpz_clears(entries[i].n, entries[i].e, entries[i].s, NULL);
+        rsa_priv_clear(&entries[i].key);
+    }
+    free(entries);
+    free(file);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
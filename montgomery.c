@@ -0,0 +1,443 @@
+#include "montgomery.h"
+#include "arena.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <gmp.h>
+#if defined(__x86_64__) && defined(__GNUC__) && GMP_LIMB_BITS == 64
+#include <cpuid.h>
+#define MONT_X86 1
+#endif
+
+#if GMP_NAIL_BITS != 0
+#error "montgomery.c requires a GMP build without nail bits"
+#endif
+
+bool mont_fixed = true;
+int64_t mont_window_bias = 0;
+
+// FIXED WIDTH KERNEL
+// mul and sqr work on a product on their own stack; redc replaces
+// mont_redc. None of them touch the caller's scratch.
+struct mont_kernel {
+    mp_size_t nn;
+    void (*mul)(mp_limb_t *rp, const mp_limb_t *ap, const mp_limb_t *bp, const mont_ctx_t *ctx);
+    void (*sqr)(mp_limb_t *rp, const mp_limb_t *ap, const mont_ctx_t *ctx);
+    void (*redc)(mp_limb_t *rp, mp_limb_t *tp, const mont_ctx_t *ctx);
+};
+
+// COPY MPZ INTO A ZERO PADDED LIMB ARRAY
+// @param rp : Output array of nn limbs
+// @param a : Non-negative value with at most nn limbs
+// @param nn : Number of limbs to write
+static void limbs_set(mp_limb_t *rp, const mpz_t a, mp_size_t nn) {
+    mp_size_t an = mpz_size(a);
+    if (an > 0) {
+        memcpy(rp, mpz_limbs_read(a), an * sizeof(mp_limb_t));
+    }
+    memset(rp + an, 0, (nn - an) * sizeof(mp_limb_t));
+}
+
+// MONTGOMERY REDUCTION
+// @param rp : Output array of nn limbs, rp = tp * R^-1 mod n
+// @param tp : Input array of 2*nn limbs, destroyed
+// @param ctx : Montgomery context for n
+// Word-by-word REDC. Each step clears the lowest remaining limb of tp and
+// parks the addmul carry in that limb, which lines up with the upper half
+// for the final addition.
+static void mont_redc(mp_limb_t *rp, mp_limb_t *tp, const mont_ctx_t *ctx) {
+    if (ctx->kernel != NULL) {
+        ctx->kernel->redc(rp, tp, ctx);
+        return;
+    }
+    mp_size_t nn = ctx->nn;
+    for (mp_size_t i = 0; i < nn; i += 1) {
+        mp_limb_t q = tp[i] * ctx->ninv;
+        tp[i] = mpn_addmul_1(tp + i, ctx->np, nn, q);
+    }
+    mp_limb_t cy = mpn_add_n(rp, tp + nn, tp, nn);
+    if (cy != 0 || mpn_cmp(rp, ctx->np, nn) >= 0) {
+        mpn_sub_n(rp, rp, ctx->np, nn);
+    }
+}
+
+#ifdef MONT_X86
+#define MONT_STR_(x) #x
+#define MONT_STR(x)  MONT_STR_(x)
+
+// ONE REDUCTION ROW OF N LIMBS
+// tp[0..N) += np[0..N) * m, returning the carry limb. The loop is unrolled
+// by the assembler; mulx leaves the flags alone, so the low halves ride the
+// CF chain (adcx) and the high halves the OF chain (adox) side by side.
+#define MONT_ROW(N)                                                                                 \
+    __attribute__((target("bmi2,adx"))) static inline mp_limb_t row_##N(                            \
+        mp_limb_t *tp, const mp_limb_t *np, mp_limb_t m) {                                          \
+        mp_limb_t cy;                                                                               \
+        __asm__ volatile("xor %%r11d, %%r11d\n\t"                                                   \
+                         ".set k, 0\n\t"                                                            \
+                         ".rept " MONT_STR(N) "\n\t"                                                \
+                         "mulx k*8(%[np]), %%r8, %%r9\n\t"                                          \
+                         "mov k*8(%[tp]), %%r10\n\t"                                                \
+                         "adcx %%r8, %%r10\n\t"                                                     \
+                         "adox %%r11, %%r10\n\t"                                                    \
+                         "mov %%r10, k*8(%[tp])\n\t"                                                \
+                         "mov %%r9, %%r11\n\t"                                                      \
+                         ".set k, k+1\n\t"                                                          \
+                         ".endr\n\t"                                                                \
+                         "mov $0, %%r10d\n\t"                                                       \
+                         "adcx %%r10, %%r11\n\t"                                                    \
+                         "adox %%r10, %%r11\n\t"                                                    \
+                         "mov %%r11, %[cy]\n\t"                                                     \
+                         : [cy] "=r"(cy)                                                            \
+                         : [tp] "r"(tp), [np] "r"(np), "d"(m)                                       \
+                         : "r8", "r9", "r10", "r11", "cc", "memory");                               \
+        return cy;                                                                                  \
+    }
+
+// KERNEL FOR N LIMBS
+// The product comes from GMP's own assembly and lands in a 2N-limb array on
+// the stack; the reduction is N unrolled rows with the same carry parking
+// as mont_redc.
+#define MONT_KERNEL(N)                                                                              \
+    MONT_ROW(N)                                                                                     \
+    __attribute__((target("bmi2,adx"))) static void redc_##N(                                       \
+        mp_limb_t *rp, mp_limb_t *tp, const mont_ctx_t *ctx) {                                      \
+        for (int i = 0; i < N; i += 1) {                                                            \
+            tp[i] = row_##N(tp + i, ctx->np, tp[i] * ctx->ninv);                                    \
+        }                                                                                           \
+        mp_limb_t cy = mpn_add_n(rp, tp + N, tp, N);                                                \
+        if (cy != 0 || mpn_cmp(rp, ctx->np, N) >= 0) {                                              \
+            mpn_sub_n(rp, rp, ctx->np, N);                                                          \
+        }                                                                                           \
+    }                                                                                               \
+    static void mul_##N(                                                                            \
+        mp_limb_t *rp, const mp_limb_t *ap, const mp_limb_t *bp, const mont_ctx_t *ctx) {           \
+        mp_limb_t t[2 * N];                                                                         \
+        if (ap == bp) {                                                                             \
+            mpn_sqr(t, ap, N);                                                                      \
+        } else {                                                                                    \
+            mpn_mul_n(t, ap, bp, N);                                                                \
+        }                                                                                           \
+        redc_##N(rp, t, ctx);                                                                       \
+    }                                                                                               \
+    static void sqr_##N(mp_limb_t *rp, const mp_limb_t *ap, const mont_ctx_t *ctx) {                \
+        mp_limb_t t[2 * N];                                                                         \
+        mpn_sqr(t, ap, N);                                                                          \
+        redc_##N(rp, t, ctx);                                                                       \
+    }                                                                                               \
+    static const mont_kernel_t kernel_##N = { N, mul_##N, sqr_##N, redc_##N };
+
+MONT_KERNEL(16)
+MONT_KERNEL(24)
+MONT_KERNEL(32)
+MONT_KERNEL(48)
+MONT_KERNEL(64)
+
+static const mont_kernel_t *kernels[] = { &kernel_16, &kernel_24, &kernel_32, &kernel_48,
+    &kernel_64 };
+static bool kernels_ok = false;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void kernels_check(void) {
+    unsigned a, b, c, d;
+    kernels_ok = __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_BMI2) && (b & bit_ADX);
+}
+#endif
+
+// KERNEL FOR A WIDTH
+// @param nn : Limbs in the modulus
+// Returns NULL when there is none or the CPU cannot run it.
+static const mont_kernel_t *kernel_for(mp_size_t nn) {
+#ifdef MONT_X86
+    pthread_once(&kernels_once, kernels_check);
+    size_t count = mont_fixed && kernels_ok ? sizeof(kernels) / sizeof(kernels[0]) : 0;
+    for (size_t i = 0; i < count; i += 1) {
+        if (kernels[i]->nn == nn) {
+            return kernels[i];
+        }
+    }
+#else
+    (void) nn;
+#endif
+    return NULL;
+}
+
+// INITIALIZE MONTGOMERY CONTEXT
+// @param ctx : Context to initialize
+// @param n : Odd modulus n
+void mont_init(mont_ctx_t *ctx, const mpz_t n) {
+    ctx->cap = 0;
+    ctx->np = ctx->one = ctx->r2 = NULL;
+    ctx->kernel = NULL;
+    mpz_inits(ctx->n, ctx->t, NULL);
+    mont_set(ctx, n);
+    return;
+}
+
+// SET MONTGOMERY CONTEXT TO ANOTHER MODULUS
+// @param ctx : Initialized context
+// @param n : Odd modulus n
+// Precomputes -n^-1 mod 2^64, R mod n and R^2 mod n. The arrays only grow,
+// so a context reused for moduli of one size never allocates again.
+void mont_set(mont_ctx_t *ctx, const mpz_t n) {
+    mp_size_t nn = mpz_size(n);
+    if (nn > ctx->cap) {
+        size_t old = ctx->cap * sizeof(mp_limb_t), size = nn * sizeof(mp_limb_t);
+        ctx->np = (mp_limb_t *) arena_realloc(ctx->np, old, size);
+        ctx->one = (mp_limb_t *) arena_realloc(ctx->one, old, size);
+        ctx->r2 = (mp_limb_t *) arena_realloc(ctx->r2, old, size);
+        ctx->cap = nn;
+    }
+    mpz_set(ctx->n, n);
+    ctx->nn = nn;
+    limbs_set(ctx->np, n, ctx->nn);
+
+    // NEWTON ITERATION FOR N^-1 MOD 2^64, EACH STEP DOUBLES THE CORRECT BITS
+    mp_limb_t n0 = ctx->np[0];
+    mp_limb_t inv = n0; // CORRECT TO 3 BITS FOR ODD N
+    for (int i = 0; i < 5; i += 1) {
+        inv *= 2 - n0 * inv;
+    }
+    ctx->ninv = -inv;
+
+    mpz_set_ui(ctx->t, 0);
+    mpz_setbit(ctx->t, ctx->nn * GMP_NUMB_BITS); // R
+    mpz_mod(ctx->t, ctx->t, n);
+    limbs_set(ctx->one, ctx->t, ctx->nn);
+    mpz_set_ui(ctx->t, 0);
+    mpz_setbit(ctx->t, 2 * ctx->nn * GMP_NUMB_BITS); // R^2
+    mpz_mod(ctx->t, ctx->t, n);
+    limbs_set(ctx->r2, ctx->t, ctx->nn);
+    ctx->kernel = kernel_for(nn);
+    return;
+}
+
+// CLEAR MONTGOMERY CONTEXT
+// @param ctx : Context to free
+void mont_clear(mont_ctx_t *ctx) {
+    arena_free(ctx->np, ctx->cap * sizeof(mp_limb_t));
+    arena_free(ctx->one, ctx->cap * sizeof(mp_limb_t));
+    arena_free(ctx->r2, ctx->cap * sizeof(mp_limb_t));
+    mpz_clears(ctx->n, ctx->t, NULL);
+    return;
+}
+
+// MONTGOMERY MULTIPLICATION
+// @param rp : Output residue, may alias ap or bp
+// @param ap,bp : Residues in Montgomery form
+// @param tp : Scratch of 2*nn limbs
+// @param ctx : Montgomery context
+// Computes rp = ap * bp * R^-1 mod n.
+void mont_mul(mp_limb_t *rp, const mp_limb_t *ap, const mp_limb_t *bp, mp_limb_t *tp,
+    const mont_ctx_t *ctx) {
+    if (ctx->kernel != NULL) {
+        ctx->kernel->mul(rp, ap, bp, ctx);
+        return;
+    }
+    if (ap == bp) {
+        mpn_sqr(tp, ap, ctx->nn);
+    } else {
+        mpn_mul_n(tp, ap, bp, ctx->nn);
+    }
+    mont_redc(rp, tp, ctx);
+    return;
+}
+
+// MONTGOMERY SQUARING
+// @param rp : Output residue, may alias ap
+// @param ap : Residue in Montgomery form
+// @param tp : Scratch of 2*nn limbs
+// @param ctx : Montgomery context
+void mont_sqr(mp_limb_t *rp, const mp_limb_t *ap, mp_limb_t *tp, const mont_ctx_t *ctx) {
+    if (ctx->kernel != NULL) {
+        ctx->kernel->sqr(rp, ap, ctx);
+        return;
+    }
+    mpn_sqr(tp, ap, ctx->nn);
+    mont_redc(rp, tp, ctx);
+    return;
+}
+
+// CONVERT INTO MONTGOMERY FORM
+// @param rp : Output residue of nn limbs
+// @param a : Any integer, reduced mod n first when out of range
+// @param tp : Scratch of 2*nn limbs
+// @param ctx : Montgomery context
+// Inputs whose quotient fits the scratch, up to 3*nn - 1 limbs, are divided
+// in place without allocating; that covers a ciphertext reduced by either
+// CRT prime even when the primes differ in size.
+void mont_to(mp_limb_t *rp, const mpz_t a, mp_limb_t *tp, const mont_ctx_t *ctx) {
+    mp_size_t an = mpz_size(a);
+    if (mpz_sgn(a) > 0 && an < 3 * ctx->nn && mpz_cmp(a, ctx->n) >= 0) {
+        // QUOTIENT OF AN - NN + 1 LIMBS INTO THE SCRATCH
+        mpn_tdiv_qr(tp, rp, 0, mpz_limbs_read(a), an, ctx->np, ctx->nn);
+    } else if (mpz_sgn(a) < 0 || mpz_cmp(a, ctx->n) >= 0) {
+        mpz_t t;
+        mpz_init(t);
+        mpz_mod(t, a, ctx->n);
+        limbs_set(rp, t, ctx->nn);
+        mpz_clear(t);
+    } else {
+        limbs_set(rp, a, ctx->nn);
+    }
+    mont_mul(rp, rp, ctx->r2, tp, ctx); // a * R^2 * R^-1 = a * R
+    return;
+}
+
+// CONVERT OUT OF MONTGOMERY FORM
+// @param o : Output integer in [0, n)
+// @param ap : Residue in Montgomery form
+// @param tp : Scratch of 2*nn limbs
+// @param ctx : Montgomery context
+void mont_from(mpz_t o, const mp_limb_t *ap, mp_limb_t *tp, const mont_ctx_t *ctx) {
+    mp_size_t nn = ctx->nn;
+    memcpy(tp, ap, nn * sizeof(mp_limb_t));
+    memset(tp + nn, 0, nn * sizeof(mp_limb_t));
+    mont_redc(mpz_limbs_write(o, nn), tp, ctx);
+    mpz_limbs_finish(o, nn);
+    return;
+}
+
+// SLIDING WINDOW SIZE
+// @param ebits : Bit length of the exponent
+// Picks the window that minimizes squarings plus table multiplications,
+// moved by mont_window_bias and kept within 1 to MONT_WINDOW_MAX.
+uint64_t mont_window_bits(uint64_t ebits) {
+    int64_t w = 7;
+    if (ebits <= 7) {
+        w = 1;
+    } else if (ebits <= 25) {
+        w = 2;
+    } else if (ebits <= 81) {
+        w = 3;
+    } else if (ebits <= 241) {
+        w = 4;
+    } else if (ebits <= 673) {
+        w = 5;
+    } else if (ebits <= 1793) {
+        w = 6;
+    }
+    w += mont_window_bias;
+    return w < 1 ? 1 : w > MONT_WINDOW_MAX ? MONT_WINDOW_MAX : w;
+}
+
+// MODULAR EXPONENTIATION IN MONTGOMERY FORM
+// @param o : Output, o = a^d mod n
+// @param a : Base a
+// @param d : Non-negative exponent d
+// @param ctx : Montgomery context for n
+// Left-to-right sliding window over the odd powers a, a^3, ..., a^(2^w - 1).
+void mont_pow(mpz_t o, const mpz_t a, const mpz_t d, const mont_ctx_t *ctx) {
+    size_t size = MONT_POW_SCRATCH(ctx->nn) * sizeof(mp_limb_t);
+    mp_limb_t *sp = (mp_limb_t *) arena_alloc(size);
+    mont_pow_tp(o, a, d, ctx, sp);
+    arena_free(sp, size);
+    return;
+}
+
+// MODULAR EXPONENTIATION IN CALLER SCRATCH
+// @param o : Output, o = a^d mod n
+// @param a : Base a
+// @param d : Non-negative exponent d
+// @param ctx : Montgomery context for n
+// @param sp : Scratch of MONT_POW_SCRATCH(nn) limbs
+// mont_pow without the allocation, for loops that run it per block.
+void mont_pow_tp(mpz_t o, const mpz_t a, const mpz_t d, const mont_ctx_t *ctx, mp_limb_t *sp) {
+    mp_size_t nn = ctx->nn;
+    if (mpz_sgn(d) <= 0) {
+        mpz_set_ui(o, 1);
+        mpz_mod(o, o, ctx->n);
+        return;
+    }
+    int64_t ebits = mpz_sizeinbase(d, 2);
+    uint64_t w = mont_window_bits(ebits);
+    uint64_t tsize = (uint64_t) 1 << (w - 1);
+
+    // TABLE OF ODD POWERS, ACCUMULATOR AND PRODUCT SCRATCH
+    mp_limb_t *table = sp;
+    mp_limb_t *acc = table + tsize * nn;
+    mp_limb_t *tp = acc + nn;
+    mp_limb_t *a2 = tp + 2 * nn;
+
+    mont_to(table, a, tp, ctx);
+    if (tsize > 1) {
+        mont_sqr(a2, table, tp, ctx);
+        for (uint64_t i = 1; i < tsize; i += 1) {
+            mont_mul(table + i * nn, table + (i - 1) * nn, a2, tp, ctx);
+        }
+    }
+
+    // TOP BIT IS SET SO THE FIRST WINDOW ALWAYS EXISTS
+    bool first = true;
+    for (int64_t i = ebits - 1; i >= 0;) {
+        if (mpz_tstbit(d, i) == 0) {
+            mont_sqr(acc, acc, tp, ctx);
+            i -= 1;
+            continue;
+        }
+        // WINDOW FROM BIT i DOWN TO THE LOWEST SET BIT l WITHIN w BITS
+        int64_t l = i - (int64_t) w + 1 < 0 ? 0 : i - (int64_t) w + 1;
+        while (mpz_tstbit(d, l) == 0) {
+            l += 1;
+        }
+        uint64_t val = 0;
+        for (int64_t b = i; b >= l; b -= 1) {
+            val = (val << 1) | mpz_tstbit(d, b);
+        }
+        if (first) {
+            memcpy(acc, table + (val >> 1) * nn, nn * sizeof(mp_limb_t));
+            first = false;
+        } else {
+            for (int64_t b = i; b >= l; b -= 1) {
+                mont_sqr(acc, acc, tp, ctx);
+            }
+            mont_mul(acc, acc, table + (val >> 1) * nn, tp, ctx);
+        }
+        i = l - 1;
+    }
+    mont_from(o, acc, tp, ctx);
+    return;
+}
+
+// MODULAR EXPONENTIATION BY A SMALL EXPONENT
+// @param o : Output, o = a^e mod n
+// @param a : Base a
+// @param e : Single word exponent, typically 3 or 65537
+// @param ctx : Montgomery context for n
+// Plain left-to-right square-and-multiply without a window table. For the
+// usual public exponents 2^k + 1 this is the shortest addition chain: k
+// squarings and a single multiplication.
+void mont_pow_ui(mpz_t o, const mpz_t a, uint64_t e, const mont_ctx_t *ctx) {
+    size_t size = 4 * ctx->nn * sizeof(mp_limb_t);
+    mp_limb_t *sp = (mp_limb_t *) arena_alloc(size);
+    mont_pow_ui_tp(o, a, e, ctx, sp);
+    arena_free(sp, size);
+    return;
+}
+
+// SMALL EXPONENT IN CALLER SCRATCH
+// @param sp : Scratch of at least 4 * nn limbs
+void mont_pow_ui_tp(mpz_t o, const mpz_t a, uint64_t e, const mont_ctx_t *ctx, mp_limb_t *sp) {
+    mp_size_t nn = ctx->nn;
+    if (e == 0) {
+        mpz_set_ui(o, 1);
+        mpz_mod(o, o, ctx->n);
+        return;
+    }
+    mp_limb_t *base = sp;
+    mp_limb_t *acc = base + nn;
+    mp_limb_t *tp = acc + nn;
+    mont_to(base, a, tp, ctx);
+    memcpy(acc, base, nn * sizeof(mp_limb_t));
+    for (int b = 62 - __builtin_clzll(e); b >= 0; b -= 1) {
+        mont_sqr(acc, acc, tp, ctx);
+        if ((e >> b) & 1) {
+            mont_mul(acc, acc, base, tp, ctx);
+        }
+    }
+    mont_from(o, acc, tp, ctx);
+    return;
+}
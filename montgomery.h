@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+// MONTGOMERY CONTEXT FOR AN ODD MODULUS N
+// Residues are nn-limb arrays holding x*R mod n where R = 2^(nn*GMP_NUMB_BITS).
+// A context is read-only once initialized, so it may be shared between threads;
+// every routine that needs scratch space takes it from the caller.
+// mont_set rebuilds a context for another modulus in place, reusing its
+// arrays when they are large enough.
+typedef struct mont_kernel mont_kernel_t;
+
+typedef struct {
+    mp_size_t nn; // LIMBS IN N
+    mp_size_t cap; // LIMBS ALLOCATED FOR np, one AND r2
+    mp_limb_t *np; // LIMBS OF N
+    mp_limb_t ninv; // -N^-1 MOD 2^GMP_NUMB_BITS
+    mp_limb_t *one; // R MOD N (ONE IN MONTGOMERY FORM)
+    mp_limb_t *r2; // R^2 MOD N (USED TO ENTER MONTGOMERY FORM)
+    mpz_t n;
+    mpz_t t; // SCRATCH FOR mont_set ONLY
+    const mont_kernel_t *kernel; // FIXED WIDTH KERNEL FOR nn, NULL FOR THE GENERIC ONE
+} mont_ctx_t;
+
+// FIXED WIDTH KERNELS
+// Moduli of 16, 24, 32, 48 and 64 limbs (the primes and moduli of 2048,
+// 3072 and 4096-bit keys) get a Montgomery reduction unrolled for their
+// width when the CPU has BMI2 and ADX. Clearing mont_fixed before a
+// context is set keeps it on the generic path.
+extern bool mont_fixed;
+
+// WINDOW BIAS
+// Added to the window mont_window_bits picks for every exponent, from a
+// tuning profile (tune.h). The tables of the wider windows cost more than
+// the count of multiplications says on some CPUs, and less on others.
+extern int64_t mont_window_bias;
+
+// SCRATCH LIMBS mont_pow_tp AND mont_pow_ui_tp TAKE, FOR THE WIDEST WINDOW
+#define MONT_WINDOW_MAX 7
+#define MONT_POW_SCRATCH(nn) (((1 << (MONT_WINDOW_MAX - 1)) + 4) * (nn))
+
+void mont_init(mont_ctx_t *ctx, const mpz_t n);
+
+void mont_set(mont_ctx_t *ctx, const mpz_t n);
+
+void mont_clear(mont_ctx_t *ctx);
+
+void mont_mul(mp_limb_t *rp, const mp_limb_t *ap, const mp_limb_t *bp, mp_limb_t *tp,
+    const mont_ctx_t *ctx);
+
+void mont_sqr(mp_limb_t *rp, const mp_limb_t *ap, mp_limb_t *tp, const mont_ctx_t *ctx);
+
+void mont_to(mp_limb_t *rp, const mpz_t a, mp_limb_t *tp, const mont_ctx_t *ctx);
+
+void mont_from(mpz_t o, const mp_limb_t *ap, mp_limb_t *tp, const mont_ctx_t *ctx);
+
+uint64_t mont_window_bits(uint64_t ebits);
+
+void mont_pow(mpz_t o, const mpz_t a, const mpz_t d, const mont_ctx_t *ctx);
+
+void mont_pow_tp(mpz_t o, const mpz_t a, const mpz_t d, const mont_ctx_t *ctx, mp_limb_t *sp);
+
+void mont_pow_ui(mpz_t o, const mpz_t a, uint64_t e, const mont_ctx_t *ctx);
+
+void mont_pow_ui_tp(mpz_t o, const mpz_t a, uint64_t e, const mont_ctx_t *ctx, mp_limb_t *sp);
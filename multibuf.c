@@ -0,0 +1,266 @@
+#include "multibuf.h"
+#include "montgomery.h"
+#include "arena.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gmp.h>
+#if defined(__x86_64__) && defined(__GNUC__) && GMP_LIMB_BITS == 64
+#include <immintrin.h>
+#define MB_X86 1
+#endif
+
+#define MB_BITS  52
+#define MB_MASK  ((UINT64_C(1) << MB_BITS) - 1)
+#define MB_ALIGN 64 // ONE VECTOR OF MB_LANES DIGITS
+
+bool mb_enabled = true;
+
+// SPLIT INTO DIGITS
+// @param out : k * MB_LANES digits, digit j of every lane side by side
+// @param lane : Lane to write
+// @param a : Value below 2^(52k)
+// @param k : Digits
+static void to_digits(uint64_t *out, uint64_t lane, const mpz_t a, uint64_t k) {
+    const mp_limb_t *ap = mpz_limbs_read(a);
+    uint64_t an = mpz_size(a);
+    for (uint64_t j = 0; j < k; j += 1) {
+        uint64_t w = MB_BITS * j / 64, s = MB_BITS * j % 64;
+        uint64_t v = w < an ? ap[w] >> s : 0;
+        if (s > 64 - MB_BITS && w + 1 < an) {
+            v |= ap[w + 1] << (64 - s);
+        }
+        out[j * MB_LANES + lane] = v & MB_MASK;
+    }
+}
+
+// JOIN DIGITS
+// @param o : Output
+// @param in : k * MB_LANES normalized digits
+// @param lane : Lane to read
+// @param k : Digits
+static void from_digits(mpz_t o, const uint64_t *in, uint64_t lane, uint64_t k) {
+    uint64_t on = (MB_BITS * k + 63) / 64;
+    mp_limb_t *op = mpz_limbs_write(o, on);
+    memset(op, 0, on * sizeof(mp_limb_t));
+    for (uint64_t j = 0; j < k; j += 1) {
+        uint64_t w = MB_BITS * j / 64, s = MB_BITS * j % 64;
+        uint64_t v = in[j * MB_LANES + lane];
+        op[w] |= v << s;
+        if (s > 64 - MB_BITS) {
+            op[w + 1] |= v >> (64 - s);
+        }
+    }
+    mpz_limbs_finish(o, on);
+}
+
+// INITIALIZE MULTI-BUFFER CONTEXT
+// @param ctx : Context to initialize
+// @param n : Odd modulus n
+// Returns false, leaving nothing to clear, when the lanes cannot run here.
+bool mb_init(mb_ctx_t *ctx, const mpz_t n) {
+#ifdef MB_X86
+    if (!mb_enabled || !__builtin_cpu_supports("avx512ifma") || mpz_even_p(n)) {
+        return false;
+    }
+    ctx->k = (mpz_sizeinbase(n, 2) + 2 + MB_BITS - 1) / MB_BITS;
+    size_t size = ctx->k * MB_LANES * sizeof(uint64_t);
+    ctx->n = (uint64_t *) aligned_alloc(MB_ALIGN, size);
+    ctx->rr = (uint64_t *) aligned_alloc(MB_ALIGN, size);
+    mpz_init_set(ctx->mod, n);
+
+    // R^2 MOD N TO ENTER MONTGOMERY FORM WITH ONE MULTIPLICATION
+    mpz_t rr;
+    mpz_init(rr);
+    mpz_setbit(rr, 2 * MB_BITS * ctx->k);
+    mpz_mod(rr, rr, n);
+    for (uint64_t l = 0; l < MB_LANES; l += 1) {
+        to_digits(ctx->n, l, n, ctx->k);
+        to_digits(ctx->rr, l, rr, ctx->k);
+    }
+    mpz_clear(rr);
+
+    // NEWTON ITERATION FOR N^-1 MOD 2^64, THEN KEEP 52 BITS
+    uint64_t n0 = mpz_getlimbn(n, 0);
+    uint64_t inv = n0;
+    for (int i = 0; i < 5; i += 1) {
+        inv *= 2 - n0 * inv;
+    }
+    ctx->ninv = -inv & MB_MASK;
+    return true;
+#else
+    (void) ctx;
+    (void) n;
+    return false;
+#endif
+}
+
+// CLEAR MULTI-BUFFER CONTEXT
+void mb_clear(mb_ctx_t *ctx) {
+    free(ctx->n);
+    free(ctx->rr);
+    mpz_clear(ctx->mod);
+}
+
+#ifdef MB_X86
+#define MB_TARGET __attribute__((target("avx512f,avx512ifma")))
+
+// MONTGOMERY MULTIPLICATION ACROSS THE LANES
+// @param r : Output, k vectors, may alias a or b
+// @param a,b : k vectors of normalized digits, each lane below 2N
+// @param ctx : Multi-buffer context
+// @param acc : Scratch of k + 1 vectors
+// One row per digit of b: the products and the reduction by m * N go into
+// 64-bit accumulators a row at a time, and the row shifts down one digit
+// as its lowest digit, now zero, drops off. Each accumulator takes four
+// 52-bit halves per row for at most k rows, so nothing is normalized until
+// the end. With R >= 4N every lane stays below 2N.
+MB_TARGET static void mb_mul(
+    __m512i *r, const __m512i *a, const __m512i *b, const mb_ctx_t *ctx, __m512i *acc) {
+    uint64_t k = ctx->k;
+    const __m512i *n = (const __m512i *) ctx->n;
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i ninv = _mm512_set1_epi64(ctx->ninv);
+    const __m512i mask = _mm512_set1_epi64(MB_MASK);
+    for (uint64_t j = 0; j <= k; j += 1) {
+        acc[j] = zero;
+    }
+    for (uint64_t i = 0; i < k; i += 1) {
+        __m512i bi = b[i];
+        __m512i t = _mm512_madd52lo_epu64(acc[0], a[0], bi);
+        __m512i m = _mm512_madd52lo_epu64(zero, t, ninv);
+        t = _mm512_madd52lo_epu64(t, m, n[0]);
+        __m512i x = _mm512_add_epi64(acc[1], _mm512_srli_epi64(t, MB_BITS));
+        for (uint64_t j = 1; j < k; j += 1) {
+            x = _mm512_madd52lo_epu64(x, a[j], bi);
+            x = _mm512_madd52hi_epu64(x, a[j - 1], bi);
+            x = _mm512_madd52lo_epu64(x, m, n[j]);
+            x = _mm512_madd52hi_epu64(x, m, n[j - 1]);
+            acc[j - 1] = x;
+            x = acc[j + 1];
+        }
+        x = _mm512_madd52hi_epu64(x, a[k - 1], bi);
+        x = _mm512_madd52hi_epu64(x, m, n[k - 1]);
+        acc[k - 1] = x;
+        acc[k] = zero;
+    }
+    __m512i carry = zero;
+    for (uint64_t j = 0; j < k; j += 1) {
+        __m512i x = _mm512_add_epi64(acc[j], carry);
+        r[j] = _mm512_and_si512(x, mask);
+        carry = _mm512_srli_epi64(x, MB_BITS);
+    }
+}
+
+MB_TARGET static void mb_copy(__m512i *r, const __m512i *a, uint64_t k) {
+    for (uint64_t j = 0; j < k; j += 1) {
+        r[j] = a[j];
+    }
+}
+
+// SLIDING WINDOW ACROSS THE LANES
+// @param x : k vectors, the bases on entry and the powers in Montgomery
+//            form on return
+// @param d : Exponent, at least 1
+// @param ctx : Multi-buffer context
+// @param sp : Scratch of (2^(w-1) + 2) * k + 1 vectors
+// The window schedule of mont_pow_tp, shared by every lane.
+MB_TARGET static void mb_pow_lanes(__m512i *x, const mpz_t d, const mb_ctx_t *ctx, __m512i *sp) {
+    uint64_t k = ctx->k;
+    int64_t ebits = mpz_sizeinbase(d, 2);
+    uint64_t w = mont_window_bits(ebits);
+    uint64_t tsize = (uint64_t) 1 << (w - 1);
+    __m512i *table = sp;
+    __m512i *a2 = table + tsize * k;
+    __m512i *acc = a2 + k;
+
+    mb_mul(table, x, (const __m512i *) ctx->rr, ctx, acc);
+    if (tsize > 1) {
+        mb_mul(a2, table, table, ctx, acc);
+        for (uint64_t i = 1; i < tsize; i += 1) {
+            mb_mul(table + i * k, table + (i - 1) * k, a2, ctx, acc);
+        }
+    }
+    bool first = true;
+    for (int64_t i = ebits - 1; i >= 0;) {
+        if (mpz_tstbit(d, i) == 0) {
+            mb_mul(x, x, x, ctx, acc);
+            i -= 1;
+            continue;
+        }
+        int64_t l = i - (int64_t) w + 1 < 0 ? 0 : i - (int64_t) w + 1;
+        while (mpz_tstbit(d, l) == 0) {
+            l += 1;
+        }
+        uint64_t val = 0;
+        for (int64_t b = i; b >= l; b -= 1) {
+            val = (val << 1) | mpz_tstbit(d, b);
+        }
+        if (first) {
+            mb_copy(x, table + (val >> 1) * k, k);
+            first = false;
+        } else {
+            for (int64_t b = i; b >= l; b -= 1) {
+                mb_mul(x, x, x, ctx, acc);
+            }
+            mb_mul(x, x, table + (val >> 1) * k, ctx, acc);
+        }
+        i = l - 1;
+    }
+
+    // OUT OF MONTGOMERY FORM: MULTIPLY BY ONE
+    for (uint64_t j = 0; j < k; j += 1) {
+        a2[j] = _mm512_setzero_si512();
+    }
+    a2[0] = _mm512_set1_epi64(1);
+    mb_mul(x, x, a2, ctx, acc);
+}
+#endif
+
+// MULTI-BUFFER MODULAR EXPONENTIATION
+// @param o : count outputs, o[i] = a[i]^d mod n, may be the inputs
+// @param a : count bases
+// @param count : At most MB_LANES
+// @param d : Exponent shared by every base
+// @param ctx : Context from a successful mb_init
+// Lanes past count run on zeros. The scratch comes from the arena.
+void mb_pow(mpz_ptr o[], mpz_ptr a[], uint64_t count, const mpz_t d, const mb_ctx_t *ctx) {
+#ifdef MB_X86
+    uint64_t k = ctx->k;
+    if (mpz_sgn(d) == 0) {
+        for (uint64_t l = 0; l < count; l += 1) {
+            mpz_set_ui(o[l], mpz_cmp_ui(ctx->mod, 1) != 0);
+        }
+        return;
+    }
+    uint64_t tsize = (uint64_t) 1 << (mont_window_bits(mpz_sizeinbase(d, 2)) - 1);
+    size_t size = ((tsize + 3) * k + 1) * MB_ALIGN + MB_ALIGN;
+    uint8_t *block = (uint8_t *) arena_alloc(size);
+    uint64_t *x = (uint64_t *) (((uintptr_t) block + MB_ALIGN - 1) & ~(uintptr_t) (MB_ALIGN - 1));
+    memset(x, 0, k * MB_ALIGN);
+    for (uint64_t l = 0; l < count; l += 1) {
+        if (mpz_sgn(a[l]) < 0 || mpz_cmp(a[l], ctx->mod) >= 0) {
+            mpz_mod(o[l], a[l], ctx->mod);
+            to_digits(x, l, o[l], k);
+        } else {
+            to_digits(x, l, a[l], k);
+        }
+    }
+    mb_pow_lanes((__m512i *) x, d, ctx, (__m512i *) x + k);
+    for (uint64_t l = 0; l < count; l += 1) {
+        from_digits(o[l], x, l, k);
+        if (mpz_cmp(o[l], ctx->mod) >= 0) {
+            mpz_sub(o[l], o[l], ctx->mod);
+        }
+    }
+    arena_free(block, size);
+#else
+    (void) o;
+    (void) a;
+    (void) count;
+    (void) d;
+    (void) ctx;
+#endif
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+// MULTI-BUFFER EXPONENTIATION
+// Runs MB_LANES exponentiations of different bases by one exponent under
+// one modulus side by side, one vector lane each, with numbers held as
+// radix 2^52 digits for the AVX-512 IFMA multiply-add. The lanes follow
+// the same window schedule, so nothing depends on the data. mb_init
+// refuses when the CPU has no IFMA or mb_enabled is clear, and callers
+// keep to the scalar Montgomery path.
+#define MB_LANES 8
+
+typedef struct {
+    uint64_t k; // RADIX 2^52 DIGITS, R = 2^(52k) >= 4N
+    uint64_t *n; // DIGITS OF N, EACH REPEATED IN EVERY LANE
+    uint64_t *rr; // R^2 MOD N, REPEATED IN EVERY LANE
+    uint64_t ninv; // -N^-1 MOD 2^52
+    mpz_t mod;
+} mb_ctx_t;
+
+extern bool mb_enabled;
+
+bool mb_init(mb_ctx_t *ctx, const mpz_t n);
+
+void mb_clear(mb_ctx_t *ctx);
+
+void mb_pow(mpz_ptr o[], mpz_ptr a[], uint64_t count, const mpz_t d, const mb_ctx_t *ctx);
@@ -1,73 +1,265 @@
 #include "numtheory.h"
+#include "arena.h"
+#include "montgomery.h"
 #include "randstate.h"
+#include "stats.h"
+#include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include <gmp.h>
 
+// WORKSPACE OF EACH THREAD, MADE ON FIRST USE AND FREED WITH THE THREAD
+static _Thread_local nt_ws_t *local_ws = NULL;
+static pthread_key_t ws_key;
+static pthread_once_t ws_once = PTHREAD_ONCE_INIT;
+
+static void ws_release(void *arg) {
+    nt_ws_clear((nt_ws_t *) arg);
+    free(arg);
+}
+
+static void ws_key_init(void) {
+    pthread_key_create(&ws_key, ws_release);
+}
+
+// INITIALIZE WORKSPACE
+// @param ws : Workspace to initialize
+// @param bits : Largest modulus it will see, it grows past that on demand
+void nt_ws_init(nt_ws_t *ws, uint64_t bits) {
+    mpz_t one;
+    mpz_init_set_ui(one, 1);
+    mont_init(&ws->ctx, one);
+    mpz_clear(one);
+    for (int i = 0; i < NT_WS_TEMPS; i += 1) {
+        mpz_init2(ws->t[i], 2 * bits + 2 * GMP_NUMB_BITS);
+    }
+    for (int i = 0; i < NT_WS_LANES; i += 1) {
+        mpz_init(ws->lanes[i]);
+        ws->lane[i] = ws->lanes[i];
+    }
+    ws->nn = 0;
+    ws->limbs = NULL;
+    nt_ws_reserve(ws, bits);
+}
+
+// GROW WORKSPACE
+// @param ws : Initialized workspace
+// @param bits : Modulus size the next call needs
+void nt_ws_reserve(nt_ws_t *ws, uint64_t bits) {
+    mp_size_t nn = (bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+    if (nn > ws->nn) {
+        ws->limbs = (mp_limb_t *) arena_realloc(ws->limbs, NT_WS_LIMBS(ws->nn) * sizeof(mp_limb_t),
+            NT_WS_LIMBS(nn) * sizeof(mp_limb_t));
+        ws->nn = nn;
+    }
+}
+
+// CLEAR WORKSPACE
+void nt_ws_clear(nt_ws_t *ws) {
+    arena_free(ws->limbs, NT_WS_LIMBS(ws->nn) * sizeof(mp_limb_t));
+    mont_clear(&ws->ctx);
+    for (int i = 0; i < NT_WS_TEMPS; i += 1) {
+        mpz_clear(ws->t[i]);
+    }
+    for (int i = 0; i < NT_WS_LANES; i += 1) {
+        mpz_clear(ws->lanes[i]);
+    }
+}
+
+// WORKSPACE OF THE CALLING THREAD
+nt_ws_t *nt_ws_local(void) {
+    if (local_ws == NULL) {
+        pthread_once(&ws_once, ws_key_init);
+        local_ws = (nt_ws_t *) malloc(sizeof(nt_ws_t));
+        nt_ws_init(local_ws, 64);
+        pthread_setspecific(ws_key, local_ws);
+    }
+    return local_ws;
+}
+
+#define LEHMER_BITS 61 // LEADING BITS IN THE ONE WORD APPROXIMATION
+#define LEHMER_GAP  32 // SIZE GAP BEYOND WHICH A PLAIN DIVISION STEP GOES FIRST
+#define HGCD_BITS   16384 // ABOVE THIS GMP'S SUBQUADRATIC HALF-GCD TAKES OVER
+
+// LEADING BITS
+// @param a : Number
+// @param shift : Bits dropped from the bottom
+// Returns a >> shift, which the caller keeps below 2^64.
+static uint64_t top_bits(const mpz_t a, uint64_t shift) {
+    mp_size_t i = shift / GMP_NUMB_BITS;
+    uint64_t r = shift % GMP_NUMB_BITS;
+    uint64_t v = mpz_getlimbn(a, i) >> r;
+    if (r != 0) {
+        v |= (uint64_t) mpz_getlimbn(a, i + 1) << (GMP_NUMB_BITS - r);
+    }
+    return v;
+}
+
+// LEHMER STEP
+// @param a,b : Numbers with a >= b
+// @param m : Receives the cofactors A, B, C, D
+// Runs Euclid on the leading LEHMER_BITS of a and b for as long as the
+// quotients provably match the full ones (Knuth's Algorithm L). All four
+// bounds stay in [0, 2^61], so the products fit a signed word. Returns
+// false when not even one quotient could be settled.
+static bool lehmer_step(const mpz_t a, const mpz_t b, int64_t m[4]) {
+    uint64_t shift = mpz_sizeinbase(a, 2) - LEHMER_BITS;
+    int64_t x = top_bits(a, shift), y = top_bits(b, shift);
+    int64_t A = 1, B = 0, C = 0, D = 1;
+    while (y + C != 0 && y + D != 0) {
+        int64_t q = (x + A) / (y + C);
+        if (q != (x + B) / (y + D)) {
+            break;
+        }
+        int64_t t = A - q * C;
+        A = C;
+        C = t;
+        t = B - q * D;
+        B = D;
+        D = t;
+        t = x - q * y;
+        x = y;
+        y = t;
+    }
+    m[0] = A;
+    m[1] = B;
+    m[2] = C;
+    m[3] = D;
+    return B != 0;
+}
+
+// o = x * a + y * b
+static void combine(mpz_t o, int64_t x, const mpz_t a, int64_t y, const mpz_t b) {
+    mpz_mul_si(o, a, x);
+    if (y >= 0) {
+        mpz_addmul_ui(o, b, y);
+    } else {
+        mpz_submul_ui(o, b, -(uint64_t) y);
+    }
+}
+
+// LEHMER EUCLID
+// @param g : Output, gcd(|a|, |b|)
+// @param s : Output when not NULL, with s * a = g (mod b)
+// @param a,b : Numbers
+// Each Lehmer step folds about 30 quotients into one 2x2 word matrix, which
+// is applied to the full numbers with four single-word multiplies instead
+// of a full division per quotient. A plain division step handles very
+// uneven sizes and the last word. The temporaries are workspace 0 to 6.
+static void lehmer(mpz_t g, mpz_t s, const mpz_t a, const mpz_t b) {
+    nt_ws_t *ws = nt_ws_local();
+    mpz_ptr r0 = ws->t[0], r1 = ws->t[1], t0 = ws->t[2], t1 = ws->t[3];
+    mpz_ptr u0 = ws->t[4], u1 = ws->t[5], q = ws->t[6];
+    bool ext = s != NULL;
+    // R0 = U0 * A, R1 = U1 * A (MOD B)
+    mpz_abs(r0, b);
+    mpz_abs(r1, a);
+    mpz_set_ui(u0, 0);
+    mpz_set_ui(u1, 1);
+    if (mpz_sgn(a) < 0) {
+        mpz_neg(u1, u1);
+    }
+    if (mpz_cmp(r0, r1) < 0) {
+        mpz_swap(r0, r1);
+        mpz_swap(u0, u1);
+    }
+    int64_t m[4];
+    while (mpz_sgn(r1) != 0) {
+        if (mpz_sizeinbase(r0, 2) > LEHMER_BITS
+            && mpz_sizeinbase(r0, 2) - mpz_sizeinbase(r1, 2) < LEHMER_GAP && lehmer_step(r0, r1, m)) {
+            combine(t0, m[0], r0, m[1], r1);
+            combine(t1, m[2], r0, m[3], r1);
+            mpz_swap(r0, t0);
+            mpz_swap(r1, t1);
+            if (ext) {
+                combine(t0, m[0], u0, m[1], u1);
+                combine(t1, m[2], u0, m[3], u1);
+                mpz_swap(u0, t0);
+                mpz_swap(u1, t1);
+            }
+            continue;
+        }
+        mpz_tdiv_qr(q, t0, r0, r1); // R0 = Q * R1 + T0
+        mpz_swap(r0, r1);
+        mpz_swap(r1, t0);
+        if (ext) {
+            mpz_submul(u0, q, u1);
+            mpz_swap(u0, u1);
+        }
+    }
+    mpz_set(g, r0);
+    if (ext) {
+        mpz_set(s, u0);
+    }
+}
+
 // GREATEST COMMON DIVISOR
 // @param g : Output to store GCD value in
 // @param a,b : Numbers to calculate the greatest common divisor of
-// Calculues the greatest common divisor of two parameterized numbers.
+// Calculues the greatest common divisor of two parameterized numbers with
+// Lehmer's method. Past HGCD_BITS the quadratic methods lose to GMP's
+// half-GCD, which mpz_gcd switches to at those sizes.
 void gcd(mpz_t g, mpz_t a, mpz_t b) {
-    mpz_t tmp_a, tmp_b, t;
-    mpz_inits(t, tmp_a, tmp_b, NULL);
-    mpz_set(tmp_b, b);
-    mpz_set(tmp_a, a);
-    while (mpz_cmp_ui(tmp_b, 0) != 0) {
-        mpz_set(t, tmp_b);
-        mpz_mod(tmp_b, tmp_a, tmp_b);
-        mpz_set(tmp_a, t);
+    STAT_ADD(STAT_GCD, 1);
+    if (mpz_sizeinbase(a, 2) > HGCD_BITS && mpz_sizeinbase(b, 2) > HGCD_BITS) {
+        mpz_gcd(g, a, b);
+        return;
     }
-    mpz_set(g, tmp_a);
-    mpz_clears(t, tmp_a, tmp_b, NULL);
+    lehmer(g, NULL, a, b);
+}
+
+// EXTENDED GREATEST COMMON DIVISOR
+// @param g : Output, gcd(a, b)
+// @param s : Output, with s * a = g (mod b)
+// @param a,b : Numbers
+// Lehmer's method tracking the cofactor of a only, or mpz_gcdext past
+// HGCD_BITS.
+void gcd_ext(mpz_t g, mpz_t s, mpz_t a, mpz_t b) {
+    STAT_ADD(STAT_GCD, 1);
+    if (mpz_sizeinbase(a, 2) > HGCD_BITS && mpz_sizeinbase(b, 2) > HGCD_BITS) {
+        mpz_gcdext(g, s, NULL, a, b);
+        return;
+    }
+    lehmer(g, s, a, b);
 }
 
 // MODULAR INVERSE
 // @param o : Initialized variable to store output into
 // @param a : Base a
 // @param n : Modulo n
-// Calculates the modular inverse o of a mod n.
+// Calculates the modular inverse o of a mod n, or 0 when there is none.
 void mod_inverse(mpz_t o, mpz_t a, mpz_t n) {
-    // DECLARE & INITIALIZE VARIABLES
-    mpz_t q, t, tP, r, rP, tmp;
-    mpz_inits(q, t, tP, r, rP, tmp, NULL);
-    mpz_set(r, n); // r = n
-    mpz_set(rP, a); // r' = a
-    mpz_set_ui(t, 0); // t = 0
-    mpz_set_ui(tP, 1); // t' = 1
-    mpz_set_ui(q, 0); // q = 0
-    mpz_set_ui(tmp, 0); // tmp = 0
-    while (mpz_cmp_ui(rP, 0) != 0) { // if r' != 0
-        mpz_fdiv_q(q, r, rP); // q = floor(r/r')
-
-        mpz_set(tmp, r); // tmp = r
-        mpz_set(r, rP); // r = r'
-        mpz_mul(rP, q, rP); // r' = q*r'
-        mpz_sub(rP, tmp, rP); // r' = tmp - r'
-
-        mpz_set(tmp, t); // tmp = t
-        mpz_set(t, tP); // t = t'
-        mpz_mul(tP, q, tP); // t' = q*t'
-        mpz_sub(tP, tmp, tP); // t' = tmp - t'
-    }
-    if (mpz_cmp_ui(r, 1) == 1) { // if r > 1
-        mpz_set_ui(o, 0); // return no inverse
-        mpz_clears(q, t, tP, r, rP, tmp);
-        return;
+    STAT_ADD(STAT_MOD_INVERSE, 1);
+    nt_ws_t *ws = nt_ws_local();
+    mpz_ptr g = ws->t[7], s = ws->t[8];
+    gcd_ext(g, s, a, n);
+    if (mpz_cmp_ui(g, 1) != 0) { // NO INVERSE
+        mpz_set_ui(o, 0);
+    } else {
+        mpz_mod(o, s, n);
     }
-    if (mpz_cmp_ui(t, 0) == -1) { // if t < 0
-        mpz_add(t, t, n); // t += n
-        mpz_set(o, t); // return t
-        mpz_clears(q, t, tP, r, rP, tmp);
-        return;
-    }
-    mpz_set(o, t); // return t
-    mpz_clears(q, t, tP, r, rP, tmp);
     return;
 }
 
+// MODULAR EXPONENTIATION
+// @param o : Output, o = a^d mod n
+// @param a : Base a
+// @param d : Exponent d
+// @param n : Modulus n
+// Odd moduli (every RSA and Miller-Rabin modulus) run on the Montgomery
+// sliding window engine. Even moduli keep the plain binary method.
 void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
+    STAT_ADD(STAT_POW_MOD, 1);
+    if (mpz_odd_p(n)) {
+        nt_ws_t *ws = nt_ws_local();
+        nt_ws_reserve(ws, mpz_sizeinbase(n, 2));
+        mont_set(&ws->ctx, n);
+        mont_pow_tp(o, a, d, &ws->ctx, ws->limbs);
+        return;
+    }
     mpz_t tmp, v, p, exp;
     mpz_init_set_ui(v, 1); // v = 1
     mpz_init_set(p, a); // p = a
@@ -88,11 +280,146 @@ void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
     return;
 }
 
+// MODULAR EXPONENTIATION BY A SMALL EXPONENT
+// @param o : Output, o = a^e mod n
+// @param a : Base a
+// @param e : Single word exponent e
+// @param n : Modulus n
+// Fast path for small public exponents such as 65537.
+void pow_mod_ui(mpz_t o, mpz_t a, uint64_t e, mpz_t n) {
+    STAT_ADD(STAT_POW_MOD, 1);
+    if (mpz_odd_p(n)) {
+        nt_ws_t *ws = nt_ws_local();
+        nt_ws_reserve(ws, mpz_sizeinbase(n, 2));
+        mont_set(&ws->ctx, n);
+        mont_pow_ui_tp(o, a, e, &ws->ctx, ws->limbs);
+        return;
+    }
+    mpz_powm_ui(o, a, e, n);
+    return;
+}
+
+// MILLER-RABIN ROUNDS FOR A RANDOM CANDIDATE
+// @param bits : Bit length of the candidate
+// OpenSSL's table, from Damgard, Landrock and Pomerance's average case
+// bounds for a random odd candidate (FIPS 186-4 F.1). It is not a fixed
+// 2^-128: each size gets the security level of a two prime RSA key twice
+// its length, roughly 2^-80 at 512 bits, 2^-112 at 1024, 2^-128 at 1536 and
+// 2^-192 from 3747. Below 308 bits the average case bound is weak, and 27
+// rounds (34 below 55 bits) only give the worst case 4^-t, about 2^-54.
+// Callers that need more pass a round count or MR_ITERS_BPSW to is_prime.
+uint64_t mr_rounds(uint64_t bits) {
+    if (bits >= 3747) {
+        return 3;
+    } else if (bits >= 1345) {
+        return 4;
+    } else if (bits >= 476) {
+        return 5;
+    } else if (bits >= 400) {
+        return 6;
+    } else if (bits >= 347) {
+        return 7;
+    } else if (bits >= 308) {
+        return 8;
+    } else if (bits >= 55) {
+        return 27;
+    }
+    return 34;
+}
+
+// STRONG LUCAS PROBABLE PRIME TEST
+// @param n : Odd number n > 3 to test
+// Selfridge's method A picks the first D in 5, -7, 9, -11, ... with
+// Jacobi(D/n) = -1, with P = 1 and Q = (1 - D)/4. Writing n + 1 = 2^s * d
+// with d odd, n passes if U_d = 0 or V_(d*2^r) = 0 for some 0 <= r < s.
+static bool is_lucas_prime(mpz_t n) {
+    // PERFECT SQUARES NEVER GIVE JACOBI -1, SO THE SEARCH FOR D WOULD NOT END
+    if (mpz_perfect_square_p(n)) {
+        return false;
+    }
+    long D = 5;
+    for (;;) {
+        int j = mpz_si_kronecker(D, n);
+        if (j == -1) {
+            break;
+        }
+        if (j == 0) { // D SHARES A FACTOR WITH N
+            return mpz_cmpabs_ui(n, labs(D)) == 0;
+        }
+        D = D > 0 ? -(D + 2) : -(D - 2);
+    }
+    long Q = (1 - D) / 4;
+
+    // n + 1 = 2^s * d
+    nt_ws_t *ws = nt_ws_local();
+    mpz_ptr d = ws->t[0], U = ws->t[1], V = ws->t[2], Qk = ws->t[3], t = ws->t[4];
+    mpz_add_ui(d, n, 1);
+    uint64_t s = mpz_scan1(d, 0);
+    mpz_tdiv_q_2exp(d, d, s);
+
+    // LEFT TO RIGHT OVER THE BITS OF d STARTING FROM U_1 = 1, V_1 = P = 1
+    mpz_set_ui(U, 1);
+    mpz_set_ui(V, 1);
+    mpz_set_si(Qk, Q);
+    mpz_mod(Qk, Qk, n);
+    for (int64_t b = mpz_sizeinbase(d, 2) - 2; b >= 0; b -= 1) {
+        // DOUBLE: U_2k = U_k V_k, V_2k = V_k^2 - 2Q^k
+        mpz_mul(U, U, V);
+        mpz_mod(U, U, n);
+        mpz_mul(V, V, V);
+        mpz_submul_ui(V, Qk, 2);
+        mpz_mod(V, V, n);
+        mpz_mul(Qk, Qk, Qk);
+        mpz_mod(Qk, Qk, n);
+        if (mpz_tstbit(d, b)) {
+            // INCREMENT: U_k+1 = (U_k + V_k)/2, V_k+1 = (D U_k + V_k)/2
+            mpz_mul_si(t, U, D);
+            mpz_add(U, U, V);
+            mpz_add(V, V, t);
+            if (mpz_odd_p(U)) {
+                mpz_add(U, U, n);
+            }
+            if (mpz_odd_p(V)) {
+                mpz_add(V, V, n);
+            }
+            mpz_fdiv_q_2exp(U, U, 1);
+            mpz_fdiv_q_2exp(V, V, 1);
+            mpz_mod(U, U, n);
+            mpz_mod(V, V, n);
+            mpz_mul_si(Qk, Qk, Q);
+            mpz_mod(Qk, Qk, n);
+        }
+    }
+
+    bool prime = mpz_sgn(U) == 0 || mpz_sgn(V) == 0;
+    for (uint64_t r = 1; r < s && !prime; r += 1) {
+        mpz_mul(V, V, V);
+        mpz_submul_ui(V, Qk, 2);
+        mpz_mod(V, V, n);
+        mpz_mul(Qk, Qk, Qk);
+        mpz_mod(Qk, Qk, n);
+        prime = mpz_sgn(V) == 0;
+    }
+    return prime;
+}
+
 // MILLER-RABIN PRIMALITY TEST
 // @param n : Number n to calculate the primality of
 // @param iters : Number of iterations to run the test for
 // Calculate whether or not n is prime using iters number of iterations
+// MR_ITERS_ADAPTIVE picks the round count from the bit size of n with
+// mr_rounds. MR_ITERS_BPSW runs Baillie-PSW instead: one strong test to
+// base 2 followed by a strong Lucas test.
 bool is_prime(mpz_t n, uint64_t iters) {
+    return is_prime_r(n, iters, state);
+}
+
+// MILLER-RABIN PRIMALITY TEST WITH AN EXPLICIT RANDOM STATE
+// @param n : Number n to calculate the primality of
+// @param iters : Number of iterations, or MR_ITERS_ADAPTIVE / MR_ITERS_BPSW
+// @param rs : Random state the bases are drawn from
+// Lets each thread of a parallel search draw bases from its own stream.
+bool is_prime_r(mpz_t n, uint64_t iters, gmp_randstate_t rs) {
 
     // IF IS EVEN AND GREATER THAN TWO IT IS NEVER PRIME
     if ((mpz_cmp_ui(n, 2) < 0) || (mpz_even_p(n) != 0 && mpz_cmp_ui(n, 2) != 0)) {
@@ -104,56 +431,180 @@ bool is_prime(mpz_t n, uint64_t iters) {
         return true;
     }
 
-    // DECLARE AND INITIALIZE VARIABLES
-    mpz_t n_1, r, j, y, a, two, s_1, n_4;
-    mpz_inits(n_1, r, j, s_1, y, a, two, n_4, NULL);
+    bool bpsw = iters == MR_ITERS_BPSW;
+    if (bpsw) {
+        iters = 1;
+    } else if (iters == MR_ITERS_ADAPTIVE) {
+        iters = mr_rounds(mpz_sizeinbase(n, 2));
+    }
+
+    // TEMPORARIES FROM THE WORKSPACE, NOTHING IS ALLOCATED PER CANDIDATE
+    nt_ws_t *ws = nt_ws_local();
+    nt_ws_reserve(ws, mpz_sizeinbase(n, 2));
+    mpz_ptr n_1 = ws->t[0], r = ws->t[1], y = ws->t[2], a = ws->t[3], n_4 = ws->t[4];
     mpz_sub_ui(n_1, n, 1); // n_1 = n-1
     mpz_sub_ui(n_4, n, 4); // n_4 = n-4
-    uint64_t s = 0;
 
     // Write n-1 = 2exp(s)*r
-    while (mpz_even_p(r)) { // While r is an even integer
-        mpz_tdiv_q_2exp(r, n_1, s); // r = (n-1)/2^s
-        mpz_fdiv_q_ui(r, r, 2); // r /= 2
-        s += 1; // s++
-    }
-
-    mpz_init_set_ui(s_1, s - 1);
-    for (uint64_t i = 0; i < iters; i += 1) {
-        // choose random a from 2 to n-2
-        mpz_urandomm(a, state, n_4); // random a from 2 to n-2
-        mpz_add_ui(a, a, 2);
-        pow_mod(y, a, r, n);
+    uint64_t s = mpz_scan1(n_1, 0);
+    mpz_tdiv_q_2exp(r, n_1, s);
+
+    // ONE MONTGOMERY CONTEXT SERVES EVERY ROUND. THE SQUARING CHAIN STAYS IN
+    // MONTGOMERY FORM AND IS COMPARED AGAINST R MOD N AND -R MOD N.
+    mont_ctx_t *ctx = &ws->ctx;
+    mont_set(ctx, n);
+    mp_size_t nn = ctx->nn;
+    mp_limb_t *ym = ws->limbs;
+    mp_limb_t *m1 = ym + nn; // -1 IN MONTGOMERY FORM
+    mp_limb_t *tp = m1 + nn;
+    mp_limb_t *sp = tp + 2 * nn; // mont_pow_tp SCRATCH
+    assert(sp + MONT_POW_SCRATCH(nn) <= ws->limbs + NT_WS_LIMBS(ws->nn));
+    mpn_sub_n(m1, ctx->np, ctx->one, nn);
+
+    bool prime = true;
+    for (uint64_t i = 0; i < iters && prime; i += 1) {
+        STAT_ADD(STAT_MR_ROUNDS, 1);
+        if (bpsw) {
+            mpz_set_ui(a, 2); // BAILLIE-PSW USES THE FIXED BASE 2
+        } else {
+            // choose random a from 2 to n-2
+            mpz_urandomm(a, rs, n_4); // random a from 2 to n-2
+            mpz_add_ui(a, a, 2);
+        }
+        mont_pow_tp(y, a, r, ctx, sp);
         if (mpz_cmp_ui(y, 1) != 0 && mpz_cmp(y, n_1) != 0) {
-            mpz_set_ui(j, 1); // j = 1
-            mpz_set_ui(two, 2);
-            while (mpz_cmp(j, s_1) != 1 && mpz_cmp(y, n_1) != 0) {
-                pow_mod(y, y, two, n); // causing failure, after multiple passes, leads to 1
-                if (mpz_cmp_ui(y, 1) == 0) { // if y == 1
-                    mpz_clears(n_1, r, j, y, a, two, s_1, n_4, NULL);
-                    return false; // not prime // 17 is failing here
+            mont_to(ym, y, tp, ctx);
+            uint64_t j = 1;
+            while (j <= s - 1 && mpn_cmp(ym, m1, nn) != 0) {
+                mont_sqr(ym, ym, tp, ctx); // y = y^2 mod n
+                if (mpn_cmp(ym, ctx->one, nn) == 0) { // if y == 1
+                    prime = false; // not prime
+                    break;
+                }
+                j += 1;
+            }
+            if (mpn_cmp(ym, m1, nn) != 0) { // if y != n-1
+                prime = false; // not prime
+            }
+        }
+    }
+    if (prime && bpsw) {
+        STAT_ADD(STAT_LUCAS_TESTS, 1);
+        prime = is_lucas_prime(n);
+    }
+    return prime;
+}
+
+// SMALL PRIME TABLE FOR SIEVING
+// The odd primes 3, 5, 7, ... below SIEVE_LIMIT, built once on first use.
+#define SIEVE_LIMIT 17864 // 2048 ODD PRIMES
+#define SIEVE_MAX_STEP  (1 << 20) // RESTART THE WALK AFTER THIS MANY STEPS
+static uint16_t sieve_primes[2048];
+static uint64_t sieve_count = 0;
+static pthread_once_t sieve_once = PTHREAD_ONCE_INIT;
+
+static void sieve_init(void) {
+    static bool composite[SIEVE_LIMIT];
+    for (uint64_t i = 3; i < SIEVE_LIMIT; i += 2) {
+        if (!composite[i]) {
+            sieve_primes[sieve_count] = i;
+            sieve_count += 1;
+            for (uint64_t j = i * i; j < SIEVE_LIMIT; j += 2 * i) {
+                composite[j] = true;
+            }
+        }
+    }
+    return;
+}
+
+// SIEVED PRIME WALK
+// @param p : Variable to store prime number in
+// @param bits : Exact number of bits for prime number p
+// @param iters : Iterations to run Miller-Rabin primality test for
+// @param coprime : Value p-1 must be coprime to, 0 for no constraint
+// @param steps : Maximum number of odd candidates to walk over
+// @param rs : Random state for the start point and Miller-Rabin bases
+// Picks one random odd start point with the top bit forced and walks
+// forward two at a time. Residues of the candidate modulo the small primes
+// are updated with each step, so only candidates free of small factors are
+// handed to is_prime. Returns false if no prime was found within steps or
+// before the walk would leave the bit length.
+bool make_prime_walk(
+    mpz_t p, uint64_t bits, uint64_t iters, uint64_t coprime, uint64_t steps, gmp_randstate_t rs) {
+    pthread_once(&sieve_once, sieve_init);
+    if (bits < 2) {
+        bits = 2;
+    }
+    // ONLY SIEVE BY PRIMES BELOW THE SMALLEST CANDIDATE 2^(bits-1)
+    uint64_t count = 0;
+    while (count < sieve_count && (bits > 16 || sieve_primes[count] < (1u << (bits - 1)))) {
+        count += 1;
+    }
+    uint16_t residues[2048];
+    mpz_t start;
+    mpz_init(start);
+    mpz_urandomb(start, rs, bits);
+    mpz_setbit(start, bits - 1); // EXACT BIT LENGTH
+    mpz_setbit(start, 0); // ODD
+    for (uint64_t i = 0; i < count; i += 1) {
+        residues[i] = mpz_fdiv_ui(start, sieve_primes[i]);
+    }
+    bool found = false;
+    uint64_t step = 0;
+    for (; step < steps && !found; step += 1) {
+        bool survivor = true;
+        for (uint64_t i = 0; i < count; i += 1) {
+            survivor &= residues[i] != 0;
+        }
+        if (survivor) {
+            mpz_add_ui(p, start, 2 * step);
+            if (mpz_sizeinbase(p, 2) > bits) {
+                break; // WALKED PAST 2^bits
+            }
+            // GCD(P-1, COPRIME) FROM (P-1) MOD COPRIME, BEFORE ANY MILLER-RABIN WORK
+            uint64_t g = 1;
+            if (coprime != 0) {
+                uint64_t a = (mpz_fdiv_ui(p, coprime) + coprime - 1) % coprime, b = coprime;
+                while (a != 0) {
+                    uint64_t t = b % a;
+                    b = a;
+                    a = t;
                 }
-                mpz_add_ui(j, j, 1); // j += 1
+                g = b;
             }
-            if (mpz_cmp(y, n_1) != 0) { // if y != n-1
-                mpz_clears(n_1, r, j, y, a, two, s_1, n_4, NULL);
-                return false; // not prime
+            if (g == 1) {
+                STAT_ADD(STAT_SIEVE_SURVIVORS, 1);
+                found = is_prime_r(p, iters, rs);
+            } else {
+                STAT_ADD(STAT_COPRIME_SKIPS, 1);
             }
         }
+        // ADVANCE EVERY RESIDUE BY TWO
+        for (uint64_t i = 0; i < count; i += 1) {
+            residues[i] += 2;
+            if (residues[i] >= sieve_primes[i]) {
+                residues[i] -= sieve_primes[i];
+            }
+        }
+    }
+    STAT_ADD(STAT_CANDIDATES, step);
+    if (!found) {
+        STAT_ADD(STAT_WALK_RESTARTS, 1);
     }
-    mpz_clears(n_1, r, j, y, a, two, s_1, n_4, NULL);
-    return true; // prime
+    mpz_clear(start);
+    return found;
 }
 
 // MAKE RANDOM PRIME NUMBER
 // @param p : Variable to store prime number in
-// @param bits : Minimum number of bits for prime number p
+// @param bits : Exact number of bits for prime number p
 // @param iters : Iterations to run Miller-Rabin primality test for
 // Generates a new prime number stores in p
-// Generated prime should be a least bits number of bits long
-// The primality of the number should be tested with is_prime using iters
+// Sieved walks from the global random state until one finds a prime.
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
-    for (mpz_urandomb(p, state, bits); is_prime(p, iters) == false; mpz_urandomb(p, state, bits))
+    STAT_START(t0);
+    while (!make_prime_walk(p, bits, iters, 0, SIEVE_MAX_STEP, state))
         ;
+    STAT_STOP(STAT_PRIME_NS, t0);
     return;
 }
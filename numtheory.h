@@ -1,16 +1,62 @@
 #pragma once
 
+#include "montgomery.h"
+#include "multibuf.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <gmp.h>
 
+// SPECIAL ITERATION COUNTS FOR is_prime
+#define MR_ITERS_ADAPTIVE 0 // ROUNDS FROM mr_rounds FOR THE BIT SIZE
+#define MR_ITERS_BPSW     UINT64_MAX // BAILLIE-PSW INSTEAD OF MILLER-RABIN
+
+// WORKSPACE
+// Scratch for one thread's number theory calls, sized to a modulus once and
+// reused: temporaries, a Montgomery context rebuilt in place per modulus
+// and the limbs mont_pow_tp works in. pow_mod, is_prime, gcd and
+// mod_inverse take the calling thread's own workspace from nt_ws_local.
+// Temps 0-6 belong to the innermost routine running; mod_inverse and the
+// CRT path in rsa.c hold 5-8 across calls that only touch the context.
+// The lanes carry one group of blocks through mb_pow in the file engine.
+#define NT_WS_TEMPS 9
+#define NT_WS_LIMBS(nn) (4 * (nn) + MONT_POW_SCRATCH(nn)) // is_prime KEEPS 4 nn AHEAD OF THE SCRATCH
+#define NT_WS_LANES (3 * MB_LANES) // CIPHERTEXTS AND BOTH CRT HALVES
+
+typedef struct {
+    mp_size_t nn; // LIMBS THE SCRATCH FITS
+    mp_limb_t *limbs; // NT_WS_LIMBS(nn)
+    mont_ctx_t ctx;
+    mpz_t t[NT_WS_TEMPS];
+    mpz_ptr lane[NT_WS_LANES]; // lanes AS mb_pow TAKES THEM
+    mpz_t lanes[NT_WS_LANES];
+} nt_ws_t;
+
+void nt_ws_init(nt_ws_t *ws, uint64_t bits);
+
+void nt_ws_reserve(nt_ws_t *ws, uint64_t bits);
+
+void nt_ws_clear(nt_ws_t *ws);
+
+nt_ws_t *nt_ws_local(void);
+
 void gcd(mpz_t g, mpz_t a, mpz_t b);
 
+void gcd_ext(mpz_t g, mpz_t s, mpz_t a, mpz_t b);
+
 void mod_inverse(mpz_t o, mpz_t a, mpz_t n);
 
 void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n);
 
+void pow_mod_ui(mpz_t o, mpz_t a, uint64_t e, mpz_t n);
+
+uint64_t mr_rounds(uint64_t bits);
+
 bool is_prime(mpz_t n, uint64_t iters);
 
+bool is_prime_r(mpz_t n, uint64_t iters, gmp_randstate_t rs);
+
+bool make_prime_walk(
+    mpz_t p, uint64_t bits, uint64_t iters, uint64_t coprime, uint64_t steps, gmp_randstate_t rs);
+
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters);
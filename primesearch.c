@@ -0,0 +1,164 @@
+#include "primesearch.h"
+#include "numtheory.h"
+#include "randstate.h"
+#include "stats.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <gmp.h>
+
+#define SEARCH_SEGMENT 256 // ODD CANDIDATES PER ATTEMPT
+
+// ONE PRIME BEING SEARCHED FOR
+// Attempt k of worker w is ordered by (k, w). The prime from the smallest
+// successful attempt wins, which makes the result independent of timing.
+typedef struct {
+    uint64_t bits;
+    bool found;
+    uint64_t best_k, best_w;
+    mpz_t best;
+} target_t;
+
+typedef struct {
+    target_t *targets;
+    uint64_t count;
+    uint64_t iters, coprime, seed, round;
+    pthread_mutex_t lock;
+} search_t;
+
+typedef struct {
+    search_t *search;
+    uint64_t w;
+} worker_t;
+
+// ATTEMPT ORDER
+// @param k,w : Attempt index and worker of the attempt
+// @param t : Target to compare against
+// True when attempt (k, w) comes before the current winner of t.
+static bool precedes(uint64_t k, uint64_t w, target_t *t) {
+    return !t->found || k < t->best_k || (k == t->best_k && w < t->best_w);
+}
+
+// SEARCH WORKER
+// Each worker owns one random stream per target, derived from the seed, the
+// round, the target and the worker number. It always works on the target it
+// has made the fewest attempts on and stops working on a target as soon as a
+// smaller attempt has already succeeded there.
+static void *search_worker(void *arg) {
+    worker_t *wk = (worker_t *) arg;
+    search_t *s = wk->search;
+    gmp_randstate_t *rs = (gmp_randstate_t *) malloc(s->count * sizeof(gmp_randstate_t));
+    uint64_t *k = (uint64_t *) calloc(s->count, sizeof(uint64_t));
+    bool *done = (bool *) calloc(s->count, sizeof(bool));
+    for (uint64_t t = 0; t < s->count; t += 1) {
+        randstate_init_stream(rs[t], s->seed, (s->round << 32) | (t << 16) | wk->w);
+    }
+    mpz_t cand;
+    mpz_init(cand);
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        for (uint64_t t = 0; t < s->count; t += 1) {
+            done[t] = done[t] || !precedes(k[t], wk->w, &s->targets[t]);
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        int64_t pick = -1;
+        for (uint64_t t = 0; t < s->count; t += 1) {
+            if (!done[t] && (pick < 0 || k[t] < k[pick])) {
+                pick = t;
+            }
+        }
+        if (pick < 0) {
+            break; // EVERY TARGET IS SETTLED FOR THIS WORKER
+        }
+
+        target_t *t = &s->targets[pick];
+        if (make_prime_walk(cand, t->bits, s->iters, s->coprime, SEARCH_SEGMENT, rs[pick])) {
+            pthread_mutex_lock(&s->lock);
+            if (precedes(k[pick], wk->w, t)) {
+                mpz_set(t->best, cand);
+                t->best_k = k[pick];
+                t->best_w = wk->w;
+                t->found = true;
+            }
+            pthread_mutex_unlock(&s->lock);
+        }
+        k[pick] += 1;
+    }
+    for (uint64_t t = 0; t < s->count; t += 1) {
+        gmp_randclear(rs[t]);
+    }
+    mpz_clear(cand);
+    free(rs);
+    free(k);
+    free(done);
+    return NULL;
+}
+
+// PARALLEL PRIME SEARCH
+// @param primes : Initialized variables to store count primes in
+// @param bits : Exact bit length of each prime
+// @param count : Number of primes to search for at the same time
+// @param iters : Iterations to run Miller-Rabin primality test for
+// @param coprime : Value each prime minus one must be coprime to, 0 for none
+// @param seed : Seed the per-worker random streams are derived from
+// @param round : Distinguishes repeated searches under the same seed
+// @param threads : Number of worker threads
+// All primes are searched for at once by threads workers. The same seed,
+// round and thread count always produce the same primes. A worker the
+// system gives no thread for runs on the calling thread instead; since the
+// winner is the smallest attempt over all workers, the primes stay the same.
+void make_primes_parallel(mpz_t primes[], const uint64_t bits[], uint64_t count, uint64_t iters,
+    uint64_t coprime, uint64_t seed, uint64_t round, uint64_t threads) {
+    STAT_START(t0);
+    if (threads == 0) {
+        threads = 1;
+    }
+    search_t s;
+    s.count = count;
+    s.iters = iters;
+    s.coprime = coprime;
+    s.seed = seed;
+    s.round = round;
+    s.targets = (target_t *) calloc(count, sizeof(target_t));
+    for (uint64_t t = 0; t < count; t += 1) {
+        s.targets[t].bits = bits[t];
+        mpz_init(s.targets[t].best);
+    }
+    pthread_mutex_init(&s.lock, NULL);
+
+    pthread_t *tids = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    worker_t *workers = (worker_t *) malloc(threads * sizeof(worker_t));
+    bool *started = (bool *) calloc(threads, sizeof(bool));
+    for (uint64_t w = 0; w < threads; w += 1) {
+        workers[w].search = &s;
+        workers[w].w = w;
+        started[w] = pthread_create(&tids[w], NULL, search_worker, &workers[w]) == 0;
+    }
+    for (uint64_t w = 0; w < threads; w += 1) {
+        if (!started[w]) {
+            search_worker(&workers[w]);
+        }
+    }
+    for (uint64_t w = 0; w < threads; w += 1) {
+        if (started[w]) {
+            pthread_join(tids[w], NULL);
+        }
+    }
+
+    for (uint64_t t = 0; t < count; t += 1) {
+        assert(s.targets[t].found); // WORKERS ONLY STOP ONCE EVERY TARGET HAS A PRIME
+        mpz_set(primes[t], s.targets[t].best);
+        mpz_clear(s.targets[t].best);
+    }
+    pthread_mutex_destroy(&s.lock);
+    free(s.targets);
+    free(tids);
+    free(workers);
+    free(started);
+    STAT_STOP(STAT_PRIME_NS, t0);
+    return;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+void make_primes_parallel(mpz_t primes[], const uint64_t bits[], uint64_t count, uint64_t iters,
+    uint64_t coprime, uint64_t seed, uint64_t round, uint64_t threads);
@@ -16,3 +16,21 @@ void randstate_init(uint64_t seed) {
 void randstate_clear(void) {
     gmp_randclear(state);
 }
+
+// SPLITMIX64 FINALIZER
+// Spreads nearby inputs (seed, seed + 1, ...) over unrelated outputs.
+static uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+void randstate_init_stream(gmp_randstate_t rs, uint64_t seed, uint64_t stream) {
+    // Initializes a private Mersenne Twister state for one worker. Its seed
+    // depends only on the user seed and the stream number, so a parallel
+    // search sees the same numbers no matter how its threads are scheduled.
+    gmp_randinit_mt(rs);
+    gmp_randseed_ui(rs, mix64(seed ^ mix64(stream)));
+    return;
+}
@@ -0,0 +1,117 @@
+#include "ring.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#define CACHE_LINE 64
+#define SPIN_LIMIT 64 // EMPTY POLLS BEFORE YIELDING
+#define YIELD_LIMIT 256 // YIELDS BEFORE SLEEPING BETWEEN POLLS
+#define SLEEP_NS 50000
+
+// BOUNDED SINGLE PRODUCER / SINGLE CONSUMER RING
+// head is only written by the consumer and tail only by the producer, so no
+// lock is needed. Each side keeps a cached copy of the other side's index
+// and only reloads it when the ring looks full or empty, and the two indices
+// live on separate cache lines so the sides do not fight over one line.
+struct ring {
+    void **buf;
+    uint64_t mask;
+    _Alignas(CACHE_LINE) _Atomic uint64_t head;
+    uint64_t tail_cache; // CONSUMER SIDE
+    _Alignas(CACHE_LINE) _Atomic uint64_t tail;
+    uint64_t head_cache; // PRODUCER SIDE
+};
+
+// WAIT BACKOFF
+// @param polls : Failed polls so far
+// Spins first, then yields, then sleeps, so a stage blocked on slow I/O does
+// not burn a core while a busy pipeline still hands items over quickly.
+static void backoff(uint64_t polls) {
+    if (polls < SPIN_LIMIT) {
+        return;
+    }
+    if (polls < SPIN_LIMIT + YIELD_LIMIT) {
+        sched_yield();
+        return;
+    }
+    struct timespec ts = { 0, SLEEP_NS };
+    nanosleep(&ts, NULL);
+}
+
+// CREATE RING
+// @param capacity : Items the ring must hold, rounded up to a power of two
+ring_t *ring_create(uint64_t capacity) {
+    ring_t *ring = (ring_t *) aligned_alloc(CACHE_LINE, sizeof(ring_t));
+    uint64_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring->buf = (void **) calloc(size, sizeof(void *));
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->tail_cache = 0;
+    ring->head_cache = 0;
+    return ring;
+}
+
+// PUSH ITEM
+// @param ring : Ring, only ever pushed to by one thread
+// @param item : Item to append, may be NULL
+// Returns false when the ring is full.
+bool ring_push(ring_t *ring, void *item) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - ring->head_cache > ring->mask) {
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->head_cache > ring->mask) {
+            return false;
+        }
+    }
+    ring->buf[tail & ring->mask] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// POP ITEM
+// @param ring : Ring, only ever popped from by one thread
+// @param item : Receives the oldest item
+// Returns false when the ring is empty.
+bool ring_pop(ring_t *ring, void **item) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == ring->tail_cache) {
+        ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == ring->tail_cache) {
+            return false;
+        }
+    }
+    *item = ring->buf[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+// PUSH ITEM, WAITING FOR ROOM
+void ring_put(ring_t *ring, void *item) {
+    for (uint64_t polls = 0; !ring_push(ring, item); polls += 1) {
+        backoff(polls);
+    }
+}
+
+// POP ITEM, WAITING FOR ONE TO ARRIVE
+void *ring_get(ring_t *ring) {
+    void *item = NULL;
+    for (uint64_t polls = 0; !ring_pop(ring, &item); polls += 1) {
+        backoff(polls);
+    }
+    return item;
+}
+
+// DESTROY RING
+// @param ring : Ring with no thread still using it
+void ring_destroy(ring_t *ring) {
+    free(ring->buf);
+    free(ring);
+}
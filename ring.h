@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct ring ring_t;
+
+ring_t *ring_create(uint64_t capacity);
+
+bool ring_push(ring_t *ring, void *item);
+
+bool ring_pop(ring_t *ring, void **item);
+
+void ring_put(ring_t *ring, void *item);
+
+void *ring_get(ring_t *ring);
+
+void ring_destroy(ring_t *ring);
@@ -1,23 +1,51 @@
 #include "rsa.h"
 #include "numtheory.h"
+#include "montgomery.h"
+#include "primesearch.h"
 #include "randstate.h"
+#include "stats.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <gmp.h>
 #include <stdlib.h>
+#include <string.h>
 
 // LOG FUNCTION FOR MPZ
 // @param n : mpz_t to calculate the log base 2 of
+// The bit length of n, 0 for n <= 0, read off the top limb.
 uint64_t log_2(mpz_t n) {
-    uint64_t log = 0;
-    mpz_t n_log;
-    // FOR LOOP TO CALCULATE LOG_2 OF N
-    for (mpz_init_set(n_log, n); mpz_cmp_ui(n_log, 0) == 1; mpz_tdiv_q_2exp(n_log, n_log, 1)) {
-        log += 1;
+    return mpz_sgn(n) > 0 ? mpz_sizeinbase(n, 2) : 0;
+}
+
+// PICK A RANDOM PUBLIC EXPONENT
+// @param e : initialized mpz_t variable for public exponent
+// @param p,q : prime factors of n
+// @param nbits : number of random bits for e
+// Draws nbits-wide values until one is coprime to the totient.
+static void make_random_e(mpz_t e, mpz_t p, mpz_t q, uint64_t nbits) {
+    // COMPUTE VARPHI
+    mpz_t varphi;
+    mpz_init(varphi);
+    mpz_t p_1, q_1;
+    mpz_inits(p_1, q_1, NULL);
+    mpz_sub_ui(p_1, p, 1); // P-1
+    mpz_sub_ui(q_1, q, 1); // Q-1
+    mpz_mul(varphi, p_1, q_1); // TOTIENT = (P-1)(Q-1)
+
+    // FIND E
+    mpz_t d;
+    mpz_init(d);
+    // IF GCD == 1 THEN WE HAVE OUR PUBLIC EXPONENT E
+    mpz_urandomb(e, state, nbits);
+    gcd(d, e, varphi);
+    while (mpz_cmp_ui(d, 1) != 0) {
+        STAT_ADD(STAT_GCD_RETRIES, 1);
+        mpz_urandomb(e, state, nbits);
+        gcd(d, e, varphi);
     }
-    mpz_clear(n_log);
-    return log;
+    mpz_clears(d, p_1, q_1, varphi, NULL); // CLEAR USED VARIABLES
+    return;
 }
 
 // GENERATE PUBLIC RSA KEY
@@ -40,25 +68,124 @@ void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t i
         make_prime(p, pbits, iters); // GENERATE P
         make_prime(q, qbits, iters); // GENERATE Q
         mpz_mul(n, p, q); // N = PQ
+        STAT_ADD(STAT_KEY_ROUNDS, log_2(n) < nbits);
     } while (log_2(n) < nbits);
 
-    // COMPUTE VARPHI
-    mpz_t varphi;
-    mpz_init(varphi);
-    mpz_t p_1, q_1;
-    mpz_inits(p_1, q_1, NULL);
-    mpz_sub_ui(p_1, p, 1); // P-1
-    mpz_sub_ui(q_1, q, 1); // Q-1
-    mpz_mul(varphi, p_1, q_1); // TOTIENT = (P-1)(Q-1)
+    make_random_e(e, p, q, nbits);
+    return;
+}
 
-    // FIND E
-    mpz_t d;
-    mpz_init(d);
-    // IF GCD == 1 THEN WE HAVE OUR PUBLIC EXPONENT E
-    for (mpz_urandomb(e, state, nbits); mpz_cmp_ui(d, 1) != 0; mpz_urandomb(e, state, nbits)) {
-        gcd(d, e, varphi);
+// GENERATE PUBLIC RSA KEY WITH A FIXED EXPONENT
+// @param p : initialized mpz_t variable for prime number p
+// @param q : initialized mpz_t variable for prime number q
+// @param n : initialized mpz_t variable for mod n
+// @param e : initialized mpz_t variable for public exponent
+// @param nbits : minimum number of bits for public key
+// @param iters : number of iterations for Miller-Rabin
+// @param pubexp : odd public exponent, usually 65537
+// Primes are drawn like rsa_make_pub, but any prime with gcd(e, prime-1) != 1
+// is redrawn so that e is always invertible mod the totient.
+void rsa_make_pub_fixed(
+    mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t pubexp) {
+    uint64_t pbits = 0, qbits = 0;
+    uint64_t upper = (3 * nbits) / 4; // UPPER BOUND OF RANDOM GENERATION
+    uint64_t lower = nbits / 4; // LOWER BOUND OF RANDOM GENERATION
+    mpz_t g, t;
+    mpz_inits(g, t, NULL);
+    mpz_set_ui(e, pubexp);
+    do {
+        pbits = (random() % (upper - lower + 1)) + lower;
+        qbits = nbits - pbits;
+        do { // REDRAW P UNTIL GCD(E, P-1) == 1
+            make_prime(p, pbits, iters);
+            mpz_sub_ui(t, p, 1);
+            gcd(g, e, t);
+            STAT_ADD(STAT_GCD_RETRIES, mpz_cmp_ui(g, 1) != 0);
+        } while (mpz_cmp_ui(g, 1) != 0);
+        do { // REDRAW Q UNTIL GCD(E, Q-1) == 1
+            make_prime(q, qbits, iters);
+            mpz_sub_ui(t, q, 1);
+            gcd(g, e, t);
+            STAT_ADD(STAT_GCD_RETRIES, mpz_cmp_ui(g, 1) != 0);
+        } while (mpz_cmp_ui(g, 1) != 0 || mpz_cmp(p, q) == 0);
+        mpz_mul(n, p, q); // N = PQ
+        STAT_ADD(STAT_KEY_ROUNDS, log_2(n) < nbits);
+    } while (log_2(n) < nbits);
+    mpz_clears(g, t, NULL);
+    return;
+}
+
+// GENERATE PUBLIC RSA KEY ON SEVERAL THREADS
+// @param p,q,n,e : initialized mpz_t variables for the key
+// @param nbits : minimum number of bits for public key
+// @param iters : number of iterations for Miller-Rabin
+// @param pubexp : fixed public exponent, 0 for a random nbits exponent
+// @param seed : seed for the per-thread random streams
+// @param threads : number of worker threads
+// p and q are searched for at the same time by all threads. The same seed
+// and thread count always produce the same key.
+void rsa_make_pub_parallel(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters,
+    uint64_t pubexp, uint64_t seed, uint64_t threads) {
+    uint64_t upper = (3 * nbits) / 4; // UPPER BOUND OF RANDOM GENERATION
+    uint64_t lower = nbits / 4; // LOWER BOUND OF RANDOM GENERATION
+    uint64_t bits[2];
+    mpz_t pq[2];
+    mpz_inits(pq[0], pq[1], NULL);
+    for (uint64_t round = 0;; round += 1) {
+        bits[0] = (random() % (upper - lower + 1)) + lower;
+        bits[1] = nbits - bits[0];
+        make_primes_parallel(pq, bits, 2, iters, pubexp, seed, round, threads);
+        mpz_mul(n, pq[0], pq[1]); // N = PQ
+        if (mpz_cmp(pq[0], pq[1]) != 0 && log_2(n) >= nbits) {
+            break;
+        }
+        STAT_ADD(STAT_KEY_ROUNDS, 1);
     }
-    mpz_clears(d, p_1, q_1, varphi, NULL); // CLEAR USED VARIABLES
+    mpz_set(p, pq[0]);
+    mpz_set(q, pq[1]);
+    mpz_clears(pq[0], pq[1], NULL);
+    if (pubexp == 0) {
+        make_random_e(e, p, q, nbits);
+    } else {
+        mpz_set_ui(e, pubexp);
+    }
+    return;
+}
+
+// GENERATE MULTI-PRIME PUBLIC RSA KEY
+// @param primes : count initialized mpz_t variables for the primes
+// @param count : number of primes, at most RSA_MAX_PRIMES
+// @param n,e : initialized mpz_t variables for mod n and the public exponent
+// @param nbits : minimum number of bits for public key
+// @param iters : number of iterations for Miller-Rabin
+// @param pubexp : odd public exponent, every prime minus one is coprime to it
+// @param seed : seed for the per-thread random streams
+// @param threads : number of worker threads, 0 searches on one
+// The primes are balanced, nbits / count bits each, and searched for at the
+// same time like rsa_make_pub_parallel. Smaller primes are much quicker to
+// find, and every private operation works on count smaller moduli.
+void rsa_make_pub_multi(mpz_t primes[], uint64_t count, mpz_t n, mpz_t e, uint64_t nbits,
+    uint64_t iters, uint64_t pubexp, uint64_t seed, uint64_t threads) {
+    uint64_t bits[RSA_MAX_PRIMES];
+    for (uint64_t i = 0; i < count; i += 1) {
+        bits[i] = nbits / count + (i < nbits % count ? 1 : 0);
+    }
+    for (uint64_t round = 0;; round += 1) {
+        make_primes_parallel(primes, bits, count, iters, pubexp, seed, round, threads);
+        bool distinct = true;
+        mpz_set(n, primes[0]);
+        for (uint64_t i = 1; i < count; i += 1) {
+            mpz_mul(n, n, primes[i]); // N = PRODUCT OF THE PRIMES
+            for (uint64_t j = 0; j < i; j += 1) {
+                distinct = distinct && mpz_cmp(primes[i], primes[j]) != 0;
+            }
+        }
+        if (distinct && log_2(n) >= nbits) {
+            break;
+        }
+        STAT_ADD(STAT_KEY_ROUNDS, 1);
+    }
+    mpz_set_ui(e, pubexp);
     return;
 }
 
@@ -114,6 +241,25 @@ void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q) {
     return;
 }
 
+// CREATE MULTI-PRIME PRIVATE RSA KEY
+// @param d : Initialized mpz_t variable for private key d
+// @param e : Public exponent e
+// @param primes : Prime factors of n
+// @param count : Number of primes
+// d is the inverse of e modulo the totient, the product of every prime minus one.
+void rsa_make_priv_multi(mpz_t d, mpz_t e, mpz_t primes[], uint64_t count) {
+    mpz_t varphi, r_1;
+    mpz_inits(varphi, r_1, NULL);
+    mpz_set_ui(varphi, 1);
+    for (uint64_t i = 0; i < count; i += 1) {
+        mpz_sub_ui(r_1, primes[i], 1);
+        mpz_mul(varphi, varphi, r_1);
+    }
+    mod_inverse(d, e, varphi);
+    mpz_clears(varphi, r_1, NULL);
+    return;
+}
+
 // WRITES PRIVATE KEY TO PARAMETERIZED FILE
 // @param n : Mod n
 // @param d : Private key d
@@ -135,53 +281,204 @@ void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile) {
     return;
 }
 
+// INITIALIZE PRIVATE KEY
+// @param key : Private key to initialize, starts without CRT data
+void rsa_priv_init(rsa_priv_t *key) {
+    mpz_inits(key->n, key->d, key->p, key->q, key->dp, key->dq, key->qinv, NULL);
+    for (uint64_t i = 0; i < RSA_EXTRA; i += 1) {
+        mpz_inits(key->r[i], key->dr[i], key->tr[i], key->rprod[i], NULL);
+    }
+    key->crt = false;
+    key->extra = 0;
+    return;
+}
+
+// CLEAR PRIVATE KEY
+// @param key : Private key to clear
+void rsa_priv_clear(rsa_priv_t *key) {
+    mpz_clears(key->n, key->d, key->p, key->q, key->dp, key->dq, key->qinv, NULL);
+    for (uint64_t i = 0; i < RSA_EXTRA; i += 1) {
+        mpz_clears(key->r[i], key->dr[i], key->tr[i], key->rprod[i], NULL);
+    }
+    return;
+}
+
+// PRODUCTS OF THE PRIMES
+// @param key : Private key with p, q and its extra primes set
+// Fills rprod and returns whether all the primes multiply out to n.
+static bool prime_products(rsa_priv_t *key) {
+    mpz_ptr prod = nt_ws_local()->t[7];
+    mpz_mul(prod, key->p, key->q);
+    for (uint64_t i = 0; i < key->extra; i += 1) {
+        mpz_set(key->rprod[i], prod);
+        mpz_mul(prod, prod, key->r[i]);
+    }
+    return mpz_cmp(prod, key->n) == 0;
+}
+
+// CREATE EXTENDED PRIVATE KEY
+// @param key : Initialized private key to fill
+// @param n : Mod n
+// @param d : Private exponent d
+// @param p,q : Prime factors of n
+// Derives dP = d mod (p-1), dQ = d mod (q-1) and qInv = q^-1 mod p.
+void rsa_make_priv_crt(rsa_priv_t *key, mpz_t n, mpz_t d, mpz_t p, mpz_t q) {
+    mpz_set(key->n, n);
+    mpz_set(key->d, d);
+    mpz_set(key->p, p);
+    mpz_set(key->q, q);
+    mpz_sub_ui(key->dp, p, 1);
+    mpz_mod(key->dp, d, key->dp); // DP = D MOD (P-1)
+    mpz_sub_ui(key->dq, q, 1);
+    mpz_mod(key->dq, d, key->dq); // DQ = D MOD (Q-1)
+    mod_inverse(key->qinv, key->q, key->p); // QINV = Q^-1 MOD P
+    key->crt = true;
+    key->extra = 0;
+    return;
+}
+
+// CREATE EXTENDED MULTI-PRIME PRIVATE KEY
+// @param key : Initialized private key to fill
+// @param n : Mod n
+// @param d : Private exponent d
+// @param primes : Prime factors of n, p and q first
+// @param count : Number of primes, at most RSA_MAX_PRIMES
+// Derives the two-prime values like rsa_make_priv_crt, then d_i and t_i
+// for each further prime.
+void rsa_make_priv_crt_multi(rsa_priv_t *key, mpz_t n, mpz_t d, mpz_t primes[], uint64_t count) {
+    rsa_make_priv_crt(key, n, d, primes[0], primes[1]);
+    key->extra = count - 2;
+    for (uint64_t i = 0; i < key->extra; i += 1) {
+        mpz_set(key->r[i], primes[i + 2]);
+        mpz_sub_ui(key->dr[i], key->r[i], 1);
+        mpz_mod(key->dr[i], d, key->dr[i]); // D_I = D MOD (R_I - 1)
+    }
+    prime_products(key);
+    for (uint64_t i = 0; i < key->extra; i += 1) {
+        mod_inverse(key->tr[i], key->rprod[i], key->r[i]); // T_I = (P Q .. R_(I-1))^-1 MOD R_I
+    }
+    return;
+}
+
+// MODULI OF THE PRIVATE EXPONENTIATIONS
+// @param key : Private key
+// @param mods : Receives n, or p, q and the extra primes
+// @param exps : Receives the matching exponents, may be NULL
+// Returns how many there are.
+uint64_t rsa_priv_moduli(rsa_priv_t *key, mpz_ptr mods[], mpz_ptr exps[]) {
+    mpz_ptr m[RSA_MAX_PRIMES], x[RSA_MAX_PRIMES];
+    uint64_t count = 1;
+    m[0] = key->n;
+    x[0] = key->d;
+    if (key->crt) {
+        m[0] = key->p, x[0] = key->dp;
+        m[1] = key->q, x[1] = key->dq;
+        for (uint64_t i = 0; i < key->extra; i += 1) {
+            m[i + 2] = key->r[i], x[i + 2] = key->dr[i];
+        }
+        count = 2 + key->extra;
+    }
+    for (uint64_t i = 0; i < count; i += 1) {
+        mods[i] = m[i];
+        if (exps != NULL) {
+            exps[i] = x[i];
+        }
+    }
+    return count;
+}
+
+// WRITE EXTENDED PRIVATE KEY TO PARAMETERIZED FILE
+// @param key : Private key to write
+// @param pvfile : Output file to write the private key to
+// Writes n and d exactly like rsa_write_priv, followed by p, q, dP, dQ and
+// qInv when the key holds CRT data, then r_i, d_i and t_i for each extra
+// prime. Every value is a hexstring on its own line.
+void rsa_write_priv_crt(rsa_priv_t *key, FILE *pvfile) {
+    rsa_write_priv(key->n, key->d, pvfile);
+    if (key->crt) {
+        gmp_fprintf(pvfile, "%Zx\n", key->p);
+        gmp_fprintf(pvfile, "%Zx\n", key->q);
+        gmp_fprintf(pvfile, "%Zx\n", key->dp);
+        gmp_fprintf(pvfile, "%Zx\n", key->dq);
+        gmp_fprintf(pvfile, "%Zx\n", key->qinv);
+        for (uint64_t i = 0; i < key->extra; i += 1) {
+            gmp_fprintf(pvfile, "%Zx\n", key->r[i]);
+            gmp_fprintf(pvfile, "%Zx\n", key->dr[i]);
+            gmp_fprintf(pvfile, "%Zx\n", key->tr[i]);
+        }
+    }
+    return;
+}
+
+// READ EXTENDED PRIVATE KEY FROM PARAMETERIZED FILE
+// @param key : Initialized private key to fill
+// @param pvfile : Input file to read private key from
+// Legacy two-line files load with crt unset so callers fall back to d, and
+// so does a key whose primes do not multiply out to n.
+void rsa_read_priv_crt(rsa_priv_t *key, FILE *pvfile) {
+    rsa_read_priv(key->n, key->d, pvfile);
+    key->crt = gmp_fscanf(pvfile, "%Zx\n", key->p) == 1
+               && gmp_fscanf(pvfile, "%Zx\n", key->q) == 1
+               && gmp_fscanf(pvfile, "%Zx\n", key->dp) == 1
+               && gmp_fscanf(pvfile, "%Zx\n", key->dq) == 1
+               && gmp_fscanf(pvfile, "%Zx\n", key->qinv) == 1;
+    key->extra = 0;
+    while (key->crt && key->extra < RSA_EXTRA
+           && gmp_fscanf(pvfile, "%Zx\n", key->r[key->extra]) == 1
+           && gmp_fscanf(pvfile, "%Zx\n", key->dr[key->extra]) == 1
+           && gmp_fscanf(pvfile, "%Zx\n", key->tr[key->extra]) == 1) {
+        key->extra += 1;
+    }
+    key->crt = key->crt && prime_products(key);
+    return;
+}
+
+// GARNER RECOMBINATION
+// @param m : Output, the unique m mod pq with m = m1 mod p and m = m2 mod q
+// @param m1 : Residue mod p, destroyed
+// @param m2 : Residue mod q
+// @param key : Private key holding p, q and qInv
+// The products go through workspace temp 6, since mpz_mul into one of its
+// own operands allocates a fresh result every time.
+void rsa_crt_combine(mpz_t m, mpz_t m1, mpz_t m2, rsa_priv_t *key) {
+    mpz_ptr h = nt_ws_local()->t[6];
+    mpz_sub(m1, m1, m2); // M1 - M2
+    mpz_mul(h, m1, key->qinv); // H = QINV * (M1 - M2)
+    mpz_mod(m1, h, key->p); // H MOD P
+    mpz_mul(h, m1, key->q); // H * Q
+    mpz_add(m, h, m2); // M = M2 + H * Q
+    return;
+}
+
+// FOLD IN AN EXTRA PRIME
+// @param m : Residue mod p q r_3 ... r_(i-1), the same mod r_i as well on return
+// @param mi : Residue mod r_i, destroyed
+// @param i : Extra prime, 0 for r_3
+// @param key : Private key
+// RFC 8017 5.1.2 step 2.b.v, through workspace temp 6 like rsa_crt_combine.
+void rsa_crt_extend(mpz_t m, mpz_t mi, uint64_t i, rsa_priv_t *key) {
+    mpz_ptr h = nt_ws_local()->t[6];
+    mpz_sub(mi, mi, m); // M_I - M
+    mpz_mul(h, mi, key->tr[i]); // H = T_I * (M_I - M)
+    mpz_mod(mi, h, key->r[i]); // H MOD R_I
+    mpz_mul(h, mi, key->rprod[i]); // H * R
+    mpz_add(m, m, h); // M = M + H * R
+    return;
+}
+
 // RSA ENCRYPT MESSAGE
 // @param c : Initialized variable for ciphertext
 // @param m : Message m
 // @param e : Public exponenet
 // @param n : Mod n
 // E(M) = M*exp(e) (mod n) = c
+// Single word exponents take the square-and-multiply fast path.
 void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n) {
-    pow_mod(c, m, e, n);
-    return;
-}
-
-// RSA ENCRYPT FILE
-// @param infile : Input file to read data from
-// @param outfile : Output file to write ciphertexts to
-// @param n : Mod n
-// @param e : Public exponent e
-// Reads all bytes from a parameterized infile and runs rsa_encrypt for
-// each block of data k. Then writes all blocks to parameterized outfile.
-// Written outputs are formatted as hexstrings on trailing newlines.
-void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
-    uint64_t k = 0; // BLOCK SIZE
-    uint64_t j = 0; // BYTES READ
-    mpz_t nlog, m, c;
-    mpz_inits(m, c, NULL);
-    // BLOCK = k = floor((log2(n)-1)/8)
-    // While nlog != 0, bitshift right to divide by 2
-    for (mpz_init_set(nlog, n); mpz_cmp_ui(nlog, 0) == 1; mpz_tdiv_q_2exp(nlog, nlog, 1)) {
-        k += 1;
+    if (mpz_fits_ulong_p(e)) {
+        pow_mod_ui(c, m, mpz_get_ui(e), n);
+        return;
     }
-    k -= 1;
-    k /= 8;
-    uint8_t *buffer = (uint8_t *) calloc(k, sizeof(uint8_t));
-    // READ k-1 BYTES UNTIL EOF
-    // USE fread() instead of fgetc
-    while ((j += fread(buffer + 1, sizeof(uint8_t), k - 1, infile)) > 0) {
-        // increment j by bytes_read
-        buffer[0] = 0xFF;
-        // mpz_import to convert read bytes to mpz_t m
-        mpz_import(m, j + 1, 1, sizeof(uint8_t), 1, 0, buffer);
-        // call rsa_encrypt
-        rsa_encrypt(c, m, e, n);
-        // output to outfile as hexstring w/ newline
-        gmp_fprintf(outfile, "%Zx\n", c);
-        j = 0;
-    }
-    mpz_clears(nlog, m, c, NULL);
-    free(buffer);
+    pow_mod(c, m, e, n);
     return;
 }
 
@@ -196,34 +493,78 @@ void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n) {
     return;
 }
 
-// RSA DECRYPT FILE
-// @param infile : Input file to read data from
-// @param outfile : Output file to write decrypted messages to
-// @param n : Mod n
-// @param e : Private key d
-// Reads all ciphertexts in parameterized infile until end of file.
-// For each ciphertext, decrypt it using rsa_decrypt.
-// Write the decrypted message to the parameterized outfile.
-void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d) {
-    uint64_t k = 0; // BLOCK SIZE
-    uint64_t j = 0; // BYTES READ
-    mpz_t nlog, m, c;
-    mpz_inits(m, c, NULL);
-    // While nlog != 0, bitshift right to divide by 2
-    for (mpz_init_set(nlog, n); mpz_cmp_ui(nlog, 0) == 1; mpz_tdiv_q_2exp(nlog, nlog, 1)) {
-        k += 1;
+// RSA DECRYPT WITH CRT
+// @param m : Stores decrypted message
+// @param c : Ciphertext to decrypt
+// @param key : Private key
+// Runs two half-size exponentiations mod p and q and recombines them, then
+// one more per extra prime. Keys without CRT data fall back to rsa_decrypt.
+void rsa_decrypt_crt(mpz_t m, mpz_t c, rsa_priv_t *key) {
+    if (!key->crt) {
+        rsa_decrypt(m, c, key->d, key->n);
+        return;
+    }
+    nt_ws_t *ws = nt_ws_local();
+    mpz_ptr m1 = ws->t[7], m2 = ws->t[8], cr = ws->t[5];
+    mpz_mod(cr, c, key->p); // REDUCED INTO A SIZED TEMP, PRIMES MAY BE FAR SMALLER THAN C
+    pow_mod(m1, cr, key->dp, key->p); // M1 = C^DP MOD P
+    mpz_mod(cr, c, key->q);
+    pow_mod(m2, cr, key->dq, key->q); // M2 = C^DQ MOD Q
+    mpz_set(cr, c); // C OUTLIVES M, WHICH MAY BE THE SAME VARIABLE
+    rsa_crt_combine(m, m1, m2, key);
+    for (uint64_t i = 0; i < key->extra; i += 1) {
+        mpz_mod(m2, cr, key->r[i]);
+        pow_mod(m1, m2, key->dr[i], key->r[i]); // M_I = C^D_I MOD R_I
+        rsa_crt_extend(m, m1, i, key);
+    }
+    return;
+}
+
+// ONE EXPONENTIATION OF rsa_decrypt_crt_pool
+typedef struct {
+    mpz_ptr c, mod, exp;
+    mpz_t out;
+} crt_part_t;
+
+static void crt_part(void *arg) {
+    crt_part_t *part = (crt_part_t *) arg;
+    mpz_ptr cr = nt_ws_local()->t[5];
+    mpz_mod(cr, part->c, part->mod);
+    pow_mod(part->out, cr, part->exp, part->mod);
+}
+
+// RSA DECRYPT WITH CRT ON A POOL
+// @param m : Stores decrypted message
+// @param c : Ciphertext to decrypt
+// @param key : Private key
+// @param pool : Workers, NULL runs rsa_decrypt_crt on the calling thread
+// Every prime's exponentiation is a task of its own, each on the workspace
+// of the worker running it, and the caller recombines once all are done.
+// A key with k primes finishes in about the time of one exponentiation
+// mod a prime when k workers are free.
+void rsa_decrypt_crt_pool(mpz_t m, mpz_t c, rsa_priv_t *key, pool_t *pool) {
+    if (pool == NULL || !key->crt) {
+        rsa_decrypt_crt(m, c, key);
+        return;
+    }
+    mpz_ptr mods[RSA_MAX_PRIMES], exps[RSA_MAX_PRIMES];
+    uint64_t count = rsa_priv_moduli(key, mods, exps);
+    crt_part_t parts[RSA_MAX_PRIMES];
+    for (uint64_t i = 0; i < count; i += 1) {
+        parts[i].c = c;
+        parts[i].mod = mods[i];
+        parts[i].exp = exps[i];
+        mpz_init(parts[i].out);
+        pool_submit(pool, crt_part, &parts[i]);
     }
-    k -= 1;
-    k /= 8;
-    uint8_t *buffer = (uint8_t *) calloc(k, sizeof(uint8_t));
-    while (gmp_fscanf(infile, "%Zx\n", c) != EOF) {
-        rsa_decrypt(m, c, d, n);
-        mpz_export(buffer, &j, 1, sizeof(uint8_t), 1, 0, m);
-        fwrite(buffer + 1, sizeof(uint8_t), j - 1, outfile);
-        j = 0;
+    pool_wait(pool);
+    rsa_crt_combine(m, parts[0].out, parts[1].out, key);
+    for (uint64_t i = 0; i < key->extra; i += 1) {
+        rsa_crt_extend(m, parts[i + 2].out, i, key);
+    }
+    for (uint64_t i = 0; i < count; i += 1) {
+        mpz_clear(parts[i].out);
     }
-    free(buffer);
-    mpz_clears(nlog, m, c, NULL);
     return;
 }
 
@@ -239,6 +580,26 @@ void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n) {
     return;
 }
 
+// RSA SIGN WITH CRT
+// @param s : Initialized variable to store sign
+// @param m : Message to sign
+// @param key : Private key
+// Signing is a private key operation, so it shares the CRT decrypt path.
+void rsa_sign_crt(mpz_t s, mpz_t m, rsa_priv_t *key) {
+    rsa_decrypt_crt(s, m, key);
+    return;
+}
+
+// RSA SIGN WITH CRT ON A POOL
+// @param s : Initialized variable to store sign
+// @param m : Message to sign
+// @param key : Private key
+// @param pool : Workers for the per-prime exponentiations, may be NULL
+void rsa_sign_crt_pool(mpz_t s, mpz_t m, rsa_priv_t *key, pool_t *pool) {
+    rsa_decrypt_crt_pool(s, m, key, pool);
+    return;
+}
+
 // VERIFY RSA SIGN
 // @param m : Message m
 // @param s : Sign s
@@ -246,13 +607,37 @@ void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n) {
 // @param n : Mod n
 // Verifies the sign of a message. If its inverse and the message are equal.
 bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n) {
-    mpz_t t;
-    mpz_init(t);
-    pow_mod(t, s, e, n); // VERIFYING IS THE INVERSE OF SIGNING
-    if (mpz_cmp(t, m) == 0) { // IF T AND M ARE EQUAL, VERIFIED
-        mpz_clear(t);
-        return true;
+    mpz_ptr t = nt_ws_local()->t[7];
+    if (mpz_fits_ulong_p(e)) {
+        pow_mod_ui(t, s, mpz_get_ui(e), n); // SMALL EXPONENT FAST PATH
+    } else {
+        pow_mod(t, s, e, n); // VERIFYING IS THE INVERSE OF SIGNING
+    }
+    return mpz_cmp(t, m) == 0; // IF T AND M ARE EQUAL, VERIFIED
+}
+
+// ENCODE DIGEST FOR SIGNING
+// @param m : Initialized variable to store the encoded digest
+// @param digest : SHA-256 digest of the signed data
+// @param n : Mod n
+// EMSA-PKCS1-v1_5 (RFC 8017 9.2): 00 01 FF .. FF 00 DigestInfo digest,
+// as wide as n. Returns false when n is too small for the encoding.
+bool rsa_encode_digest(mpz_t m, const uint8_t digest[SHA256_DIGEST], mpz_t n) {
+    static const uint8_t info[] = { 0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+        0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20 };
+    size_t modbytes = mpz_sizeinbase(n, 256);
+    size_t tlen = sizeof(info) + SHA256_DIGEST;
+    if (modbytes < tlen + 11) { // AT LEAST 8 BYTES OF FF PADDING
+        return false;
     }
-    mpz_clear(t);
-    return false;
+    uint8_t *em = (uint8_t *) malloc(modbytes);
+    em[0] = 0x00;
+    em[1] = 0x01;
+    memset(em + 2, 0xFF, modbytes - tlen - 3);
+    em[modbytes - tlen - 1] = 0x00;
+    memcpy(em + modbytes - tlen, info, sizeof(info));
+    memcpy(em + modbytes - SHA256_DIGEST, digest, SHA256_DIGEST);
+    mpz_import(m, modbytes, 1, sizeof(uint8_t), 1, 0, em);
+    free(em);
+    return true;
 }
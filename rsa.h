@@ -1,30 +1,164 @@
 #pragma once
 
+#include "sha256.h"
+#include "threadpool.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <gmp.h>
 
+// RSA PRIVATE KEY
+// Keys read from legacy two-line files only hold n and d and have crt unset.
+// Extended keys also carry p, q, dP = d mod (p-1), dQ = d mod (q-1) and
+// qInv = q^-1 mod p for Chinese Remainder Theorem private operations.
+// Multi-prime keys (RFC 8017 3.2) add extra primes r_i, each with
+// d_i = d mod (r_i - 1) and t_i = (p q r_3 ... r_(i-1))^-1 mod r_i; rprod
+// holds that product, which is derived rather than stored.
+#define RSA_MAX_PRIMES 5
+#define RSA_EXTRA      (RSA_MAX_PRIMES - 2)
+
+typedef struct {
+    mpz_t n, d;
+    bool crt;
+    mpz_t p, q, dp, dq, qinv;
+    uint64_t extra; // PRIMES BEYOND p AND q
+    mpz_t r[RSA_EXTRA], dr[RSA_EXTRA], tr[RSA_EXTRA], rprod[RSA_EXTRA];
+} rsa_priv_t;
+
+// FILE ENCRYPTION OPTIONS
+// Files run through a reader, a compute stage and a writer connected by
+// bounded rings. batch is the blocks per ring entry and window the entries
+// in flight (0 picks 4, or 4 per thread with threads), which together bound
+// the buffered data. threads = 0 computes on the calling thread, otherwise
+// batches are spread over a work-stealing pool. binary selects the binary
+// ciphertext container instead of one hexstring per line; decryption
+// detects the container by itself. hybrid writes the container in hybrid
+// mode, where only a session key goes through RSA. compress runs the
+// input through the built-in LZ codec before block encryption, and index
+// ends the container in a batch index for range decryption. Both imply the
+// container.
+typedef struct {
+    uint64_t threads;
+    uint64_t batch;
+    uint64_t window;
+    bool binary;
+    bool hybrid;
+    bool compress;
+    bool index;
+} rsa_file_opts_t;
+
+// BINARY CIPHERTEXT CONTAINER
+// A 24 byte header, all fields big-endian:
+//   magic[4]  0x89 'R' 'S' 'A' (0x89 is never a hex digit)
+//   version   1 byte
+//   flags     1 byte
+//   reserved  2 bytes
+//   modbytes  4 bytes, bytes in n and in every ciphertext block
+//   blocksize 4 bytes, k; each block carries up to k-1 plaintext bytes
+//   length    8 bytes, plaintext length or all ones when it was unknown
+// followed by the ciphertext blocks, each modbytes wide.
+//
+// With RSA_BIN_HYBRID in flags, blocksize is the chunk size instead and the
+// header is followed by one modbytes wide block wrapping 0xFF and k-1 random
+// bytes, the first 32 of them a ChaCha20-Poly1305 key and the next 7 a nonce
+// prefix. The payload follows in chunks of blocksize bytes plus a 16 byte
+// tag, only the last one shorter. Chunk i is sealed under the nonce
+// prefix || i (4 bytes) || 1 if last else 0, with the first 16 header bytes
+// as associated data, so reordered, dropped or truncated chunks fail.
+//
+// With RSA_BIN_COMPRESSED in flags, the blocks carry a stream of LZ frames
+// instead of the plaintext: raw length (4 bytes), stored length (4 bytes)
+// and the payload, which is raw when both lengths are equal. Frames hold
+// at most LZ_FRAME raw bytes and length stays the uncompressed length.
+//
+// With RSA_BIN_INDEXED in flags, the blocks end at a block of all 0xFF
+// bytes, which no ciphertext below n can be. An index follows with one
+// 16 byte entry per batch (or frame): its plaintext offset and the offset
+// of its first block from the start of the container. A 24 byte footer
+// closes the file: the entry count, the plaintext length and the index
+// magic. Hybrid containers need no index since every chunk has a fixed
+// place.
+#define RSA_BIN_MAGIC       "\x89RSA"
+#define RSA_BIN_VERSION     1
+#define RSA_BIN_HEADER      24
+#define RSA_BIN_HYBRID      0x01
+#define RSA_BIN_COMPRESSED  0x02
+#define RSA_BIN_INDEXED     0x04
+#define RSA_BIN_ENTRY       16
+#define RSA_BIN_FOOTER      24
+#define RSA_BIN_INDEX_MAGIC "\x89RSAIDX"
+#define RSA_HYBRID_MIN_BITS 321 // SMALLEST n WHOSE k-1 BYTES HOLD THE 39 SESSION BYTES
+
 void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters);
 
+void rsa_make_pub_fixed(
+    mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t pubexp);
+
+void rsa_make_pub_parallel(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters,
+    uint64_t pubexp, uint64_t seed, uint64_t threads);
+
+void rsa_make_pub_multi(mpz_t primes[], uint64_t count, mpz_t n, mpz_t e, uint64_t nbits,
+    uint64_t iters, uint64_t pubexp, uint64_t seed, uint64_t threads);
+
 void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
 
 void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
 
 void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q);
 
+void rsa_make_priv_multi(mpz_t d, mpz_t e, mpz_t primes[], uint64_t count);
+
 void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile);
 
 void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile);
 
+void rsa_priv_init(rsa_priv_t *key);
+
+void rsa_priv_clear(rsa_priv_t *key);
+
+void rsa_make_priv_crt(rsa_priv_t *key, mpz_t n, mpz_t d, mpz_t p, mpz_t q);
+
+void rsa_make_priv_crt_multi(rsa_priv_t *key, mpz_t n, mpz_t d, mpz_t primes[], uint64_t count);
+
+uint64_t rsa_priv_moduli(rsa_priv_t *key, mpz_ptr mods[], mpz_ptr exps[]);
+
+void rsa_write_priv_crt(rsa_priv_t *key, FILE *pvfile);
+
+void rsa_read_priv_crt(rsa_priv_t *key, FILE *pvfile);
+
 void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n);
 
-void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e);
+void rsa_file_opts_init(rsa_file_opts_t *opts);
+
+bool rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e);
+
+bool rsa_encrypt_file_opts(
+    FILE *infile, FILE *outfile, mpz_t n, mpz_t e, const rsa_file_opts_t *opts);
 
 void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n);
 
-void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d);
+void rsa_decrypt_crt(mpz_t m, mpz_t c, rsa_priv_t *key);
+
+void rsa_decrypt_crt_pool(mpz_t m, mpz_t c, rsa_priv_t *key, pool_t *pool);
+
+void rsa_crt_combine(mpz_t m, mpz_t m1, mpz_t m2, rsa_priv_t *key);
+
+void rsa_crt_extend(mpz_t m, mpz_t mi, uint64_t i, rsa_priv_t *key);
+
+bool rsa_decrypt_file(FILE *infile, FILE *outfile, rsa_priv_t *key);
+
+bool rsa_decrypt_file_opts(
+    FILE *infile, FILE *outfile, rsa_priv_t *key, const rsa_file_opts_t *opts);
+
+bool rsa_decrypt_range(FILE *infile, FILE *outfile, rsa_priv_t *key, int64_t start, uint64_t len,
+    const rsa_file_opts_t *opts);
 
 void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n);
 
+void rsa_sign_crt(mpz_t s, mpz_t m, rsa_priv_t *key);
+
+void rsa_sign_crt_pool(mpz_t s, mpz_t m, rsa_priv_t *key, pool_t *pool);
+
 bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n);
+
+bool rsa_encode_digest(mpz_t m, const uint8_t digest[SHA256_DIGEST], mpz_t n);
@@ -0,0 +1,233 @@
+#include "rsad.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OPTIONS "hvs:k:m:i:o:g:b:z:l:"
+
+#define BENCH_LEN 32 // MESSAGE BYTES PER BENCHMARK OPERATION
+
+void help(char *exec) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "   Sends encrypt, decrypt, sign and verify requests to rsad.\n\n"
+        "USAGE\n"
+        "   %s [-hv] [-s socket] [-k key] [-m mode] [-i infile] [-o outfile] [-g sigfile]\n"
+        "   %*s [-b count] [-z batch] [-l bytes]\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -v              Display verbose program output.\n"
+        "   -s socket       Socket path of the daemon (default: rsad.sock).\n"
+        "   -k key          Index of the key pair in the daemon (default: 0).\n"
+        "   -m mode         encrypt, decrypt, sign, verify or stats (default: encrypt).\n"
+        "   -i infile       Message, ciphertext block or signed message (default: stdin).\n"
+        "   -o outfile      Ciphertext block, message or signature (default: stdout).\n"
+        "   -g sigfile      Signature block to verify against the input.\n"
+        "   -b count        Benchmark count operations of mode on random messages and\n"
+        "                   report the p50 and p99 round trip of each batch.\n"
+        "   -z batch        Operations per request when benchmarking (default: 1).\n"
+        "   -l bytes        Message bytes when benchmarking (default: 32).\n"
+        "Blocks are raw bytes as wide as n, while sign and verify write and read one hex\n"
+        "line: pass a signature from -m sign through xxd -p | tr -d '\\n' for verify, and\n"
+        "one from sign through xxd -r -p, left padded to the width of n, for -g.\n",
+        exec, (int) strlen(exec), "");
+}
+
+// READ WHOLE FILE
+// @param infile : File to read
+// @param len : Receives the bytes read
+static uint8_t *read_all(FILE *infile, size_t *len) {
+    size_t cap = 4096;
+    uint8_t *buf = (uint8_t *) malloc(cap);
+    *len = 0;
+    size_t got;
+    while ((got = fread(buf + *len, sizeof(uint8_t), cap - *len, infile)) > 0) {
+        *len += got;
+        if (*len == cap) {
+            cap *= 2;
+            buf = (uint8_t *) realloc(buf, cap);
+        }
+    }
+    return buf;
+}
+
+static uint8_t mode_op(const char *mode) {
+    for (uint8_t op = RSAD_OP_ENCRYPT; op < RSAD_OPS; op += 1) {
+        if (strcmp(mode, rsad_op_name(op)) == 0) {
+            return op;
+        }
+    }
+    return 0;
+}
+
+static const char *status_text(uint8_t status) {
+    switch (status) {
+    case RSAD_OK: return "ok";
+    case RSAD_NO_KEY: return "the daemon has no key for this operation";
+    case RSAD_BAD_SIGNATURE: return "signature does not verify";
+    default: return "request rejected";
+    }
+}
+
+// BENCHMARK
+// @param conn : Open connection
+// @param op : Operation to time
+// @param key : Key pair index
+// @param count : Operations to run
+// @param batch : Operations per request
+// @param bytes : Message bytes
+// Decrypt and verify first get their inputs from one encrypt or sign batch.
+static bool bench(rsad_conn_t *conn, uint8_t op, uint8_t key, uint64_t count, uint32_t batch,
+    uint32_t bytes) {
+    rsad_op_t *ops = (rsad_op_t *) calloc(batch, sizeof(rsad_op_t));
+    rsad_result_t *res = (rsad_result_t *) calloc(batch, sizeof(rsad_result_t));
+    uint8_t **data = (uint8_t **) calloc(batch, sizeof(uint8_t *));
+    bool ok = true;
+    for (uint32_t i = 0; i < batch; i += 1) {
+        data[i] = (uint8_t *) malloc(bytes);
+        for (uint32_t j = 0; j < bytes; j += 1) {
+            data[i][j] = rand() & 0xFF;
+        }
+        ops[i].op = op == RSAD_OP_DECRYPT ? RSAD_OP_ENCRYPT : op == RSAD_OP_VERIFY ? RSAD_OP_SIGN : op;
+        ops[i].key = key;
+        ops[i].len = bytes;
+        ops[i].data = data[i];
+    }
+    if (op == RSAD_OP_DECRYPT || op == RSAD_OP_VERIFY) {
+        ok = rsad_call(conn, ops, batch, res);
+        for (uint32_t i = 0; ok && i < batch; i += 1) {
+            ok = res[i].status == RSAD_OK;
+            // DECRYPT THE CIPHERTEXT, OR VERIFY THE SIGNATURE FOLLOWED BY ITS MESSAGE
+            uint32_t len = res[i].len + (op == RSAD_OP_VERIFY ? bytes : 0);
+            uint8_t *in = (uint8_t *) malloc(len);
+            memcpy(in, res[i].data, res[i].len);
+            memcpy(in + res[i].len, data[i], len - res[i].len);
+            free(data[i]);
+            data[i] = in;
+            ops[i].op = op;
+            ops[i].len = len;
+            ops[i].data = in;
+        }
+    }
+    rsad_lat_t lat;
+    rsad_lat_init(&lat, count / batch + 1);
+    uint64_t begin = rsad_now_ns();
+    for (uint64_t done = 0; ok && done < count; done += batch) {
+        uint32_t n = count - done < batch ? count - done : batch;
+        uint64_t start = rsad_now_ns();
+        ok = rsad_call(conn, ops, n, res);
+        rsad_lat_add(&lat, rsad_now_ns() - start);
+        for (uint32_t i = 0; ok && i < n; i += 1) {
+            ok = res[i].status == RSAD_OK;
+        }
+    }
+    uint64_t total = rsad_now_ns() - begin;
+    if (ok) {
+        uint64_t p50, p99;
+        rsad_lat_percentiles(&lat, &p50, &p99);
+        printf("%s: %lu ops in %.3f s, %.0f ops/s\n", rsad_op_name(op), count, total / 1e9,
+            count / (total / 1e9));
+        printf("round trip of %u ops: p50 %.1f us, p99 %.1f us\n", batch, p50 / 1e3, p99 / 1e3);
+    }
+    rsad_lat_clear(&lat);
+    for (uint32_t i = 0; i < batch; i += 1) {
+        free(data[i]);
+    }
+    free(data);
+    free(ops);
+    free(res);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    const char *path = RSAD_SOCKET;
+    FILE *infile = stdin;
+    FILE *outfile = stdout;
+    FILE *sigfile = NULL;
+    uint8_t op = RSAD_OP_ENCRYPT;
+    uint8_t key = 0;
+    uint64_t count = 0;
+    uint32_t batch = 1;
+    uint32_t bytes = BENCH_LEN;
+    int opt = 0;
+    bool verbose = false;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 's': path = optarg; break;
+        case 'k': key = atoi(optarg); break;
+        case 'm': op = mode_op(optarg); break;
+        case 'i': infile = fopen(optarg, "r"); break;
+        case 'o': outfile = fopen(optarg, "w"); break;
+        case 'g': sigfile = fopen(optarg, "r"); break;
+        case 'b': count = strtoull(optarg, NULL, 10); break;
+        case 'z': batch = atoi(optarg); break;
+        case 'l': bytes = atoi(optarg); break;
+        case 'v': verbose = true; break;
+        case 'h': {
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+        }
+    }
+    if (op == 0 || batch == 0) {
+        help(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (infile == NULL || outfile == NULL || (op == RSAD_OP_VERIFY && count == 0 && sigfile == NULL)) {
+        fprintf(stderr, "Could not open a file.\n");
+        return EXIT_FAILURE;
+    }
+    rsad_conn_t conn;
+    if (!rsad_open(&conn, path)) {
+        fprintf(stderr, "Could not connect to %s.\n", path);
+        return EXIT_FAILURE;
+    }
+    if (count > 0) {
+        bool ok = bench(&conn, op, key, count, batch, bytes);
+        if (!ok) {
+            fprintf(stderr, "Benchmark failed.\n");
+        }
+        rsad_close(&conn);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // One operation on the whole input, verify puts the signature first.
+    // STATS CARRIES NO DATA, SO IT DOES NOT WAIT ON THE INPUT
+    size_t len = 0, siglen = 0;
+    uint8_t *data = op == RSAD_OP_STATS ? (uint8_t *) malloc(1) : read_all(infile, &len);
+    if (sigfile != NULL) {
+        uint8_t *sig = read_all(sigfile, &siglen);
+        sig = (uint8_t *) realloc(sig, siglen + len + 1);
+        memcpy(sig + siglen, data, len);
+        free(data);
+        data = sig;
+        len += siglen;
+    }
+    rsad_op_t req = { op, key, (uint32_t) len, data };
+    rsad_result_t res;
+    uint64_t start = rsad_now_ns();
+    bool ok = rsad_call(&conn, &req, 1, &res);
+    uint64_t took = rsad_now_ns() - start;
+    if (!ok) {
+        fprintf(stderr, "Request failed.\n");
+    } else if (res.status != RSAD_OK) {
+        fprintf(stderr, "%s: %s.\n", rsad_op_name(op), status_text(res.status));
+    } else {
+        fwrite(res.data, sizeof(uint8_t), res.len, outfile);
+    }
+    if (verbose) {
+        fprintf(stderr, "round trip = %.1f us\n", took / 1e3);
+    }
+    ok = ok && res.status == RSAD_OK;
+
+    // Close files and the connection
+    free(data);
+    rsad_close(&conn);
+    fclose(infile);
+    fclose(outfile);
+    if (sigfile != NULL) {
+        fclose(sigfile);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,424 @@
+#include "rsa.h"
+#include "rsad.h"
+#include "montgomery.h"
+#include "sha256.h"
+#include "arena.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define OPTIONS "hvs:k:"
+
+#define MAX_KEYS    16
+#define LAT_SAMPLES 65536 // RECENT SERVICE TIMES KEPT PER OPERATION
+#define STATS_ROOM  512
+
+// ONE LOADED KEY PAIR
+// Everything an operation needs is computed once at load time: the
+// Montgomery context of n for public operations and of p and q (or n when
+// the private key has no CRT values) for private ones.
+typedef struct {
+    bool pub, priv;
+    mpz_t n, e;
+    rsa_priv_t sk;
+    uint64_t k; // BLOCK SIZE, EACH BLOCK CARRIES k-1 BYTES
+    size_t modbytes;
+    bool small; // e FITS A WORD
+    mont_ctx_t ctx, ctxp, ctxq;
+    mont_ctx_t ctxr[RSA_EXTRA]; // EXTRA PRIMES OF A MULTI-PRIME KEY
+} keypair_t;
+
+typedef struct {
+    keypair_t keys[MAX_KEYS];
+    size_t count;
+    pthread_mutex_t lock; // GUARDS lat
+    rsad_lat_t lat[RSAD_OPS];
+} server_t;
+
+// PER CONNECTION SCRATCH
+typedef struct {
+    mpz_t m, c, m1, m2;
+} scratch_t;
+
+static server_t server;
+static volatile sig_atomic_t stopping = 0;
+
+void help(char *exec) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "   Serves encrypt, decrypt, sign and verify requests over a Unix socket.\n\n"
+        "USAGE\n"
+        "   %s [-hv] [-s socket] [-k key]...\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -v              Print the service times of every operation on exit.\n"
+        "   -s socket       Socket path to listen on (default: rsad.sock).\n"
+        "   -k key          Load key.pub and key.priv as the next key pair, either may be\n"
+        "                   missing; repeat for more pairs (default: rsa).\n",
+        exec);
+}
+
+// GROW A BUFFER, DOUBLING SO A BATCH OF RESULTS APPENDS IN LINEAR TIME
+static void reserve(uint8_t **buf, size_t *cap, size_t size) {
+    if (*cap < size) {
+        *cap = size > 2 * *cap ? size : 2 * *cap;
+        *buf = (uint8_t *) realloc(*buf, *cap);
+    }
+}
+
+static void put_be(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i -= 1) {
+        p[i] = v & 0xFF;
+        v >>= 8;
+    }
+}
+
+static uint64_t get_be(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i += 1) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// EXPORT FIXED WIDTH BLOCK
+static void export_fixed(uint8_t *block, mpz_t c, size_t width) {
+    size_t count = mpz_sgn(c) == 0 ? 0 : mpz_sizeinbase(c, 256);
+    memset(block, 0, width - count);
+    mpz_export(block + width - count, NULL, 1, sizeof(uint8_t), 1, 0, c);
+}
+
+// LOAD KEY PAIR
+// @param kp : Key pair to fill
+// @param name : Path prefix of the .pub and .priv files
+// Returns false when neither file can be read or their moduli differ.
+static bool load_key(keypair_t *kp, const char *name) {
+    char path[4096], username[256];
+    mpz_inits(kp->n, kp->e, NULL);
+    rsa_priv_init(&kp->sk);
+    snprintf(path, sizeof(path), "%s.pub", name);
+    FILE *pbfile = fopen(path, "r");
+    if (pbfile != NULL) {
+        mpz_t s;
+        mpz_init(s);
+        rsa_read_pub(kp->n, kp->e, s, username, pbfile);
+        kp->pub = mpz_sgn(kp->n) > 0 && mpz_odd_p(kp->n);
+        mpz_clear(s);
+        fclose(pbfile);
+    }
+    snprintf(path, sizeof(path), "%s.priv", name);
+    FILE *pvfile = fopen(path, "r");
+    if (pvfile != NULL) {
+        rsa_read_priv_crt(&kp->sk, pvfile);
+        kp->priv = mpz_sgn(kp->sk.n) > 0 && mpz_odd_p(kp->sk.n);
+        fclose(pvfile);
+    }
+    if ((!kp->pub && !kp->priv) || (kp->pub && kp->priv && mpz_cmp(kp->n, kp->sk.n) != 0)) {
+        return false;
+    }
+    if (!kp->pub) {
+        mpz_set(kp->n, kp->sk.n);
+    }
+    kp->k = (mpz_sizeinbase(kp->n, 2) - 1) / 8;
+    kp->modbytes = mpz_sizeinbase(kp->n, 256);
+    kp->small = mpz_fits_ulong_p(kp->e);
+    mont_init(&kp->ctx, kp->n);
+    if (kp->priv && kp->sk.crt) {
+        mont_init(&kp->ctxp, kp->sk.p);
+        mont_init(&kp->ctxq, kp->sk.q);
+        for (uint64_t i = 0; i < kp->sk.extra; i += 1) {
+            mont_init(&kp->ctxr[i], kp->sk.r[i]);
+        }
+    }
+    return kp->k >= 2;
+}
+
+// PUBLIC OPERATION
+static void public_pow(mpz_t o, mpz_t a, keypair_t *kp) {
+    if (kp->small) {
+        mont_pow_ui(o, a, mpz_get_ui(kp->e), &kp->ctx);
+    } else {
+        mont_pow(o, a, kp->e, &kp->ctx);
+    }
+}
+
+// PRIVATE OPERATION
+static void private_pow(mpz_t o, mpz_t a, keypair_t *kp, scratch_t *sc) {
+    if (kp->sk.crt) {
+        mont_pow(sc->m1, a, kp->sk.dp, &kp->ctxp);
+        mont_pow(sc->m2, a, kp->sk.dq, &kp->ctxq);
+        rsa_crt_combine(o, sc->m1, sc->m2, &kp->sk);
+        for (uint64_t i = 0; i < kp->sk.extra; i += 1) {
+            mont_pow(sc->m1, a, kp->sk.dr[i], &kp->ctxr[i]);
+            rsa_crt_extend(o, sc->m1, i, &kp->sk);
+        }
+    } else {
+        mont_pow(o, a, kp->sk.d, &kp->ctx);
+    }
+}
+
+// WRITE STATS TEXT
+// @param out : Receives at most STATS_ROOM bytes
+static uint32_t write_stats(uint8_t *out) {
+    size_t len = 0;
+    pthread_mutex_lock(&server.lock);
+    for (uint8_t op = RSAD_OP_ENCRYPT; op <= RSAD_OP_VERIFY; op += 1) {
+        uint64_t p50, p99;
+        rsad_lat_percentiles(&server.lat[op], &p50, &p99);
+        len += snprintf((char *) out + len, STATS_ROOM - len, "%-8s count=%lu p50=%.1fus p99=%.1fus\n",
+            rsad_op_name(op), server.lat[op].count, p50 / 1e3, p99 / 1e3);
+    }
+    pthread_mutex_unlock(&server.lock);
+    return len;
+}
+
+// RUN ONE OPERATION
+// @param op : Operation code
+// @param key : Key pair index
+// @param data : Operation data
+// @param len : Bytes of data
+// @param out : Receives the result, room for the modulus or STATS_ROOM bytes
+// @param olen : Receives the result length
+// @param sc : Scratch of the calling connection
+// Returns the status of the result.
+static uint8_t run_op(uint8_t op, uint8_t key, const uint8_t *data, uint32_t len, uint8_t *out,
+    uint32_t *olen, scratch_t *sc) {
+    *olen = 0;
+    if (op == RSAD_OP_STATS) {
+        *olen = write_stats(out);
+        return RSAD_OK;
+    }
+    if (key >= server.count || op < RSAD_OP_ENCRYPT || op > RSAD_OP_VERIFY) {
+        return RSAD_BAD_REQUEST;
+    }
+    keypair_t *kp = &server.keys[key];
+    bool private = op == RSAD_OP_DECRYPT || op == RSAD_OP_SIGN;
+    if ((private && !kp->priv) || (!private && !kp->pub)) {
+        return RSAD_NO_KEY;
+    }
+    uint8_t digest[SHA256_DIGEST];
+    sha256_t hash;
+    switch (op) {
+    case RSAD_OP_ENCRYPT:
+        if (len > kp->k - 1) {
+            return RSAD_BAD_REQUEST;
+        }
+        // THE SAME 0xFF PAD AS THE FILE FORMATS
+        mpz_import(sc->m, len, 1, sizeof(uint8_t), 1, 0, data);
+        mpz_set_ui(sc->c, 0xFF);
+        mpz_mul_2exp(sc->c, sc->c, 8 * len);
+        mpz_ior(sc->m, sc->m, sc->c);
+        public_pow(sc->c, sc->m, kp);
+        export_fixed(out, sc->c, kp->modbytes);
+        *olen = kp->modbytes;
+        return RSAD_OK;
+    case RSAD_OP_DECRYPT: {
+        if (len != kp->modbytes) {
+            return RSAD_BAD_REQUEST;
+        }
+        mpz_import(sc->c, len, 1, sizeof(uint8_t), 1, 0, data);
+        if (mpz_cmp(sc->c, kp->n) >= 0) {
+            return RSAD_BAD_REQUEST;
+        }
+        private_pow(sc->m, sc->c, kp, sc);
+        size_t j = mpz_sgn(sc->m) == 0 ? 0 : mpz_sizeinbase(sc->m, 256);
+        mpz_tdiv_q_2exp(sc->c, sc->m, 8 * (j - (j > 0)));
+        if (j == 0 || mpz_cmp_ui(sc->c, 0xFF) != 0) {
+            return RSAD_BAD_REQUEST; // NOT A PADDED BLOCK UNDER THIS KEY
+        }
+        mpz_tdiv_r_2exp(sc->m, sc->m, 8 * (j - 1));
+        export_fixed(out, sc->m, j - 1);
+        *olen = j - 1;
+        return RSAD_OK;
+    }
+    case RSAD_OP_SIGN:
+        sha256_init(&hash);
+        sha256_update(&hash, data, len);
+        sha256_final(&hash, digest);
+        if (!rsa_encode_digest(sc->m, digest, kp->n)) {
+            return RSAD_BAD_REQUEST;
+        }
+        private_pow(sc->c, sc->m, kp, sc);
+        export_fixed(out, sc->c, kp->modbytes);
+        *olen = kp->modbytes;
+        return RSAD_OK;
+    default: // RSAD_OP_VERIFY
+        if (len < kp->modbytes) {
+            return RSAD_BAD_REQUEST;
+        }
+        sha256_init(&hash);
+        sha256_update(&hash, data + kp->modbytes, len - kp->modbytes);
+        sha256_final(&hash, digest);
+        mpz_import(sc->c, kp->modbytes, 1, sizeof(uint8_t), 1, 0, data);
+        if (!rsa_encode_digest(sc->m, digest, kp->n) || mpz_cmp(sc->c, kp->n) >= 0) {
+            return RSAD_BAD_SIGNATURE;
+        }
+        public_pow(sc->m1, sc->c, kp);
+        return mpz_cmp(sc->m1, sc->m) == 0 ? RSAD_OK : RSAD_BAD_SIGNATURE;
+    }
+}
+
+// SERVE ONE CONNECTION
+// Answers request frames until the client hangs up or sends a frame that
+// does not parse. Operations of a batch run in order on this thread and
+// each one's service time goes into the reservoir of its operation.
+static void *serve(void *arg) {
+    int fd = (int) (intptr_t) arg;
+    scratch_t sc;
+    mpz_inits(sc.m, sc.c, sc.m1, sc.m2, NULL);
+    size_t room = STATS_ROOM;
+    for (size_t i = 0; i < server.count; i += 1) {
+        room = server.keys[i].modbytes > room ? server.keys[i].modbytes : room;
+    }
+    uint8_t *in = NULL, *out = NULL;
+    size_t in_cap = 0, out_cap = 0, len;
+    while (rsad_recv(fd, &in, &in_cap, &len)) {
+        if (len < 4) {
+            break;
+        }
+        uint64_t count = get_be(in, 4);
+        // CHECK THE WHOLE FRAME BEFORE RUNNING ANY OF IT
+        size_t at = 4;
+        uint64_t i = 0;
+        for (; i < count && len - at >= 6 && len - at - 6 >= get_be(in + at + 2, 4); i += 1) {
+            at += 6 + get_be(in + at + 2, 4);
+        }
+        if (i < count || at != len) {
+            break;
+        }
+        size_t olen = 4;
+        reserve(&out, &out_cap, olen);
+        put_be(out, count, 4);
+        at = 4;
+        for (i = 0; i < count; i += 1) {
+            uint8_t op = in[at], key = in[at + 1];
+            uint32_t dlen = get_be(in + at + 2, 4), rlen;
+            reserve(&out, &out_cap, olen + 5 + room);
+            uint64_t start = rsad_now_ns();
+            out[olen] = run_op(op, key, in + at + 6, dlen, out + olen + 5, &rlen, &sc);
+            uint64_t took = rsad_now_ns() - start;
+            if (op > 0 && op < RSAD_OPS) {
+                pthread_mutex_lock(&server.lock);
+                rsad_lat_add(&server.lat[op], took);
+                pthread_mutex_unlock(&server.lock);
+            }
+            put_be(out + olen + 1, rlen, 4);
+            olen += 5 + rlen;
+            at += 6 + dlen;
+        }
+        if (!rsad_send(fd, out, olen)) {
+            break;
+        }
+    }
+    close(fd);
+    free(in);
+    free(out);
+    mpz_clears(sc.m, sc.c, sc.m1, sc.m2, NULL);
+    return NULL;
+}
+
+static void on_signal(int sig) {
+    (void) sig;
+    stopping = 1;
+}
+
+int main(int argc, char **argv) {
+    arena_install(); // BEFORE ANY GMP ALLOCATION
+    const char *path = RSAD_SOCKET;
+    const char *names[MAX_KEYS];
+    size_t nnames = 0;
+    int opt = 0;
+    bool verbose = false;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 's': path = optarg; break;
+        case 'k': {
+            if (nnames == MAX_KEYS) {
+                fprintf(stderr, "At most %d key pairs.\n", MAX_KEYS);
+                return EXIT_FAILURE;
+            }
+            names[nnames++] = optarg;
+            break;
+        }
+        case 'v': verbose = true; break;
+        case 'h': {
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+        }
+    }
+    if (nnames == 0) {
+        names[nnames++] = "rsa";
+    }
+
+    // Load every key pair once, with its contexts
+    for (size_t i = 0; i < nnames; i += 1) {
+        if (!load_key(&server.keys[i], names[i])) {
+            fprintf(stderr, "Could not load key pair %s.\n", names[i]);
+            return EXIT_FAILURE;
+        }
+        server.count += 1;
+    }
+    pthread_mutex_init(&server.lock, NULL);
+    for (int op = 0; op < RSAD_OPS; op += 1) {
+        rsad_lat_init(&server.lat[op], LAT_SAMPLES);
+    }
+
+    // Listen on the socket
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path is too long.\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, path);
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(lfd, 64) != 0) {
+        fprintf(stderr, "Could not listen on %s.\n", path);
+        return EXIT_FAILURE;
+    }
+
+    // Stop on SIGINT and SIGTERM; accept returns EINTR without SA_RESTART
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!stopping) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                fprintf(stderr, "accept: %s\n", strerror(errno));
+            }
+            continue;
+        }
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, serve, (void *) (intptr_t) fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    close(lfd);
+    unlink(path);
+
+    // If verbose
+    if (verbose) {
+        uint8_t stats[STATS_ROOM];
+        uint32_t len = write_stats(stats);
+        fwrite(stats, sizeof(uint8_t), len, stderr);
+    }
+    return EXIT_SUCCESS;
+}
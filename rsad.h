@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// RSAD WIRE PROTOCOL
+// Every message is a frame: a 4 byte body length followed by the body, all
+// fields big-endian. A request body holds a 4 byte operation count and that
+// many operations:
+//   op      1 byte, one of RSAD_OP_*
+//   key     1 byte, index of the key pair in the order the daemon loaded them
+//   length  4 bytes
+//   data    length bytes
+// The response body repeats the count and holds one result per operation,
+// in request order:
+//   status  1 byte, one of RSAD_*
+//   length  4 bytes
+//   data    length bytes
+//
+// ENCRYPT takes up to k-1 message bytes and returns one ciphertext block as
+// wide as n, padded with 0xFF like the file formats; DECRYPT reverses it.
+// SIGN hashes its data with SHA-256 and returns the PKCS #1 v1.5 signature
+// block. VERIFY takes a signature block followed by the message and returns
+// no data, only RSAD_OK or RSAD_BAD_SIGNATURE. STATS ignores key and data
+// and returns one text line per operation with its count and the p50 and
+// p99 service time in the daemon.
+#define RSAD_SOCKET    "rsad.sock"
+#define RSAD_MAX_FRAME (1 << 26)
+
+#define RSAD_OP_ENCRYPT 1
+#define RSAD_OP_DECRYPT 2
+#define RSAD_OP_SIGN    3
+#define RSAD_OP_VERIFY  4
+#define RSAD_OP_STATS   5
+#define RSAD_OPS        6
+
+#define RSAD_OK            0
+#define RSAD_BAD_REQUEST   1 // UNKNOWN OPERATION OR KEY, OR DATA OF THE WRONG SIZE
+#define RSAD_NO_KEY        2 // THE KEY PAIR LACKS THE HALF THIS OPERATION NEEDS
+#define RSAD_BAD_SIGNATURE 3
+
+typedef struct {
+    uint8_t op;
+    uint8_t key;
+    uint32_t len;
+    const uint8_t *data;
+} rsad_op_t;
+
+// A result points into the receive buffer of its connection and stays
+// valid until the next call on that connection.
+typedef struct {
+    uint8_t status;
+    uint32_t len;
+    const uint8_t *data;
+} rsad_result_t;
+
+typedef struct {
+    int fd;
+    uint8_t *in, *out;
+    size_t in_cap, out_cap;
+} rsad_conn_t;
+
+// LATENCY RESERVOIR
+// Keeps the last cap samples in nanoseconds; percentiles are taken over
+// those, count is every sample ever added.
+typedef struct {
+    uint64_t *samples;
+    size_t cap, next;
+    uint64_t count;
+} rsad_lat_t;
+
+const char *rsad_op_name(uint8_t op);
+
+uint64_t rsad_now_ns(void);
+
+bool rsad_send(int fd, const uint8_t *body, size_t len);
+
+bool rsad_recv(int fd, uint8_t **buf, size_t *cap, size_t *len);
+
+bool rsad_open(rsad_conn_t *conn, const char *path);
+
+bool rsad_call(rsad_conn_t *conn, const rsad_op_t *ops, uint32_t count, rsad_result_t *results);
+
+void rsad_close(rsad_conn_t *conn);
+
+void rsad_lat_init(rsad_lat_t *lat, size_t cap);
+
+void rsad_lat_add(rsad_lat_t *lat, uint64_t ns);
+
+void rsad_lat_percentiles(const rsad_lat_t *lat, uint64_t *p50, uint64_t *p99);
+
+void rsad_lat_clear(rsad_lat_t *lat);
@@ -0,0 +1,231 @@
+#include "rsad.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// BIG-ENDIAN FIELD HELPERS
+static void put_be(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i -= 1) {
+        p[i] = v & 0xFF;
+        v >>= 8;
+    }
+}
+
+static uint64_t get_be(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i += 1) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// GROW A BUFFER
+static void reserve(uint8_t **buf, size_t *cap, size_t size) {
+    if (*cap < size) {
+        *buf = (uint8_t *) realloc(*buf, size);
+        *cap = size;
+    }
+}
+
+// OPERATION NAME
+// @param op : One of RSAD_OP_*
+const char *rsad_op_name(uint8_t op) {
+    static const char *names[RSAD_OPS] = { "?", "encrypt", "decrypt", "sign", "verify", "stats" };
+    return op < RSAD_OPS ? names[op] : names[0];
+}
+
+// MONOTONIC CLOCK IN NANOSECONDS
+uint64_t rsad_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// WRITE ALL BYTES
+static bool write_full(int fd, const uint8_t *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// READ EXACTLY len BYTES
+static bool read_full(int fd, uint8_t *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// SEND FRAME
+// @param fd : Connected socket
+// @param body : Frame body
+// @param len : Bytes in body
+bool rsad_send(int fd, const uint8_t *body, size_t len) {
+    uint8_t prefix[4];
+    put_be(prefix, len, 4);
+    return len <= RSAD_MAX_FRAME && write_full(fd, prefix, 4) && write_full(fd, body, len);
+}
+
+// RECEIVE FRAME
+// @param fd : Connected socket
+// @param buf : Buffer grown to hold the body
+// @param cap : Capacity of buf
+// @param len : Receives the body length
+// Fails on end of stream and on frames over RSAD_MAX_FRAME.
+bool rsad_recv(int fd, uint8_t **buf, size_t *cap, size_t *len) {
+    uint8_t prefix[4];
+    if (!read_full(fd, prefix, 4)) {
+        return false;
+    }
+    *len = get_be(prefix, 4);
+    if (*len > RSAD_MAX_FRAME) {
+        return false;
+    }
+    reserve(buf, cap, *len > 0 ? *len : 1);
+    return read_full(fd, *buf, *len);
+}
+
+// CONNECT TO DAEMON
+// @param conn : Receives the connection
+// @param path : Socket path of the daemon
+bool rsad_open(rsad_conn_t *conn, const char *path) {
+    struct sockaddr_un addr;
+    memset(conn, 0, sizeof(rsad_conn_t));
+    conn->fd = -1;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return false;
+    }
+    conn->fd = fd;
+    return true;
+}
+
+// CALL DAEMON
+// @param conn : Open connection
+// @param ops : Operations to run, in order
+// @param count : Number of operations
+// @param results : Receives one result per operation
+// Sends the whole batch as one frame and waits for the one response frame.
+bool rsad_call(rsad_conn_t *conn, const rsad_op_t *ops, uint32_t count, rsad_result_t *results) {
+    size_t len = 4;
+    for (uint32_t i = 0; i < count; i += 1) {
+        len += 6 + ops[i].len;
+    }
+    reserve(&conn->out, &conn->out_cap, len);
+    put_be(conn->out, count, 4);
+    uint8_t *p = conn->out + 4;
+    for (uint32_t i = 0; i < count; i += 1) {
+        p[0] = ops[i].op;
+        p[1] = ops[i].key;
+        put_be(p + 2, ops[i].len, 4);
+        memcpy(p + 6, ops[i].data, ops[i].len);
+        p += 6 + ops[i].len;
+    }
+    if (!rsad_send(conn->fd, conn->out, len)
+        || !rsad_recv(conn->fd, &conn->in, &conn->in_cap, &len) || len < 4
+        || get_be(conn->in, 4) != count) {
+        return false;
+    }
+    size_t at = 4;
+    for (uint32_t i = 0; i < count; i += 1) {
+        if (len - at < 5 || len - at - 5 < get_be(conn->in + at + 1, 4)) {
+            return false;
+        }
+        results[i].status = conn->in[at];
+        results[i].len = get_be(conn->in + at + 1, 4);
+        results[i].data = conn->in + at + 5;
+        at += 5 + results[i].len;
+    }
+    return true;
+}
+
+// CLOSE CONNECTION
+void rsad_close(rsad_conn_t *conn) {
+    if (conn->fd >= 0) {
+        close(conn->fd);
+    }
+    free(conn->in);
+    free(conn->out);
+    conn->fd = -1;
+    conn->in = conn->out = NULL;
+}
+
+// INIT LATENCY RESERVOIR
+// @param lat : Reservoir to set up
+// @param cap : Most recent samples kept
+void rsad_lat_init(rsad_lat_t *lat, size_t cap) {
+    lat->samples = (uint64_t *) malloc(cap * sizeof(uint64_t));
+    lat->cap = cap;
+    lat->next = 0;
+    lat->count = 0;
+}
+
+// ADD LATENCY SAMPLE
+void rsad_lat_add(rsad_lat_t *lat, uint64_t ns) {
+    lat->samples[lat->next] = ns;
+    lat->next = (lat->next + 1) % lat->cap;
+    lat->count += 1;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// LATENCY PERCENTILES
+// @param lat : Reservoir to read
+// @param p50 : Receives the median in nanoseconds, 0 without samples
+// @param p99 : Receives the 99th percentile in nanoseconds
+void rsad_lat_percentiles(const rsad_lat_t *lat, uint64_t *p50, uint64_t *p99) {
+    size_t n = lat->count < lat->cap ? lat->count : lat->cap;
+    *p50 = *p99 = 0;
+    if (n == 0) {
+        return;
+    }
+    uint64_t *sorted = (uint64_t *) malloc(n * sizeof(uint64_t));
+    memcpy(sorted, lat->samples, n * sizeof(uint64_t));
+    qsort(sorted, n, sizeof(uint64_t), cmp_u64);
+    *p50 = sorted[(n - 1) / 2];
+    *p99 = sorted[(n - 1) * 99 / 100];
+    free(sorted);
+}
+
+// CLEAR LATENCY RESERVOIR
+void rsad_lat_clear(rsad_lat_t *lat) {
+    free(lat->samples);
+    lat->samples = NULL;
+}
@@ -0,0 +1,1619 @@
+#include "rsa.h"
+#include "montgomery.h"
+#include "multibuf.h"
+#include "numtheory.h"
+#include "threadpool.h"
+#include "ring.h"
+#include "chacha.h"
+#include "lz.h"
+#include "stats.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#define DEFAULT_BATCH 16 // BLOCKS PER TASK
+#define DEFAULT_DEPTH 4 // BATCHES IN FLIGHT WITHOUT WORKER THREADS
+#define WINDOW_PER_THREAD 4 // BATCHES IN FLIGHT PER WORKER BY DEFAULT
+
+// ONE BATCH OF BLOCKS
+// The reader fills in, a compute step turns it into out, and the writer
+// emits out. Batches reach the writer in the order they were read, whatever
+// order the pool finishes them in, and go back to the reader once written.
+typedef struct slot {
+    const uint8_t *data; // in, or the input mapping
+    uint8_t *in;
+    size_t in_len, in_cap;
+    uint8_t *out;
+    size_t out_len, out_cap;
+    uint64_t blocks;
+    uint64_t seq; // BATCH NUMBER IN READ ORDER
+    bool last; // NOTHING IS READ AFTER THIS BATCH
+    bool done;
+    struct engine *eng;
+} slot_t;
+
+// BLOCK ENGINE
+// read and compute are supplied by the operation. read runs on the reader
+// thread, compute on the pool (or on the calling thread when there is no
+// pool) and the writer thread emits the results.
+typedef struct engine {
+    bool (*read)(void *job, slot_t *slot);
+    void (*compute)(void *job, slot_t *slot);
+    void (*write)(void *job, slot_t *slot); // NULL WRITES out THROUGH engine_emit
+    void *job;
+    FILE *outfile;
+    ring_t *free; // WRITER -> READER, EMPTY SLOTS
+    ring_t *full; // READER -> COMPUTE, READ SLOTS
+    ring_t *ordered; // COMPUTE -> WRITER, SLOTS IN READ ORDER
+    uint64_t nread; // BATCHES READ, OWNED BY THE READER
+    uint64_t skip; // OUTPUT BYTES TO DROP BEFORE WRITING
+    uint64_t left; // OUTPUT BYTES STILL TO WRITE AFTER THAT
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+} engine_t;
+
+// GROW A SLOT BUFFER
+static void reserve(uint8_t **buf, size_t *cap, size_t size) {
+    if (*cap < size) {
+        *buf = (uint8_t *) realloc(*buf, size);
+        *cap = size;
+    }
+}
+
+// EMIT ENGINE OUTPUT
+// @param eng : Engine whose output window applies
+// @param p : Next output bytes in order
+// @param n : Number of bytes at p
+// Drops the first skip bytes of the output and stops after left more, which
+// trims a range decryption to exactly the bytes asked for. Nothing more is
+// written once a write failed; output_ok reports it at the end.
+static void engine_emit(engine_t *eng, const uint8_t *p, size_t n) {
+    size_t drop = eng->skip < n ? eng->skip : n;
+    eng->skip -= drop;
+    p += drop;
+    n -= drop;
+    n = eng->left < n ? eng->left : n;
+    eng->left -= n;
+    if (!ferror(eng->outfile)) {
+        fwrite(p, sizeof(uint8_t), n, eng->outfile);
+    }
+}
+
+static void compute_task(void *arg) {
+    slot_t *slot = (slot_t *) arg;
+    engine_t *eng = slot->eng;
+    STAT_START(t0);
+    eng->compute(eng->job, slot);
+    STAT_STOP(STAT_COMPUTE_NS, t0);
+    STAT_ADD(STAT_BATCHES, 1);
+    STAT_ADD(STAT_BLOCKS, slot->blocks);
+    pthread_mutex_lock(&eng->lock);
+    slot->done = true;
+    pthread_cond_broadcast(&eng->done);
+    pthread_mutex_unlock(&eng->lock);
+}
+
+// READ ONE BATCH
+// @param eng : Engine
+// Takes a free slot and fills it, NULL once read reports end of input.
+static slot_t *read_slot(engine_t *eng) {
+    slot_t *slot = (slot_t *) ring_get(eng->free);
+    slot->done = false;
+    slot->seq = eng->nread;
+    STAT_START(t0);
+    bool more = eng->read(eng->job, slot);
+    STAT_STOP(STAT_READ_NS, t0);
+    if (!more) {
+        ring_put(eng->free, slot);
+        return NULL;
+    }
+    eng->nread += 1;
+    return slot;
+}
+
+// WRITE ONE BATCH
+// @param eng : Engine
+// @param slot : Computed slot, handed back to the reader afterwards
+static void write_slot(engine_t *eng, slot_t *slot) {
+    STAT_START(t0);
+    if (eng->write != NULL) {
+        eng->write(eng->job, slot);
+    } else {
+        engine_emit(eng, slot->out, slot->out_len);
+    }
+    STAT_STOP(STAT_WRITE_NS, t0);
+    ring_put(eng->free, slot);
+}
+
+// READER STAGE
+// Fills free slots until read reports end of input, then passes NULL on.
+static void *reader_stage(void *arg) {
+    engine_t *eng = (engine_t *) arg;
+    slot_t *slot;
+    while ((slot = read_slot(eng)) != NULL) {
+        ring_put(eng->full, slot);
+    }
+    ring_put(eng->full, NULL);
+    return NULL;
+}
+
+// WRITER STAGE
+// Writes slots in read order as soon as each one is computed and hands the
+// slot back to the reader.
+static void *writer_stage(void *arg) {
+    engine_t *eng = (engine_t *) arg;
+    slot_t *slot;
+    while ((slot = (slot_t *) ring_get(eng->ordered)) != NULL) {
+        pthread_mutex_lock(&eng->lock);
+        while (!slot->done) {
+            pthread_cond_wait(&eng->done, &eng->lock);
+        }
+        pthread_mutex_unlock(&eng->lock);
+        write_slot(eng, slot);
+    }
+    return NULL;
+}
+
+// RUN BLOCK ENGINE
+// @param eng : Engine with the operation callbacks
+// @param opts : Thread, batch and depth settings
+// Runs a reader, the compute stage and a writer connected by lock-free
+// rings, so reading, exponentiation and writing overlap even with a single
+// compute thread. window slots circulate between the stages, which bounds
+// memory and lets a stalled input or output drain from the buffered batches.
+// When the system refuses the reader or writer thread, this thread takes
+// over that stage and works through the batches one at a time.
+static void engine_run(engine_t *eng, const rsa_file_opts_t *opts) {
+    uint64_t window = DEFAULT_DEPTH;
+    pool_t *pool = NULL;
+    if (opts->threads > 0) {
+        window = WINDOW_PER_THREAD * opts->threads;
+        pool = pool_create(opts->threads);
+    }
+    window = opts->window > 0 ? opts->window : window;
+    slot_t *slots = (slot_t *) calloc(window, sizeof(slot_t));
+    pthread_mutex_init(&eng->lock, NULL);
+    pthread_cond_init(&eng->done, NULL);
+    // ROOM FOR EVERY SLOT PLUS THE END MARKER, SO NO PUT EVER WAITS FOR LONG
+    eng->free = ring_create(window + 1);
+    eng->full = ring_create(window + 1);
+    eng->ordered = ring_create(window + 1);
+    eng->nread = 0;
+    for (uint64_t i = 0; i < window; i += 1) {
+        slots[i].eng = eng;
+        ring_put(eng->free, &slots[i]);
+    }
+
+    pthread_t reader, writer;
+    bool writing = pthread_create(&writer, NULL, writer_stage, eng) == 0;
+    bool reading = writing && pthread_create(&reader, NULL, reader_stage, eng) == 0;
+    slot_t *slot;
+    while ((slot = reading ? (slot_t *) ring_get(eng->full) : read_slot(eng)) != NULL) {
+        if (pool != NULL && writing) {
+            pool_submit(pool, compute_task, slot);
+        } else {
+            compute_task(slot);
+        }
+        if (writing) {
+            ring_put(eng->ordered, slot);
+        } else {
+            write_slot(eng, slot);
+        }
+    }
+    if (writing) {
+        ring_put(eng->ordered, NULL);
+        pthread_join(writer, NULL);
+    }
+    if (reading) {
+        pthread_join(reader, NULL);
+    }
+
+    if (pool != NULL) {
+        pool_destroy(pool);
+    }
+    for (uint64_t i = 0; i < window; i += 1) {
+        free(slots[i].in);
+        free(slots[i].out);
+    }
+    free(slots);
+    ring_destroy(eng->free);
+    ring_destroy(eng->full);
+    ring_destroy(eng->ordered);
+    pthread_mutex_destroy(&eng->lock);
+    pthread_cond_destroy(&eng->done);
+}
+
+// FILE MAPPING
+// Regular files are mapped whole; base is NULL when the stream cannot be
+// mapped (pipes, terminals, empty files) and stdio is used instead.
+typedef struct {
+    uint8_t *base;
+    size_t size;
+} map_t;
+
+// MAP INPUT FILE
+// @param m : Receives the read-only mapping
+// @param infile : Input stream
+// @param pos : Receives the stream position
+// Reading from the mapping starts at pos, so anything the caller already
+// consumed through stdio is skipped. Nothing is mapped when nothing is left.
+static bool map_input(map_t *m, FILE *infile, size_t *pos) {
+    struct stat st;
+    m->base = NULL;
+    int fd = fileno(infile);
+    long at = ftell(infile);
+    if (fd < 0 || at < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || at >= st.st_size) {
+        return false;
+    }
+    *pos = at;
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+    m->base = (uint8_t *) base;
+    m->size = st.st_size;
+    return true;
+}
+
+// MAP OUTPUT FILE
+// @param m : Receives the writable mapping
+// @param outfile : Output stream
+// @param size : Final file size, preallocated with posix_fallocate
+static bool map_output(map_t *m, FILE *outfile, size_t size) {
+    struct stat st;
+    m->base = NULL;
+    int fd = fileno(outfile);
+    // A SHARED WRITABLE MAPPING NEEDS THE FILE OPEN FOR READING TOO, AND AN
+    // APPENDING STREAM DOES NOT WRITE WHERE ftell SAYS IT DOES
+    if (size == 0 || fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+        || (fcntl(fd, F_GETFL) & (O_ACCMODE | O_APPEND)) != O_RDWR) {
+        return false;
+    }
+    fflush(outfile);
+    // ALLOCATE THE BLOCKS UP FRONT, A FULL DISK WOULD OTHERWISE RAISE SIGBUS
+    // ON A STORE INTO THE MAPPING INSTEAD OF FAILING A WRITE
+    void *base = MAP_FAILED;
+    if (posix_fallocate(fd, 0, size) == 0) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (base == MAP_FAILED) {
+        if (ftruncate(fd, st.st_size) != 0) {
+            fprintf(stderr, "Could not truncate the output file.\n");
+        }
+        return false;
+    }
+    m->base = (uint8_t *) base;
+    m->size = size;
+    return true;
+}
+
+// CHECK OUTPUT
+// @param outfile : Output stream every write of the operation went to
+// Flushes outfile and returns false, with a message, when any write to it
+// failed, a full disk for instance.
+static bool output_ok(FILE *outfile) {
+    if (fflush(outfile) != 0 || ferror(outfile)) {
+        fprintf(stderr, "Could not write the output.\n");
+        return false;
+    }
+    return true;
+}
+
+// UNMAP OUTPUT FILE
+// @param m : Output mapping
+// @param outfile : Output stream, left positioned at its new end
+// @param size : Bytes actually produced, the file is cut back to it
+static void unmap_output(map_t *m, FILE *outfile, size_t size) {
+    munmap(m->base, m->size);
+    if (size != m->size && ftruncate(fileno(outfile), size) != 0) {
+        fprintf(stderr, "Could not truncate the output file.\n");
+    }
+    fseek(outfile, size, SEEK_SET);
+}
+
+// BLOCK SIZE
+// @param n : Mod n
+// k = floor((log2(n)-1)/8), each block carries k-1 bytes after the 0xFF pad.
+static uint64_t block_size(mpz_t n) {
+    return (mpz_sizeinbase(n, 2) - 1) / 8;
+}
+
+// BIG-ENDIAN FIELD HELPERS
+static void put_be(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i -= 1) {
+        p[i] = v & 0xFF;
+        v >>= 8;
+    }
+}
+
+static uint64_t get_be(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i += 1) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// BINARY CONTAINER HEADER
+// @param header : Receives the header bytes
+// @param modbytes : Bytes in n
+// @param k : Block size, or the chunk size in hybrid mode
+// @param length : Plaintext length, UINT64_MAX when not known yet
+// @param flags : Container flags
+static void make_header(
+    uint8_t header[RSA_BIN_HEADER], uint64_t modbytes, uint64_t k, uint64_t length, uint8_t flags) {
+    memset(header, 0, RSA_BIN_HEADER);
+    memcpy(header, RSA_BIN_MAGIC, 4);
+    header[4] = RSA_BIN_VERSION;
+    header[5] = flags;
+    put_be(header + 8, modbytes, 4);
+    put_be(header + 12, k, 4);
+    put_be(header + 16, length, 8);
+}
+
+// WRITE BINARY CONTAINER HEADER
+// @param outfile : Output file, positioned at its start
+static void write_header(
+    FILE *outfile, uint64_t modbytes, uint64_t k, uint64_t length, uint8_t flags) {
+    uint8_t header[RSA_BIN_HEADER];
+    make_header(header, modbytes, k, length, flags);
+    fwrite(header, sizeof(uint8_t), RSA_BIN_HEADER, outfile);
+}
+
+// DEFAULT FILE OPTIONS
+// @param opts : Options to reset, single threaded
+void rsa_file_opts_init(rsa_file_opts_t *opts) {
+    opts->threads = 0;
+    opts->batch = DEFAULT_BATCH;
+    opts->window = 0;
+    opts->binary = false;
+    opts->hybrid = false;
+    opts->compress = false;
+    opts->index = false;
+    return;
+}
+
+// PATCH CONTAINER LENGTH
+// @param outfile : Output file
+// @param start : Offset of the header, negative when outfile cannot seek
+// @param total : Plaintext length
+static void patch_length(FILE *outfile, long start, uint64_t total) {
+    if (start >= 0 && fseek(outfile, start + 16, SEEK_SET) == 0) {
+        uint8_t length[8];
+        put_be(length, total, 8);
+        fwrite(length, sizeof(uint8_t), 8, outfile);
+        fseek(outfile, 0, SEEK_END);
+    }
+}
+
+// EXPORT FIXED WIDTH BLOCK
+// @param block : Receives width bytes, big-endian and zero padded
+// @param c : Value below 256^width
+static void export_fixed(uint8_t *block, mpz_t c, size_t width) {
+    size_t count = mpz_sgn(c) == 0 ? 0 : mpz_sizeinbase(c, 256);
+    memset(block, 0, width - count);
+    mpz_export(block + width - count, NULL, 1, sizeof(uint8_t), 1, 0, c);
+}
+
+#define HYBRID_CHUNK     65536 // PAYLOAD BYTES PER SEALED CHUNK
+#define HYBRID_MAX_CHUNK (1 << 24)
+#define SESSION_PREFIX   7 // NONCE BYTES FIXED PER FILE
+#define SESSION_BYTES    (CHACHA_KEY + SESSION_PREFIX)
+
+// HYBRID JOB
+// Seals or opens chunks. stride is the chunk size on the way in and the
+// chunk plus its tag on the way back.
+typedef struct {
+    FILE *infile;
+    map_t in; // base IS NULL WHEN READING THROUGH stdio
+    size_t pos; // NEXT UNREAD BYTE OF THE INPUT MAPPING
+    uint64_t batch;
+    size_t chunk, stride;
+    bool seal;
+    bool finished; // THE READER HIT THE END OF THE INPUT
+    bool tail; // THE END OF THE INPUT IS THE END OF THE CONTAINER
+    uint64_t first; // CHUNK NUMBER OF THE FIRST CHUNK READ
+    uint64_t total; // BYTES READ
+    uint8_t key[CHACHA_KEY];
+    uint8_t prefix[SESSION_PREFIX];
+    uint8_t aad[16];
+    _Atomic bool bad; // A CHUNK FAILED AUTHENTICATION
+    _Atomic bool ended; // THE LAST CHUNK WAS AUTHENTICATED
+} hyb_job_t;
+
+// RANDOM BYTES FROM THE KERNEL
+static bool random_bytes(uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t got = getrandom(buf, len, 0);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += got;
+        len -= got;
+    }
+    return true;
+}
+
+static bool hyb_read(void *arg, slot_t *slot) {
+    hyb_job_t *job = (hyb_job_t *) arg;
+    if (job->finished) {
+        return false;
+    }
+    size_t want = job->batch * job->stride;
+    if (job->in.base != NULL) {
+        slot->in_len = job->in.size - job->pos < want ? job->in.size - job->pos : want;
+        slot->data = job->in.base + job->pos;
+        job->pos += slot->in_len;
+        job->finished = job->pos == job->in.size;
+    } else {
+        reserve(&slot->in, &slot->in_cap, want);
+        slot->in_len = fread(slot->in, sizeof(uint8_t), want, job->infile);
+        slot->data = slot->in;
+        // LOOK ONE BYTE AHEAD SO THE LAST CHUNK IS KNOWN WHEN IT IS READ
+        int next = slot->in_len < want ? EOF : fgetc(job->infile);
+        if (next == EOF) {
+            job->finished = true;
+        } else {
+            ungetc(next, job->infile);
+        }
+    }
+    slot->last = job->finished && job->tail;
+    slot->blocks = (slot->in_len + job->stride - 1) / job->stride;
+    if (job->seal && slot->blocks == 0 && slot->last) {
+        slot->blocks = 1; // AN EMPTY INPUT STILL ENDS WITH A SEALED LAST CHUNK
+    }
+    job->total += slot->in_len;
+    return slot->blocks > 0;
+}
+
+static void hyb_compute(void *arg, slot_t *slot) {
+    hyb_job_t *job = (hyb_job_t *) arg;
+    reserve(&slot->out, &slot->out_cap, slot->blocks * (job->chunk + POLY1305_TAG));
+    slot->out_len = 0;
+    uint8_t nonce[CHACHA_NONCE];
+    memcpy(nonce, job->prefix, SESSION_PREFIX);
+    for (uint64_t b = 0; b < slot->blocks; b += 1) {
+        size_t off = b * job->stride;
+        size_t len = slot->in_len - off < job->stride ? slot->in_len - off : job->stride;
+        bool last = slot->last && b + 1 == slot->blocks;
+        put_be(nonce + SESSION_PREFIX, job->first + slot->seq * job->batch + b, 4);
+        nonce[CHACHA_NONCE - 1] = last;
+        uint8_t *out = slot->out + slot->out_len;
+        if (job->seal) {
+            aead_seal(out, out + len, slot->data + off, len, job->aad, 16, job->key, nonce);
+            slot->out_len += len + POLY1305_TAG;
+            continue;
+        }
+        bool ok = len >= POLY1305_TAG
+            && aead_open(out, slot->data + off, len - POLY1305_TAG,
+                slot->data + off + len - POLY1305_TAG, job->aad, 16, job->key, nonce);
+        if (!ok && last) {
+            // A STREAM CUT AT A CHUNK BOUNDARY ENDS ON A CHUNK SEALED AS NOT LAST
+            nonce[CHACHA_NONCE - 1] = 0;
+            ok = aead_open(out, slot->data + off, len - POLY1305_TAG,
+                slot->data + off + len - POLY1305_TAG, job->aad, 16, job->key, nonce);
+            last = false;
+        }
+        if (!ok) {
+            job->bad = true;
+            return;
+        }
+        slot->out_len += len - POLY1305_TAG;
+        job->ended = job->ended || last;
+    }
+}
+
+// HYBRID ENCRYPT FILE
+// @param infile : Input file to read data from
+// @param outfile : Output file to write the hybrid container to
+// @param n : Mod n
+// @param e : Public exponent e
+// @param opts : Threading options
+// Wraps a fresh session key with rsa_encrypt once and streams the payload
+// through ChaCha20-Poly1305. Returns false, with nothing written, when n is
+// too small to wrap the session key or no session key could be drawn.
+static bool encrypt_hybrid(
+    FILE *infile, FILE *outfile, mpz_t n, mpz_t e, const rsa_file_opts_t *opts) {
+    uint64_t k = block_size(n);
+    size_t modbytes = mpz_sizeinbase(n, 256);
+    if (mpz_sizeinbase(n, 2) < RSA_HYBRID_MIN_BITS) {
+        fprintf(stderr, "Modulus is too small to wrap a session key, hybrid mode needs %d bits.\n",
+            RSA_HYBRID_MIN_BITS);
+        return false;
+    }
+    // 0xFF AND k-1 RANDOM BYTES FILL THE BLOCK, SO e = 3 LEAVES NO SMALL ROOT
+    uint8_t *session = (uint8_t *) malloc(modbytes);
+    session[0] = 0xFF;
+    if (!random_bytes(session + 1, k - 1)) {
+        fprintf(stderr, "Could not draw a session key.\n");
+        free(session);
+        return false;
+    }
+    hyb_job_t job;
+    job.infile = infile;
+    job.batch = opts->batch > 0 ? opts->batch : DEFAULT_BATCH;
+    job.chunk = job.stride = HYBRID_CHUNK;
+    job.seal = true;
+    job.finished = false;
+    job.tail = true;
+    job.first = 0;
+    job.total = 0;
+    memcpy(job.key, session + 1, CHACHA_KEY);
+    memcpy(job.prefix, session + 1 + CHACHA_KEY, SESSION_PREFIX);
+    job.bad = false;
+    job.ended = false;
+
+    mpz_t m, c;
+    mpz_inits(m, c, NULL);
+    mpz_import(m, k, 1, sizeof(uint8_t), 1, 0, session);
+    rsa_encrypt(c, m, e, n);
+    export_fixed(session, c, modbytes);
+
+    uint8_t header[RSA_BIN_HEADER];
+    make_header(header, modbytes, HYBRID_CHUNK, UINT64_MAX, RSA_BIN_HYBRID);
+    memcpy(job.aad, header, 16);
+    long start = ftell(outfile);
+    fwrite(header, sizeof(uint8_t), RSA_BIN_HEADER, outfile);
+    fwrite(session, sizeof(uint8_t), modbytes, outfile);
+    map_input(&job.in, infile, &job.pos);
+
+    engine_t eng;
+    eng.read = hyb_read;
+    eng.compute = hyb_compute;
+    eng.write = NULL;
+    eng.job = &job;
+    eng.outfile = outfile;
+    eng.skip = 0;
+    eng.left = UINT64_MAX;
+    engine_run(&eng, opts);
+    patch_length(outfile, start, job.total);
+
+    if (job.in.base != NULL) {
+        munmap(job.in.base, job.in.size);
+    }
+    mpz_clears(m, c, NULL);
+    free(session);
+    return output_ok(outfile);
+}
+
+// UNWRAP SESSION KEY
+// @param job : Receives the ChaCha20-Poly1305 key and the nonce prefix
+// @param block : Wrapped session block, as wide as n
+// @param key : Private key
+// Returns false when the block does not decrypt to 0xFF and k-1 bytes.
+static bool unwrap_session(hyb_job_t *job, const uint8_t *block, rsa_priv_t *key) {
+    uint64_t k = block_size(key->n);
+    size_t modbytes = mpz_sizeinbase(key->n, 256);
+    uint8_t *session = (uint8_t *) malloc(modbytes);
+    mpz_t m, c;
+    mpz_inits(m, c, NULL);
+    mpz_import(c, modbytes, 1, sizeof(uint8_t), 1, 0, block);
+    if (key->crt) {
+        rsa_decrypt_crt(m, c, key);
+    } else {
+        rsa_decrypt(m, c, key->d, key->n);
+    }
+    bool ok = mpz_sizeinbase(m, 256) == k;
+    if (ok) {
+        export_fixed(session, m, k);
+        ok = session[0] == 0xFF;
+    }
+    if (ok) {
+        memcpy(job->key, session + 1, CHACHA_KEY);
+        memcpy(job->prefix, session + 1 + CHACHA_KEY, SESSION_PREFIX);
+    }
+    mpz_clears(m, c, NULL);
+    free(session);
+    return ok;
+}
+
+// PREPARE HYBRID OPENING
+// @param job : Job with the session key already unwrapped
+// @param infile : Input file, NULL when reading from a mapping only
+// @param header : Container header
+// @param opts : Threading options
+static void hyb_open_init(hyb_job_t *job, FILE *infile, const uint8_t header[RSA_BIN_HEADER],
+    const rsa_file_opts_t *opts) {
+    job->infile = infile;
+    job->batch = opts->batch > 0 ? opts->batch : DEFAULT_BATCH;
+    job->chunk = get_be(header + 12, 4);
+    job->stride = job->chunk + POLY1305_TAG;
+    job->seal = false;
+    job->finished = false;
+    job->tail = true;
+    job->first = 0;
+    job->total = 0;
+    memcpy(job->aad, header, 16);
+    job->bad = false;
+    job->ended = false;
+    job->in.base = NULL;
+}
+
+// HYBRID DECRYPT FILE
+// @param infile : Input file, positioned after the container header
+// @param outfile : Output file to write the plaintext to
+// @param key : Private key
+// @param header : Container header
+// @param opts : Threading options
+// Unwraps the session key with the private key and opens every chunk.
+// Chunks are only written once their tag checks out. Returns false when the
+// key does not fit, a chunk fails authentication or the chunks stop short.
+static bool decrypt_hybrid(FILE *infile, FILE *outfile, rsa_priv_t *key,
+    const uint8_t header[RSA_BIN_HEADER], const rsa_file_opts_t *opts) {
+    uint64_t k = block_size(key->n);
+    size_t modbytes = mpz_sizeinbase(key->n, 256);
+    size_t chunk = get_be(header + 12, 4);
+    if (chunk == 0 || chunk > HYBRID_MAX_CHUNK || k - 1 < SESSION_BYTES) {
+        fprintf(stderr, "Ciphertext container does not match this key.\n");
+        return false;
+    }
+    uint8_t *session = (uint8_t *) malloc(modbytes);
+    hyb_job_t job;
+    bool ok = fread(session, sizeof(uint8_t), modbytes, infile) == modbytes
+        && unwrap_session(&job, session, key);
+    free(session);
+    if (!ok) {
+        fprintf(stderr, "Session key does not unwrap with this key.\n");
+        return false;
+    }
+
+    hyb_open_init(&job, infile, header, opts);
+    map_input(&job.in, infile, &job.pos);
+
+    engine_t eng;
+    eng.read = hyb_read;
+    eng.compute = hyb_compute;
+    eng.write = NULL;
+    eng.job = &job;
+    eng.outfile = outfile;
+    eng.skip = 0;
+    eng.left = UINT64_MAX;
+    engine_run(&eng, opts);
+
+    if (job.bad) {
+        fprintf(stderr, "Ciphertext failed authentication.\n");
+    } else if (!job.ended) {
+        fprintf(stderr, "Ciphertext is truncated.\n");
+    }
+    if (job.in.base != NULL) {
+        munmap(job.in.base, job.in.size);
+    }
+    return output_ok(outfile) && !job.bad && job.ended;
+}
+
+typedef struct {
+    FILE *infile;
+    map_t in; // base IS NULL WHEN READING THROUGH stdio
+    size_t pos; // NEXT UNREAD BYTE OF THE INPUT MAPPING
+    uint8_t *out; // FIRST BLOCK IN THE OUTPUT MAPPING, NULL FOR stdio
+    uint64_t k, batch;
+    size_t hexlen; // HEX DIGITS OF N
+    size_t modbytes; // BYTES OF N
+    bool binary;
+    bool compress; // EACH BATCH IS ONE LZ FRAME
+    bool index; // RECORD EVERY BATCH IN A TRAILING INDEX
+    uint64_t *entries; // PLAINTEXT AND CONTAINER OFFSET OF EACH BATCH
+    size_t count, entries_cap;
+    uint64_t indexed, written; // PLAINTEXT BYTES AND BLOCKS SEEN BY THE WRITER
+    uint64_t total; // PLAINTEXT BYTES READ
+    mpz_ptr e;
+    bool small;
+    mont_ctx_t ctx;
+    mb_ctx_t mb;
+    bool wide; // mb HOLDS A CONTEXT, BLOCKS GO THROUGH mb_pow IN GROUPS
+} enc_job_t;
+
+static bool enc_read(void *arg, slot_t *slot) {
+    enc_job_t *job = (enc_job_t *) arg;
+    size_t want = job->compress ? LZ_FRAME : job->batch * (job->k - 1);
+    if (job->in.base != NULL) {
+        slot->in_len = job->in.size - job->pos < want ? job->in.size - job->pos : want;
+        slot->data = job->in.base + job->pos;
+        job->pos += slot->in_len;
+    } else {
+        reserve(&slot->in, &slot->in_cap, want);
+        slot->in_len = fread(slot->in, sizeof(uint8_t), want, job->infile);
+        slot->data = slot->in;
+    }
+    slot->blocks = (slot->in_len + job->k - 2) / (job->k - 1);
+    job->total += slot->in_len;
+    return slot->in_len > 0;
+}
+
+static void enc_compute(void *arg, slot_t *slot) {
+    enc_job_t *job = (enc_job_t *) arg;
+    const uint8_t *src = slot->data;
+    size_t len = slot->in_len;
+    uint8_t *frame = NULL;
+    if (job->compress) {
+        // FRAME: RAW LENGTH, STORED LENGTH, PAYLOAD; STORED RAW WHEN IT DOES NOT SHRINK
+        frame = (uint8_t *) malloc(8 + LZ_BOUND(len));
+        size_t stored = lz_compress(frame + 8, src, len);
+        if (stored >= len) {
+            memcpy(frame + 8, src, len);
+            stored = len;
+        }
+        put_be(frame, len, 4);
+        put_be(frame + 4, stored, 4);
+        src = frame;
+        len = 8 + stored;
+        slot->blocks = (len + job->k - 2) / (job->k - 1);
+    }
+    // THE THREAD'S WORKSPACE HOLDS THE BLOCK NUMBERS AND THE POWER SCRATCH
+    nt_ws_t *ws = nt_ws_local();
+    nt_ws_reserve(ws, 8 * job->modbytes);
+    mpz_ptr c = ws->t[1], pad = ws->t[2];
+    uint8_t *out = slot->out;
+    if (job->out != NULL) {
+        out = job->out + slot->seq * job->batch * job->modbytes;
+    } else if (job->binary) {
+        reserve(&slot->out, &slot->out_cap, slot->blocks * job->modbytes);
+        out = slot->out;
+    } else {
+        reserve(&slot->out, &slot->out_cap, slot->blocks * (job->hexlen + 1) + 1);
+        out = slot->out;
+    }
+    slot->out_len = 0;
+    for (uint64_t g = 0; g < slot->blocks; g += MB_LANES) {
+        uint64_t lanes = slot->blocks - g < MB_LANES ? slot->blocks - g : MB_LANES;
+        bool wide = job->wide && lanes >= MB_LANES / 2; // A SHORT TAIL IS CHEAPER ONE BY ONE
+        for (uint64_t l = 0; l < lanes; l += 1) {
+            size_t off = (g + l) * (job->k - 1);
+            size_t j = len - off < job->k - 1 ? len - off : job->k - 1;
+            // IMPORT STRAIGHT FROM THE INPUT AND PUT THE 0xFF PAD ABOVE IT
+            mpz_ptr m = ws->lane[l];
+            mpz_import(m, j, 1, sizeof(uint8_t), 1, 0, src + off);
+            mpz_set_ui(pad, 0xFF);
+            mpz_mul_2exp(pad, pad, 8 * j);
+            mpz_ior(m, m, pad);
+            if (wide) {
+                continue;
+            }
+            // rsa_encrypt on the shared context
+            if (job->small) {
+                mont_pow_ui_tp(c, m, mpz_get_ui(job->e), &job->ctx, ws->limbs);
+            } else {
+                mont_pow_tp(c, m, job->e, &job->ctx, ws->limbs);
+            }
+            mpz_swap(m, c);
+        }
+        if (wide) {
+            mb_pow(ws->lane, ws->lane, lanes, job->e, &job->mb);
+        }
+        for (uint64_t l = 0; l < lanes; l += 1) {
+            if (job->binary) {
+                // output as a fixed width big-endian block
+                export_fixed(out + slot->out_len, ws->lane[l], job->modbytes);
+                slot->out_len += job->modbytes;
+                continue;
+            }
+            // output as hexstring w/ newline
+            mpz_get_str((char *) out + slot->out_len, 16, ws->lane[l]);
+            slot->out_len += strlen((char *) out + slot->out_len);
+            out[slot->out_len] = '\n';
+            slot->out_len += 1;
+        }
+    }
+    if (job->out != NULL) {
+        slot->out_len = 0; // ALREADY IN PLACE, NOTHING LEFT FOR THE WRITER
+    }
+    free(frame);
+}
+
+// WRITE AND INDEX
+// Runs on the writer thread. Records where each batch starts in the
+// plaintext and in the container, then writes it out.
+static void index_write(void *arg, slot_t *slot) {
+    enc_job_t *job = (enc_job_t *) arg;
+    if (job->count == job->entries_cap) {
+        job->entries_cap = job->entries_cap == 0 ? 256 : 2 * job->entries_cap;
+        job->entries = (uint64_t *) realloc(job->entries, 2 * job->entries_cap * sizeof(uint64_t));
+    }
+    job->entries[2 * job->count] = job->indexed;
+    job->entries[2 * job->count + 1] = RSA_BIN_HEADER + job->written * job->modbytes;
+    job->count += 1;
+    job->indexed += slot->in_len;
+    job->written += slot->blocks;
+    engine_emit(slot->eng, slot->out, slot->out_len);
+}
+
+// WRITE CONTAINER INDEX
+// @param outfile : Output file, positioned after the last block
+// @param job : Job with the recorded entries
+// Writes the end block, the entries and the footer.
+static void write_index(FILE *outfile, enc_job_t *job) {
+    uint8_t *end = (uint8_t *) malloc(job->modbytes);
+    memset(end, 0xFF, job->modbytes);
+    fwrite(end, sizeof(uint8_t), job->modbytes, outfile);
+    free(end);
+    uint8_t field[RSA_BIN_ENTRY];
+    for (size_t i = 0; i < job->count; i += 1) {
+        put_be(field, job->entries[2 * i], 8);
+        put_be(field + 8, job->entries[2 * i + 1], 8);
+        fwrite(field, sizeof(uint8_t), RSA_BIN_ENTRY, outfile);
+    }
+    uint8_t footer[RSA_BIN_FOOTER];
+    put_be(footer, job->count, 8);
+    put_be(footer + 8, job->total, 8);
+    memcpy(footer + 16, RSA_BIN_INDEX_MAGIC, 8);
+    fwrite(footer, sizeof(uint8_t), RSA_BIN_FOOTER, outfile);
+}
+
+// RSA ENCRYPT FILE
+// @param infile : Input file to read data from
+// @param outfile : Output file to write ciphertexts to
+// @param n : Mod n
+// @param e : Public exponent e
+// Reads all bytes from a parameterized infile and runs rsa_encrypt for
+// each block of data k. Then writes all blocks to parameterized outfile.
+// Written outputs are formatted as hexstrings on trailing newlines.
+// Returns false like rsa_encrypt_file_opts.
+bool rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
+    rsa_file_opts_t opts;
+    rsa_file_opts_init(&opts);
+    return rsa_encrypt_file_opts(infile, outfile, n, e, &opts);
+}
+
+// RSA ENCRYPT FILE WITH OPTIONS
+// @param infile : Input file to read data from
+// @param outfile : Output file to write ciphertexts to
+// @param n : Mod n
+// @param e : Public exponent e
+// @param opts : Threading options
+// Same output as rsa_encrypt_file unless opts selects the binary container.
+// With threads the blocks are encrypted in parallel and written back in
+// their original order. The container header records the plaintext length
+// when outfile is seekable, otherwise the length field stays all ones.
+// A regular infile is read through a mapping, and a container written to a
+// regular outfile goes straight into a mapping sized from the block count.
+// With index the container ends in an index of its batches, see rsa.h.
+// Returns false when no ciphertext could be written or a write failed.
+bool rsa_encrypt_file_opts(
+    FILE *infile, FILE *outfile, mpz_t n, mpz_t e, const rsa_file_opts_t *opts) {
+    if (opts->hybrid) {
+        return encrypt_hybrid(infile, outfile, n, e, opts);
+    }
+    enc_job_t job;
+    job.infile = infile;
+    job.k = block_size(n);
+    job.batch = opts->batch > 0 ? opts->batch : DEFAULT_BATCH;
+    job.hexlen = mpz_sizeinbase(n, 16);
+    job.modbytes = mpz_sizeinbase(n, 256);
+    job.binary = opts->binary || opts->compress || opts->index;
+    job.compress = opts->compress;
+    job.index = opts->index;
+    job.entries = NULL;
+    job.count = job.entries_cap = 0;
+    job.indexed = job.written = 0;
+    job.total = 0;
+    job.e = e;
+    job.small = mpz_fits_ulong_p(e);
+    job.out = NULL;
+    job.in.base = NULL;
+    mont_init(&job.ctx, n); // ONE MONTGOMERY CONTEXT FOR EVERY BLOCK
+    job.wide = mb_init(&job.mb, n);
+
+    map_input(&job.in, infile, &job.pos);
+
+    map_t outmap = { NULL, 0 };
+    long start = job.binary ? ftell(outfile) : -1;
+    if (job.binary && !job.compress && job.in.base != NULL && start >= 0) {
+        uint64_t length = job.in.size - job.pos;
+        uint64_t blocks = (length + job.k - 2) / (job.k - 1);
+        if (map_output(&outmap, outfile, start + RSA_BIN_HEADER + blocks * job.modbytes)) {
+            job.out = outmap.base + start + RSA_BIN_HEADER;
+        }
+    }
+
+    engine_t eng;
+    eng.read = enc_read;
+    eng.compute = enc_compute;
+    eng.write = job.index ? index_write : NULL;
+    eng.job = &job;
+    eng.outfile = outfile;
+    eng.skip = 0;
+    eng.left = UINT64_MAX;
+    uint8_t flags = (job.compress ? RSA_BIN_COMPRESSED : 0) | (job.index ? RSA_BIN_INDEXED : 0);
+    if (job.binary && job.out == NULL) {
+        write_header(outfile, job.modbytes, job.k, UINT64_MAX, flags);
+    }
+    engine_run(&eng, opts);
+    if (job.out != NULL) {
+        // THE LENGTH IS KNOWN BY NOW, WRITE THE HEADER IN PLACE
+        uint64_t blocks = (job.total + job.k - 2) / (job.k - 1);
+        make_header(outmap.base + start, job.modbytes, job.k, job.total, flags);
+        unmap_output(&outmap, outfile, start + RSA_BIN_HEADER + blocks * job.modbytes);
+    }
+    if (job.index) {
+        write_index(outfile, &job);
+    }
+    if (job.binary && job.out == NULL) {
+        patch_length(outfile, start, job.total); // WHEN THE OUTPUT CAN SEEK
+    }
+    free(job.entries);
+    if (job.in.base != NULL) {
+        munmap(job.in.base, job.in.size);
+    }
+    mont_clear(&job.ctx);
+    if (job.wide) {
+        mb_clear(&job.mb);
+    }
+    return output_ok(outfile);
+}
+
+typedef struct {
+    FILE *infile;
+    map_t in; // base IS NULL WHEN READING THROUGH stdio
+    size_t pos; // NEXT UNREAD BYTE OF THE INPUT MAPPING
+    uint8_t *out; // START OF THE PLAINTEXT IN THE OUTPUT MAPPING, NULL FOR stdio
+    uint64_t k, batch;
+    size_t modbytes; // WIDTH OF A BINARY CIPHERTEXT BLOCK
+    bool binary;
+    uint64_t length; // PLAINTEXT LENGTH FROM THE CONTAINER HEADER
+    uint64_t blocks; // BLOCKS READ
+    bool compressed;
+    bool indexed; // THE BLOCKS END AT AN ALL ONES BLOCK
+    bool finished; // THE READER MET THAT BLOCK
+    uint8_t *frame; // LZ FRAME BEING REASSEMBLED BY THE WRITER
+    size_t frame_len;
+    uint8_t *raw;
+    bool corrupt;
+    rsa_priv_t *key;
+    mpz_ptr mod[RSA_MAX_PRIMES], exp[RSA_MAX_PRIMES]; // FROM rsa_priv_moduli
+    uint64_t mods;
+    mont_ctx_t ctx[RSA_MAX_PRIMES];
+    mb_ctx_t mb[RSA_MAX_PRIMES];
+    bool wide; // THE mb CONTEXTS ARE SET, BLOCKS GO THROUGH mb_pow IN GROUPS
+    char *line;
+    size_t line_cap;
+} dec_job_t;
+
+// END OF BLOCKS MARKER
+// @param block : Block to check
+// @param width : Bytes in the block
+// True for all 0xFF bytes, a value no ciphertext below n can take.
+static bool end_block(const uint8_t *block, size_t width) {
+    for (size_t i = 0; i < width; i += 1) {
+        if (block[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool dec_read(void *arg, slot_t *slot) {
+    dec_job_t *job = (dec_job_t *) arg;
+    if (job->finished) {
+        return false;
+    }
+    if (job->binary) {
+        size_t want = job->batch * job->modbytes;
+        if (job->in.base != NULL) {
+            slot->in_len = job->in.size - job->pos < want ? job->in.size - job->pos : want;
+            slot->data = job->in.base + job->pos;
+            job->pos += slot->in_len;
+        } else {
+            reserve(&slot->in, &slot->in_cap, want);
+            slot->in_len = fread(slot->in, sizeof(uint8_t), want, job->infile);
+            slot->data = slot->in;
+        }
+        slot->blocks = slot->in_len / job->modbytes; // A TRUNCATED LAST BLOCK IS DROPPED
+        for (uint64_t b = 0; job->indexed && b < slot->blocks; b += 1) {
+            if (end_block(slot->data + b * job->modbytes, job->modbytes)) {
+                slot->blocks = b; // THE INDEX FOLLOWS, LEAVE IT UNREAD
+                job->finished = true;
+            }
+        }
+        job->blocks += slot->blocks;
+        return slot->blocks > 0;
+    }
+    slot->in_len = 0;
+    slot->blocks = 0;
+    ssize_t len = 0;
+    while (slot->blocks < job->batch && (len = getline(&job->line, &job->line_cap, job->infile)) != -1) {
+        while (len > 0 && (job->line[len - 1] == '\n' || job->line[len - 1] == '\r')) {
+            len -= 1;
+        }
+        if (len == 0) {
+            continue;
+        }
+        // KEEP EACH HEXSTRING NUL TERMINATED SO compute CAN PARSE IT IN PLACE
+        reserve(&slot->in, &slot->in_cap, slot->in_len + len + 1);
+        memcpy(slot->in + slot->in_len, job->line, len);
+        slot->in[slot->in_len + len] = '\0';
+        slot->in_len += len + 1;
+        slot->blocks += 1;
+    }
+    slot->data = slot->in;
+    job->blocks += slot->blocks;
+    return slot->blocks > 0;
+}
+
+// EXPORT ONE PLAINTEXT BLOCK
+// @param dst : Receives the bytes below the 0xFF pad
+// @param m : Decrypted block
+// @param low : Scratch variable
+// @param cap : Most bytes dst can take
+// Returns the bytes written, 0 for a block that does not fit.
+static size_t export_block(uint8_t *dst, mpz_t m, mpz_t low, size_t cap) {
+    size_t j = mpz_sizeinbase(m, 256);
+    if (j < 2 || j - 1 > cap) {
+        return 0;
+    }
+    // THE PAD IS THE TOP BYTE, KEEP THE LEADING ZEROS OF WHAT IS BELOW IT
+    mpz_tdiv_r_2exp(low, m, 8 * (j - 1));
+    size_t count = mpz_sgn(low) == 0 ? 0 : mpz_sizeinbase(low, 256);
+    memset(dst, 0, j - 1 - count);
+    mpz_export(dst + j - 1 - count, NULL, 1, sizeof(uint8_t), 1, 0, low);
+    return j - 1;
+}
+
+static void dec_compute(void *arg, slot_t *slot) {
+    dec_job_t *job = (dec_job_t *) arg;
+    rsa_priv_t *key = job->key;
+    size_t mlen = mpz_sizeinbase(key->n, 256);
+    nt_ws_t *ws = nt_ws_local();
+    nt_ws_reserve(ws, 8 * job->modbytes);
+    mpz_ptr m = ws->t[0], low = ws->t[4];
+    uint8_t *out = slot->out;
+    uint64_t first = slot->seq * job->batch; // BLOCK NUMBER OF THE FIRST BLOCK
+    if (job->out != NULL) {
+        out = job->out + first * (job->k - 1);
+    } else {
+        reserve(&slot->out, &slot->out_cap, slot->blocks * mlen);
+        out = slot->out;
+    }
+    slot->out_len = 0;
+    const char *hex = (const char *) slot->data;
+    mpz_ptr *cs = ws->lane, *m1s = ws->lane + MB_LANES, *m2s = ws->lane + 2 * MB_LANES;
+    bool valid[MB_LANES];
+    for (uint64_t g = 0; g < slot->blocks; g += MB_LANES) {
+        uint64_t lanes = slot->blocks - g < MB_LANES ? slot->blocks - g : MB_LANES;
+        bool wide = job->wide && lanes >= MB_LANES / 2; // A SHORT TAIL IS CHEAPER ONE BY ONE
+        for (uint64_t l = 0; l < lanes; l += 1) {
+            mpz_ptr c = cs[l];
+            valid[l] = true;
+            if (job->binary) {
+                mpz_import(c, job->modbytes, 1, sizeof(uint8_t), 1, 0,
+                    slot->data + (g + l) * job->modbytes);
+            } else {
+                valid[l] = mpz_set_str(c, hex, 16) == 0;
+                hex += strlen(hex) + 1;
+                if (!valid[l]) {
+                    mpz_set_ui(c, 0); // KEEPS ITS LANE BUSY, NOTHING IS WRITTEN FOR IT
+                }
+            }
+        }
+        // rsa_decrypt_crt ON THE SHARED CONTEXTS, ONE MODULUS AT A TIME FOR THE WHOLE
+        // GROUP: EACH NEW RESIDUE IS FOLDED INTO m1s, WHICH ENDS UP HOLDING THE BLOCKS
+        for (uint64_t i = 0; i < job->mods; i += 1) {
+            mpz_ptr *v = i == 0 ? m1s : m2s;
+            for (uint64_t l = 0; l < lanes; l += 1) {
+                mpz_mod(v[l], cs[l], job->mod[i]);
+            }
+            if (wide) {
+                mb_pow(v, v, lanes, job->exp[i], &job->mb[i]);
+            } else {
+                for (uint64_t l = 0; l < lanes; l += 1) {
+                    mont_pow_tp(m, v[l], job->exp[i], &job->ctx[i], ws->limbs);
+                    mpz_swap(m, v[l]);
+                }
+            }
+            for (uint64_t l = 0; i > 0 && l < lanes; l += 1) {
+                if (i == 1) {
+                    rsa_crt_combine(m1s[l], m1s[l], m2s[l], key);
+                } else {
+                    rsa_crt_extend(m1s[l], m2s[l], i - 2, key);
+                }
+            }
+        }
+        for (uint64_t l = 0; l < lanes; l += 1) {
+            if (!valid[l]) {
+                continue;
+            }
+            if (job->out != NULL) {
+                // EVERY BLOCK HAS A FIXED PLACE IN THE MAPPING
+                uint64_t at = (first + g + l) * (job->k - 1);
+                uint64_t cap = job->length - at < job->k - 1 ? job->length - at : job->k - 1;
+                if (at < job->length) {
+                    export_block(out + (g + l) * (job->k - 1), m1s[l], low, cap);
+                }
+                continue;
+            }
+            slot->out_len += export_block(out + slot->out_len, m1s[l], low, mlen);
+        }
+    }
+}
+
+// WRITE DECOMPRESSED
+// Runs on the writer thread. Decrypted bytes form a stream of LZ frames
+// that do not line up with batches, so each frame is reassembled in
+// job->frame and written out once it is complete.
+static void unlz_write(void *arg, slot_t *slot) {
+    dec_job_t *job = (dec_job_t *) arg;
+    const uint8_t *p = slot->out;
+    size_t n = slot->out_len;
+    if (job->frame == NULL) {
+        job->frame = (uint8_t *) malloc(8 + LZ_BOUND(LZ_FRAME));
+        job->raw = (uint8_t *) malloc(LZ_FRAME);
+    }
+    while (n > 0 && !job->corrupt) {
+        size_t need = job->frame_len < 8 ? 8 : 8 + get_be(job->frame + 4, 4);
+        size_t take = need - job->frame_len < n ? need - job->frame_len : n;
+        memcpy(job->frame + job->frame_len, p, take);
+        job->frame_len += take;
+        p += take;
+        n -= take;
+        if (job->frame_len < 8) {
+            continue;
+        }
+        size_t raw = get_be(job->frame, 4), stored = get_be(job->frame + 4, 4);
+        if (raw > LZ_FRAME || stored > LZ_BOUND(raw)) {
+            job->corrupt = true;
+            break;
+        }
+        if (job->frame_len < 8 + stored) {
+            continue;
+        }
+        if (stored == raw) {
+            engine_emit(slot->eng, job->frame + 8, raw);
+        } else if (lz_decompress(job->raw, raw, job->frame + 8, stored)) {
+            engine_emit(slot->eng, job->raw, raw);
+        } else {
+            job->corrupt = true;
+        }
+        job->frame_len = 0;
+    }
+}
+
+// PREPARE BLOCK DECRYPTION
+// @param job : Job to set up for hexstring input
+// @param infile : Input file, NULL when reading from a mapping only
+// @param key : Private key
+// @param opts : Threading options
+static void dec_job_init(dec_job_t *job, FILE *infile, rsa_priv_t *key, const rsa_file_opts_t *opts) {
+    job->infile = infile;
+    job->k = block_size(key->n);
+    job->modbytes = mpz_sizeinbase(key->n, 256);
+    job->batch = opts->batch > 0 ? opts->batch : DEFAULT_BATCH;
+    job->binary = false;
+    job->compressed = false;
+    job->indexed = false;
+    job->finished = false;
+    job->length = UINT64_MAX;
+    job->key = key;
+    job->line = NULL;
+    job->line_cap = 0;
+    job->blocks = 0;
+    job->out = NULL;
+    job->in.base = NULL;
+    job->frame = NULL;
+    job->frame_len = 0;
+    job->raw = NULL;
+    job->corrupt = false;
+    // ONE MONTGOMERY CONTEXT PER MODULUS FOR EVERY BLOCK
+    job->mods = rsa_priv_moduli(key, job->mod, job->exp);
+    uint64_t ready = 0;
+    for (uint64_t i = 0; i < job->mods; i += 1) {
+        mont_init(&job->ctx[i], job->mod[i]);
+    }
+    while (ready < job->mods && mb_init(&job->mb[ready], job->mod[ready])) {
+        ready += 1;
+    }
+    job->wide = ready == job->mods;
+    while (!job->wide && ready > 0) {
+        mb_clear(&job->mb[--ready]);
+    }
+}
+
+// FINISH BLOCK DECRYPTION
+// @param job : Job to report on and release, its input mapping included
+// Returns false when the compressed stream was corrupt or cut short.
+static bool dec_job_clear(dec_job_t *job) {
+    bool ok = !job->corrupt && job->frame_len == 0;
+    if (job->corrupt) {
+        fprintf(stderr, "Compressed stream is corrupt.\n");
+    } else if (job->frame_len > 0) {
+        fprintf(stderr, "Compressed stream is truncated.\n");
+    }
+    free(job->frame);
+    free(job->raw);
+    if (job->in.base != NULL) {
+        munmap(job->in.base, job->in.size);
+    }
+    for (uint64_t i = 0; i < job->mods; i += 1) {
+        mont_clear(&job->ctx[i]);
+        if (job->wide) {
+            mb_clear(&job->mb[i]);
+        }
+    }
+    free(job->line);
+    return ok;
+}
+
+// RSA DECRYPT FILE
+// @param infile : Input file to read data from
+// @param outfile : Output file to write decrypted messages to
+// @param key : Private key
+// Reads all ciphertexts in parameterized infile until end of file.
+// For each ciphertext, decrypt it using rsa_decrypt, or its CRT form when
+// the key carries p and q.
+// Write the decrypted message to the parameterized outfile.
+// Returns false like rsa_decrypt_file_opts.
+bool rsa_decrypt_file(FILE *infile, FILE *outfile, rsa_priv_t *key) {
+    rsa_file_opts_t opts;
+    rsa_file_opts_init(&opts);
+    return rsa_decrypt_file_opts(infile, outfile, key, &opts);
+}
+
+// CHECK CONTAINER HEADER
+// @param header : Header bytes
+// @param key : Private key the container should be for
+static bool header_ok(const uint8_t header[RSA_BIN_HEADER], rsa_priv_t *key) {
+    return memcmp(header, RSA_BIN_MAGIC, 4) == 0 && header[4] == RSA_BIN_VERSION
+        && get_be(header + 8, 4) == mpz_sizeinbase(key->n, 256);
+}
+
+// RSA DECRYPT FILE WITH OPTIONS
+// @param infile : Input file to read data from
+// @param outfile : Output file to write decrypted messages to
+// @param key : Private key
+// @param opts : Threading options
+// Accepts hexstring lines and the binary container. The first byte tells
+// them apart since the container magic starts with a non hex byte. A
+// container in a regular file is read through a mapping, and when its
+// header records the length the plaintext goes straight into a mapping of
+// a regular outfile. Returns false when the container does not fit the key,
+// fails authentication, holds less than its header promised or the output
+// could not be written; whatever was written by then is not to be trusted.
+bool rsa_decrypt_file_opts(
+    FILE *infile, FILE *outfile, rsa_priv_t *key, const rsa_file_opts_t *opts) {
+    int first = fgetc(infile);
+    uint8_t header[RSA_BIN_HEADER];
+    if (first == (uint8_t) RSA_BIN_MAGIC[0]) {
+        header[0] = first;
+        if (fread(header + 1, sizeof(uint8_t), RSA_BIN_HEADER - 1, infile) != RSA_BIN_HEADER - 1
+            || !header_ok(header, key)) {
+            fprintf(stderr, "Ciphertext container does not match this key.\n");
+            return false;
+        }
+        if (header[5] & RSA_BIN_HYBRID) {
+            return decrypt_hybrid(infile, outfile, key, header, opts);
+        }
+    } else if (first != EOF) {
+        ungetc(first, infile);
+    }
+    dec_job_t job;
+    dec_job_init(&job, infile, key, opts);
+    if (first == (uint8_t) RSA_BIN_MAGIC[0]) {
+        job.binary = true;
+        job.length = get_be(header + 16, 8);
+        job.compressed = header[5] & RSA_BIN_COMPRESSED;
+        job.indexed = header[5] & RSA_BIN_INDEXED;
+        map_input(&job.in, infile, &job.pos);
+    }
+
+    // THE HEADER LENGTH IS NOT AUTHENTICATED, SO THE MAPPING ONLY COVERS WHAT
+    // THE MAPPED CIPHERTEXT CAN DECRYPT TO; dec_compute NEVER WRITES PAST THAT
+    map_t outmap = { NULL, 0 };
+    long start = job.length != UINT64_MAX && !job.compressed && job.in.base != NULL
+        ? ftell(outfile)
+        : -1;
+    uint64_t size = 0;
+    if (start >= 0) {
+        size = (job.in.size - job.pos) / job.modbytes * (job.k - 1);
+        size = job.length < size ? job.length : size;
+    }
+    if (start >= 0 && size <= SIZE_MAX - (uint64_t) start
+        && map_output(&outmap, outfile, start + size)) {
+        job.out = outmap.base + start;
+    }
+
+    engine_t eng;
+    eng.read = dec_read;
+    eng.compute = dec_compute;
+    eng.write = job.compressed ? unlz_write : NULL;
+    eng.job = &job;
+    eng.outfile = outfile;
+    eng.skip = 0;
+    eng.left = UINT64_MAX;
+    engine_run(&eng, opts);
+
+    // A SHORT CIPHERTEXT LEAVES LESS PLAINTEXT THAN THE HEADER PROMISED
+    uint64_t produced = UINT64_MAX - eng.left;
+    if (job.out != NULL) {
+        produced = job.blocks * (job.k - 1) < job.length ? job.blocks * (job.k - 1) : job.length;
+        unmap_output(&outmap, outfile, start + produced);
+    }
+    bool ok = dec_job_clear(&job);
+    if (ok && job.length != UINT64_MAX && produced < job.length) {
+        fprintf(stderr, "Ciphertext is truncated.\n");
+        ok = false;
+    }
+    return output_ok(outfile) && ok;
+}
+
+// RESOLVE PLAINTEXT RANGE
+// @param start : First byte, negative counts back from the end
+// @param len : Bytes wanted, UINT64_MAX for all after start
+// @param length : Plaintext length, UINT64_MAX when unknown
+// @param lo : Receives the first byte
+// @param hi : Receives the end of the range, clamped to length
+// Returns false when start counts from an unknown end.
+static bool resolve_range(int64_t start, uint64_t len, uint64_t length, uint64_t *lo, uint64_t *hi) {
+    if (start < 0) {
+        uint64_t back = 0 - (uint64_t) start;
+        if (length == UINT64_MAX) {
+            return false;
+        }
+        *lo = back < length ? length - back : 0;
+    } else {
+        *lo = start;
+    }
+    *hi = len > UINT64_MAX - *lo ? UINT64_MAX : *lo + len;
+    if (length != UINT64_MAX) {
+        *lo = *lo < length ? *lo : length;
+        *hi = *hi < length ? *hi : length;
+    }
+    return true;
+}
+
+// CONTAINER INDEX
+// Points into the mapping of an indexed container.
+typedef struct {
+    const uint8_t *entries;
+    uint64_t count;
+    uint64_t length; // PLAINTEXT LENGTH FROM THE FOOTER
+    size_t end; // OFFSET OF THE END BLOCK
+} index_t;
+
+// READ CONTAINER INDEX
+// @param idx : Receives the index
+// @param base : Start of the container
+// @param size : Bytes in the container
+// @param modbytes : Block width
+// Every entry is checked, so a damaged index cannot point outside the blocks.
+static bool read_index(index_t *idx, const uint8_t *base, size_t size, size_t modbytes) {
+    const uint8_t *footer = base + size - RSA_BIN_FOOTER;
+    if (size < RSA_BIN_HEADER + modbytes + RSA_BIN_FOOTER
+        || memcmp(footer + 16, RSA_BIN_INDEX_MAGIC, 8) != 0) {
+        return false;
+    }
+    idx->count = get_be(footer, 8);
+    idx->length = get_be(footer + 8, 8);
+    if (idx->count > (size - RSA_BIN_HEADER - modbytes - RSA_BIN_FOOTER) / RSA_BIN_ENTRY) {
+        return false;
+    }
+    idx->entries = footer - idx->count * RSA_BIN_ENTRY;
+    idx->end = idx->entries - modbytes - base;
+    if ((idx->end - RSA_BIN_HEADER) % modbytes != 0 || !end_block(base + idx->end, modbytes)) {
+        return false;
+    }
+    uint64_t plain = 0, at = RSA_BIN_HEADER;
+    for (uint64_t i = 0; i < idx->count; i += 1) {
+        uint64_t p = get_be(idx->entries + i * RSA_BIN_ENTRY, 8);
+        uint64_t c = get_be(idx->entries + i * RSA_BIN_ENTRY + 8, 8);
+        if ((i == 0 ? p != 0 || c != RSA_BIN_HEADER : p <= plain || c <= at) || p > idx->length
+            || c >= idx->end || (c - RSA_BIN_HEADER) % modbytes != 0) {
+            return false;
+        }
+        plain = p;
+        at = c;
+    }
+    return true;
+}
+
+// FIND INDEX ENTRY
+// @param idx : Container index
+// @param offset : Plaintext offset
+// Returns the number of entries that start at or before offset.
+static uint64_t index_find(index_t *idx, uint64_t offset) {
+    uint64_t lo = 0, hi = idx->count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (get_be(idx->entries + mid * RSA_BIN_ENTRY, 8) <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// DECRYPT BLOCK CONTAINER RANGE
+// @param m : Mapping of the input file
+// @param at : Offset of the container in the mapping
+// @param outfile : Output file to write the range to
+// @param key : Private key
+// @param start, len : Requested range, see rsa_decrypt_range
+// @param opts : Threading options
+// Blocks carry k-1 bytes each except the last, so plain containers are
+// located by arithmetic. Compressed frames need the index. Returns false
+// when the range cannot be found or its blocks do not decrypt cleanly.
+static bool range_blocks(map_t *m, size_t at, FILE *outfile, rsa_priv_t *key, int64_t start,
+    uint64_t len, const rsa_file_opts_t *opts) {
+    const uint8_t *base = m->base + at;
+    size_t size = m->size - at;
+    uint8_t flags = base[5];
+    size_t modbytes = mpz_sizeinbase(key->n, 256);
+    uint64_t k = block_size(key->n);
+    uint64_t length = get_be(base + 16, 8);
+    size_t end = RSA_BIN_HEADER + (size - RSA_BIN_HEADER) / modbytes * modbytes;
+    index_t idx = { NULL, 0, 0, 0 };
+    if (flags & RSA_BIN_INDEXED) {
+        if (!read_index(&idx, base, size, modbytes)) {
+            fprintf(stderr, "Container index is damaged.\n");
+            return false;
+        }
+        length = idx.length;
+        end = idx.end;
+    } else if (flags & RSA_BIN_COMPRESSED) {
+        fprintf(stderr, "Compressed container has no index, encrypt it with -r.\n");
+        return false;
+    }
+    uint64_t lo, hi;
+    if (!resolve_range(start, len, length, &lo, &hi)) {
+        fprintf(stderr, "Plaintext length is unknown, the range must count from the start.\n");
+        return false;
+    }
+    // CONTAINER BYTES [from, to) HOLD THE RANGE, from STARTS AT PLAINTEXT OFFSET plain
+    size_t from, to;
+    uint64_t plain;
+    if (flags & RSA_BIN_INDEXED) {
+        uint64_t first = index_find(&idx, lo), last = index_find(&idx, hi - (hi > 0));
+        if (first == 0 || lo >= hi) {
+            return true;
+        }
+        plain = get_be(idx.entries + (first - 1) * RSA_BIN_ENTRY, 8);
+        from = get_be(idx.entries + (first - 1) * RSA_BIN_ENTRY + 8, 8);
+        to = last < idx.count ? get_be(idx.entries + last * RSA_BIN_ENTRY + 8, 8) : end;
+    } else {
+        uint64_t blocks = (end - RSA_BIN_HEADER) / modbytes;
+        uint64_t first = lo / (k - 1), last = hi == 0 ? 0 : (hi - 1) / (k - 1) + 1;
+        first = first < blocks ? first : blocks;
+        last = last < blocks ? last : blocks;
+        plain = first * (k - 1);
+        from = RSA_BIN_HEADER + first * modbytes;
+        to = RSA_BIN_HEADER + last * modbytes;
+    }
+    if (from >= to || lo >= hi) {
+        return true;
+    }
+
+    dec_job_t job;
+    dec_job_init(&job, NULL, key, opts);
+    job.binary = true;
+    job.compressed = flags & RSA_BIN_COMPRESSED;
+    job.in.base = m->base;
+    job.in.size = at + to; // THE READER STOPS AT THE END OF THE RANGE
+    job.pos = at + from;
+
+    engine_t eng;
+    eng.read = dec_read;
+    eng.compute = dec_compute;
+    eng.write = job.compressed ? unlz_write : NULL;
+    eng.job = &job;
+    eng.outfile = outfile;
+    eng.skip = lo - plain;
+    eng.left = hi - lo;
+    engine_run(&eng, opts);
+    job.in.base = NULL; // THE CALLER OWNS THE MAPPING
+    job.frame_len = 0; // A RANGE MAY END INSIDE A FRAME
+    return dec_job_clear(&job);
+}
+
+// DECRYPT HYBRID CONTAINER RANGE
+// @param m : Mapping of the input file
+// @param at : Offset of the container in the mapping
+// @param outfile : Output file to write the range to
+// @param key : Private key
+// @param start, len : Requested range, see rsa_decrypt_range
+// @param opts : Threading options
+// Chunk i sits at a fixed offset after the session block, so only the
+// session key and the chunks overlapping the range are decrypted. Returns
+// false when the key does not fit or a chunk in the range fails to open.
+static bool range_hybrid(map_t *m, size_t at, FILE *outfile, rsa_priv_t *key, int64_t start,
+    uint64_t len, const rsa_file_opts_t *opts) {
+    const uint8_t *base = m->base + at;
+    size_t size = m->size - at;
+    size_t modbytes = mpz_sizeinbase(key->n, 256);
+    size_t chunk = get_be(base + 12, 4);
+    if (chunk == 0 || chunk > HYBRID_MAX_CHUNK || block_size(key->n) - 1 < SESSION_BYTES) {
+        fprintf(stderr, "Ciphertext container does not match this key.\n");
+        return false;
+    }
+    hyb_job_t job;
+    size_t payload = RSA_BIN_HEADER + modbytes;
+    if (size < payload || !unwrap_session(&job, base + RSA_BIN_HEADER, key)) {
+        fprintf(stderr, "Session key does not unwrap with this key.\n");
+        return false;
+    }
+    hyb_open_init(&job, NULL, base, opts);
+    uint64_t chunks = (size - payload + job.stride - 1) / job.stride;
+    uint64_t length = get_be(base + 16, 8);
+    if (length == UINT64_MAX && chunks > 0 && size - payload - (chunks - 1) * job.stride >= POLY1305_TAG) {
+        length = size - payload - chunks * POLY1305_TAG; // THE LENGTH FOLLOWS FROM THE CHUNKS
+    }
+    uint64_t lo, hi;
+    if (!resolve_range(start, len, length, &lo, &hi)) {
+        fprintf(stderr, "Plaintext length is unknown, the range must count from the start.\n");
+        return false;
+    }
+    uint64_t first = lo / chunk, last = hi == 0 ? 0 : (hi - 1) / chunk + 1;
+    last = last < chunks ? last : chunks;
+    if (lo >= hi || first >= last) {
+        return true;
+    }
+    size_t from = payload + first * job.stride;
+    size_t to = size - payload < last * job.stride ? size : payload + last * job.stride;
+    job.in.base = m->base;
+    job.in.size = at + to; // THE READER STOPS AT THE END OF THE RANGE
+    job.pos = at + from;
+    job.first = first;
+    job.tail = to == size;
+
+    engine_t eng;
+    eng.read = hyb_read;
+    eng.compute = hyb_compute;
+    eng.write = NULL;
+    eng.job = &job;
+    eng.outfile = outfile;
+    eng.skip = lo - first * chunk;
+    eng.left = hi - lo;
+    engine_run(&eng, opts);
+
+    if (job.bad) {
+        fprintf(stderr, "Ciphertext failed authentication.\n");
+    } else if (job.tail && !job.ended) {
+        fprintf(stderr, "Ciphertext is truncated.\n");
+    }
+    return !job.bad && (!job.tail || job.ended);
+}
+
+// RSA DECRYPT FILE RANGE
+// @param infile : Input file holding a binary container, must be a regular file
+// @param outfile : Output file to write the plaintext range to
+// @param key : Private key
+// @param start : First plaintext byte, negative counts back from the end
+// @param len : Bytes to decrypt, UINT64_MAX for everything after start
+// @param opts : Threading options
+// Seeks straight to the blocks or chunks holding the range and decrypts
+// only those, so the cost follows the range and not the file. Plain block
+// containers and hybrid containers are located by arithmetic; compressed
+// containers need the trailing index written with opts->index. Returns
+// false on any error, like rsa_decrypt_file_opts.
+bool rsa_decrypt_range(FILE *infile, FILE *outfile, rsa_priv_t *key, int64_t start, uint64_t len,
+    const rsa_file_opts_t *opts) {
+    map_t m;
+    size_t at = 0;
+    bool ok = false;
+    if (!map_input(&m, infile, &at) || m.size - at < RSA_BIN_HEADER
+        || memcmp(m.base + at, RSA_BIN_MAGIC, 4) != 0) {
+        fprintf(stderr, "Range decryption needs a binary container in a regular file.\n");
+    } else if (!header_ok(m.base + at, key)) {
+        fprintf(stderr, "Ciphertext container does not match this key.\n");
+    } else if (m.base[at + 5] & RSA_BIN_HYBRID) {
+        ok = range_hybrid(&m, at, outfile, key, start, len, opts);
+    } else {
+        ok = range_blocks(&m, at, outfile, key, start, len, opts);
+    }
+    if (m.base != NULL) {
+        munmap(m.base, m.size);
+    }
+    return output_ok(outfile) && ok;
+}
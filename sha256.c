@@ -0,0 +1,203 @@
+#include "sha256.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_X86 1
+#endif
+
+#define READ_BUFFER (1 << 20) // BYTES PER READ IN sha256_file
+
+static const uint32_t K[64] = { 0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b,
+    0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74,
+    0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+    0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3,
+    0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354,
+    0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819,
+    0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3,
+    0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa,
+    0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// PORTABLE COMPRESSION
+// @param h : Chaining state
+// @param data : blocks * 64 bytes
+static void compress_generic(uint32_t h[8], const uint8_t *data, size_t blocks) {
+    uint32_t w[64];
+    for (; blocks > 0; blocks -= 1, data += SHA256_BLOCK) {
+        for (int i = 0; i < 16; i += 1) {
+            const uint8_t *p = data + 4 * i;
+            w[i] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+        }
+        for (int i = 16; i < 64; i += 1) {
+            uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        uint32_t e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; i += 1) {
+            uint32_t t1 = hh + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i]
+                + w[i];
+            uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += hh;
+    }
+}
+
+#ifdef SHA256_X86
+// SHA-NI COMPRESSION
+// The state is kept as ABEF / CDGH pairs for sha256rnds2. Each pass does
+// four rounds and extends the message schedule four words ahead.
+__attribute__((target("sha,sse4.1"))) static void compress_shani(
+    uint32_t h[8], const uint8_t *data, size_t blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &h[0]), 0xB1); // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &h[4]), 0x1B); // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0); // CDGH
+
+    for (; blocks > 0; blocks -= 1, data += SHA256_BLOCK) {
+        __m128i abef = state0, cdgh = state1;
+        __m128i msg[4];
+        for (int i = 0; i < 4; i += 1) {
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)), mask);
+        }
+        for (int i = 0; i < 16; i += 1) {
+            __m128i m = _mm_add_epi32(msg[i & 3], _mm_loadu_si128((const __m128i *) &K[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+            if (i >= 3 && i < 15) {
+                __m128i next = _mm_add_epi32(msg[(i + 1) & 3], _mm_alignr_epi8(msg[i & 3], msg[(i - 1) & 3], 4));
+                msg[(i + 1) & 3] = _mm_sha256msg2_epu32(next, msg[i & 3]);
+            }
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(m, 0x0E));
+            if (i >= 1 && i < 13) {
+                msg[(i - 1) & 3] = _mm_sha256msg1_epu32(msg[(i - 1) & 3], msg[i & 3]);
+            }
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B); // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1); // DCHG
+    _mm_storeu_si128((__m128i *) &h[0], _mm_blend_epi16(tmp, state1, 0xF0)); // DCBA
+    _mm_storeu_si128((__m128i *) &h[4], _mm_alignr_epi8(state1, tmp, 8)); // HGFE
+}
+#endif
+
+// COMPRESSION KERNEL
+// Picked once: SHA-NI when the CPU has it together with SSSE3 and SSE4.1.
+static void (*compress)(uint32_t h[8], const uint8_t *data, size_t blocks) = compress_generic;
+static pthread_once_t compress_once = PTHREAD_ONCE_INIT;
+
+static void compress_pick(void) {
+#ifdef SHA256_X86
+    unsigned a, b, c, d;
+    if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3) && (c & bit_SSE4_1)
+        && __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA)) {
+        compress = compress_shani;
+    }
+#endif
+}
+
+// SHA-256 INIT
+// @param ctx : Hash state to reset
+void sha256_init(sha256_t *ctx) {
+    static const uint32_t iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+        0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    pthread_once(&compress_once, compress_pick);
+    memcpy(ctx->h, iv, sizeof(iv));
+    ctx->len = 0;
+    ctx->left = 0;
+}
+
+// SHA-256 UPDATE
+// @param ctx : Hash state
+// @param data : Next len bytes of the message
+// Whole blocks are compressed straight from data without copying.
+void sha256_update(sha256_t *ctx, const uint8_t *data, size_t len) {
+    ctx->len += len;
+    if (ctx->left > 0) {
+        size_t want = SHA256_BLOCK - ctx->left < len ? SHA256_BLOCK - ctx->left : len;
+        memcpy(ctx->buf + ctx->left, data, want);
+        ctx->left += want;
+        data += want;
+        len -= want;
+        if (ctx->left < SHA256_BLOCK) {
+            return;
+        }
+        compress(ctx->h, ctx->buf, 1);
+        ctx->left = 0;
+    }
+    compress(ctx->h, data, len / SHA256_BLOCK);
+    data += len - len % SHA256_BLOCK;
+    memcpy(ctx->buf, data, len % SHA256_BLOCK);
+    ctx->left = len % SHA256_BLOCK;
+}
+
+// SHA-256 FINAL
+// @param ctx : Hash state, unusable afterwards
+// @param digest : Receives the 32 byte digest
+void sha256_final(sha256_t *ctx, uint8_t digest[SHA256_DIGEST]) {
+    uint64_t bits = ctx->len * 8;
+    uint8_t pad[2 * SHA256_BLOCK] = { 0x80 };
+    size_t padlen = (ctx->left < 56 ? 56 : 120) - ctx->left;
+    for (int i = 0; i < 8; i += 1) {
+        pad[padlen + i] = bits >> (56 - 8 * i);
+    }
+    sha256_update(ctx, pad, padlen + 8);
+    for (int i = 0; i < 8; i += 1) {
+        digest[4 * i] = ctx->h[i] >> 24;
+        digest[4 * i + 1] = ctx->h[i] >> 16;
+        digest[4 * i + 2] = ctx->h[i] >> 8;
+        digest[4 * i + 3] = ctx->h[i];
+    }
+}
+
+// SHA-256 OF A FILE
+// @param infile : File to hash until end of file
+// @param digest : Receives the digest
+// @param length : Receives the number of bytes hashed
+// Reads in large chunks and tells the kernel the access is sequential so
+// readahead keeps the disk busy while a chunk is hashed.
+bool sha256_file(FILE *infile, uint8_t digest[SHA256_DIGEST], uint64_t *length) {
+    uint8_t *buffer = (uint8_t *) malloc(READ_BUFFER);
+    if (buffer == NULL) {
+        return false;
+    }
+    posix_fadvise(fileno(infile), 0, 0, POSIX_FADV_SEQUENTIAL);
+    sha256_t ctx;
+    sha256_init(&ctx);
+    size_t got;
+    while ((got = fread(buffer, sizeof(uint8_t), READ_BUFFER, infile)) > 0) {
+        sha256_update(&ctx, buffer, got);
+    }
+    bool ok = !ferror(infile);
+    *length = ctx.len;
+    sha256_final(&ctx, digest);
+    free(buffer);
+    return ok;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SHA256_DIGEST 32
+#define SHA256_BLOCK  64
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t len;
+    uint8_t buf[SHA256_BLOCK];
+    size_t left;
+} sha256_t;
+
+void sha256_init(sha256_t *ctx);
+
+void sha256_update(sha256_t *ctx, const uint8_t *data, size_t len);
+
+void sha256_final(sha256_t *ctx, uint8_t digest[SHA256_DIGEST]);
+
+bool sha256_file(FILE *infile, uint8_t digest[SHA256_DIGEST], uint64_t *length);
@@ -0,0 +1,97 @@
+#include "rsa.h"
+#include "sha256.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OPTIONS "hvi:o:n:t:"
+
+void help(char *exec) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "   Signs the SHA-256 digest of a file.\n\n"
+        "USAGE\n"
+        "   %s [-hv] [-n privkey] [-i input file] [-o signature file] [-t threads]\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -v              Display verbose program output.\n"
+        "   -i infile       Specifies the file to sign (default: stdin).\n"
+        "   -o sigfile      Specifies the signature output (default: stdout).\n"
+        "   -n privfile     Private key file (default: rsa.priv).\n"
+        "   -t threads      Exponentiate mod each prime of the key on its own worker\n"
+        "                   (default: 0, one after another).\n",
+        exec);
+}
+
+int main(int argc, char **argv) {
+    arena_install(); // BEFORE ANY GMP ALLOCATION
+    FILE *pvfile = fopen("rsa.priv", "r");
+    FILE *infile = stdin;
+    FILE *outfile = stdout;
+    int opt = 0;
+    bool verbose = false;
+    uint64_t threads = 0;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'n': pvfile = fopen(optarg, "r"); break;
+        case 'i': infile = fopen(optarg, "r"); break;
+        case 'o': outfile = fopen(optarg, "w"); break;
+        case 't': threads = atoi(optarg); break;
+        case 'v': verbose = true; break;
+        case 'h': {
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+        }
+    }
+    if (pvfile == NULL || infile == NULL || outfile == NULL) {
+        fprintf(stderr, "Could not open a file.\n");
+        return EXIT_FAILURE;
+    }
+    // Read Private Key, with CRT values when the file carries them
+    rsa_priv_t key;
+    rsa_priv_init(&key);
+    rsa_read_priv_crt(&key, pvfile);
+
+    // Hash the whole file, then sign the encoded digest once
+    uint8_t digest[SHA256_DIGEST];
+    uint64_t length = 0;
+    if (!sha256_file(infile, digest, &length)) {
+        fprintf(stderr, "Could not read the input file.\n");
+        return EXIT_FAILURE;
+    }
+    mpz_t m, s;
+    mpz_inits(m, s, NULL);
+    if (!rsa_encode_digest(m, digest, key.n)) {
+        fprintf(stderr, "Key is too small to sign a SHA-256 digest.\n");
+        return EXIT_FAILURE;
+    }
+    if (key.crt) {
+        pool_t *pool = threads > 0 ? pool_create(threads) : NULL;
+        rsa_sign_crt_pool(s, m, &key, pool);
+        if (pool != NULL) {
+            pool_destroy(pool);
+        }
+    } else {
+        rsa_sign(s, m, key.d, key.n);
+    }
+    gmp_fprintf(outfile, "%Zx\n", s);
+
+    // If verbose
+    if (verbose) {
+        fprintf(stderr, "length = %lu bytes\nsha256 = ", length);
+        for (int i = 0; i < SHA256_DIGEST; i += 1) {
+            fprintf(stderr, "%02x", digest[i]);
+        }
+        gmp_fprintf(stderr, "\ns (%d bits) = %Zd\n", mpz_sizeinbase(s, 2), s);
+    }
+
+    // Close files and clear any mpz_t variables used
+    mpz_clears(m, s, NULL);
+    rsa_priv_clear(&key);
+    fclose(infile);
+    fclose(outfile);
+    fclose(pvfile);
+}
@@ -0,0 +1,51 @@
+#include "stats.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef RSA_NO_STATS
+_Atomic uint64_t stat_counts[STAT_COUNT];
+
+static const char *stat_names[STAT_COUNT] = {
+    "mr_rounds",
+    "lucas_tests",
+    "walk_restarts",
+    "coprime_skips",
+    "key_rounds",
+    "gcd_retries",
+    "pow_mod",
+    "gcd",
+    "mod_inverse",
+    "batches",
+    "blocks",
+    "candidates",
+    "sieve_survivors",
+    "arena_allocs",
+    "mallocs",
+    "prime_search",
+    "read",
+    "compute",
+    "write",
+};
+#endif
+
+// STATS REPORT
+// @param out : Stream to write to, stderr from the tools' --stats
+// One JSON object: the counters and the timers in milliseconds. Only
+// "enabled": false when the counters were compiled out.
+void stats_json(FILE *out) {
+#ifndef RSA_NO_STATS
+    fprintf(out, "{\n  \"enabled\": true,\n  \"counters\": {");
+    for (int s = 0; s < STAT_TIMERS; s += 1) {
+        fprintf(out, "%s\n    \"%s\": %lu", s > 0 ? "," : "", stat_names[s],
+            (uint64_t) stat_counts[s]);
+    }
+    fprintf(out, "\n  },\n  \"timers_ms\": {");
+    for (int s = STAT_TIMERS; s < STAT_COUNT; s += 1) {
+        fprintf(out, "%s\n    \"%s\": %.3f", s > STAT_TIMERS ? "," : "", stat_names[s],
+            stat_counts[s] / 1e6);
+    }
+    fprintf(out, "\n  }\n}\n");
+#else
+    fprintf(out, "{\n  \"enabled\": false\n}\n");
+#endif
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// HOT PATH COUNTERS AND PHASE TIMERS
+// Counters count events and timers add up nanoseconds of the monotonic
+// clock, both through relaxed atomics so workers never wait on each other.
+// Building with STATS=0 (-DRSA_NO_STATS) turns every STAT_ macro into
+// nothing, and stats_json reports that the counters were compiled out.
+typedef enum {
+    STAT_MR_ROUNDS, // MILLER-RABIN ROUNDS RUN BY is_prime
+    STAT_LUCAS_TESTS, // STRONG LUCAS TESTS RUN FOR BAILLIE-PSW
+    STAT_WALK_RESTARTS, // SIEVED WALKS THAT ENDED WITHOUT A PRIME
+    STAT_COPRIME_SKIPS, // SIEVE SURVIVORS WITH gcd(p - 1, e) != 1, NEVER TESTED
+    STAT_KEY_ROUNDS, // PRIME DRAWS THAT GAVE TOO SHORT AN n OR p == q
+    STAT_GCD_RETRIES, // PRIMES OR EXPONENTS REDRAWN FOR A gcd WITH THE TOTIENT
+    STAT_POW_MOD, // pow_mod AND pow_mod_ui CALLS
+    STAT_GCD, // gcd AND gcd_ext CALLS
+    STAT_MOD_INVERSE, // mod_inverse CALLS
+    STAT_BATCHES, // BATCHES THROUGH THE FILE ENGINE
+    STAT_BLOCKS, // BLOCKS (OR HYBRID CHUNKS) IN THOSE BATCHES
+    STAT_CANDIDATES, // VALUES make_prime WALKED OVER
+    STAT_SIEVE_SURVIVORS, // OF THOSE, THE ONES THAT SURVIVED SIEVING AND WENT TO is_prime
+    STAT_ARENA_ALLOCS, // BLOCKS HANDED OUT BY THE ARENA, GMP'S INCLUDED AFTER arena_install
+    STAT_MALLOCS, // OF THOSE, THE ONES NO CACHED BLOCK COULD SERVE
+    STAT_TIMERS, // EVERYTHING FROM HERE ON IS NANOSECONDS
+    STAT_PRIME_NS = STAT_TIMERS, // PRIME SEARCH
+    STAT_READ_NS, // FILE ENGINE READER
+    STAT_COMPUTE_NS, // FILE ENGINE COMPUTE, SUMMED OVER WORKERS
+    STAT_WRITE_NS, // FILE ENGINE WRITER
+    STAT_COUNT
+} stat_t;
+
+#ifndef RSA_NO_STATS
+#include <stdatomic.h>
+#include <time.h>
+
+extern _Atomic uint64_t stat_counts[STAT_COUNT];
+
+// MONOTONIC CLOCK IN NANOSECONDS
+static inline uint64_t stat_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#define STAT_ADD(s, v)   atomic_fetch_add_explicit(&stat_counts[s], (v), memory_order_relaxed)
+#define STAT_START(t)    uint64_t t = stat_clock()
+#define STAT_STOP(s, t)  STAT_ADD(s, stat_clock() - (t))
+#define STAT_READ(s)     atomic_load_explicit(&stat_counts[s], memory_order_relaxed)
+#else
+#define STAT_ADD(s, v)   ((void) 0)
+#define STAT_START(t)    ((void) 0)
+#define STAT_STOP(s, t)  ((void) 0)
+#define STAT_READ(s)     ((uint64_t) 0)
+#endif
+
+void stats_json(FILE *out);
@@ -0,0 +1,204 @@
+#include "threadpool.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// TASK QUEUE OF ONE WORKER
+// A growable ring of tasks. The owner and thieves both take from the head so
+// the oldest work runs first, which keeps in-order consumers moving.
+typedef struct {
+    task_fn fn;
+    void *arg;
+} task_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    task_t *buf;
+    uint64_t cap, head, size;
+} deque_t;
+
+struct pool {
+    uint64_t threads; // DEQUES, ONE PER WORKER ASKED FOR
+    uint64_t started; // WORKERS RUNNING, THEY STEAL FROM THE DEQUES OF THE REST
+    pthread_t *tids;
+    deque_t *deques;
+    uint64_t next; // DEQUE THE NEXT SUBMISSION GOES TO
+    pthread_mutex_t lock;
+    pthread_cond_t work; // SIGNALED WHEN TASKS ARE QUEUED OR THE POOL STOPS
+    pthread_cond_t idle; // SIGNALED WHEN THE LAST PENDING TASK FINISHES
+    uint64_t queued; // TASKS SITTING IN DEQUES
+    uint64_t pending; // TASKS SUBMITTED BUT NOT FINISHED
+    bool stop;
+};
+
+typedef struct {
+    pool_t *pool;
+    uint64_t id;
+} worker_arg_t;
+
+static void deque_push(deque_t *dq, task_t task) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->size == dq->cap) {
+        uint64_t cap = dq->cap == 0 ? 16 : 2 * dq->cap;
+        task_t *buf = (task_t *) malloc(cap * sizeof(task_t));
+        for (uint64_t i = 0; i < dq->size; i += 1) {
+            buf[i] = dq->buf[(dq->head + i) % dq->cap];
+        }
+        free(dq->buf);
+        dq->buf = buf;
+        dq->cap = cap;
+        dq->head = 0;
+    }
+    dq->buf[(dq->head + dq->size) % dq->cap] = task;
+    dq->size += 1;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+static bool deque_pop(deque_t *dq, task_t *task) {
+    bool got = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->size > 0) {
+        *task = dq->buf[dq->head];
+        dq->head = (dq->head + 1) % dq->cap;
+        dq->size -= 1;
+        got = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return got;
+}
+
+// WORKER LOOP
+// Runs tasks from its own deque and steals from the others when it runs dry.
+// Sleeps only when no deque holds any task.
+static void *pool_worker(void *arg) {
+    worker_arg_t *wa = (worker_arg_t *) arg;
+    pool_t *pool = wa->pool;
+    uint64_t id = wa->id;
+    free(wa);
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (pool->queued == 0 && pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        task_t task;
+        bool got = false;
+        for (uint64_t i = 0; i < pool->threads && !got; i += 1) {
+            got = deque_pop(&pool->deques[(id + i) % pool->threads], &task);
+        }
+        if (!got) {
+            continue; // ANOTHER WORKER TOOK IT FIRST
+        }
+        pthread_mutex_lock(&pool->lock);
+        pool->queued -= 1;
+        pthread_mutex_unlock(&pool->lock);
+
+        task.fn(task.arg);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->pending -= 1;
+        if (pool->pending == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// CREATE THREAD POOL
+// @param threads : Number of worker threads, at least one
+// Returns a pool with one task deque per worker. When the system refuses
+// some threads the pool runs on those it got, and when it refuses all of
+// them pool_create returns NULL, which every caller treats as running the
+// work on the calling thread.
+pool_t *pool_create(uint64_t threads) {
+    pool_t *pool = (pool_t *) calloc(1, sizeof(pool_t));
+    pool->threads = threads == 0 ? 1 : threads;
+    pool->tids = (pthread_t *) malloc(pool->threads * sizeof(pthread_t));
+    pool->deques = (deque_t *) calloc(pool->threads, sizeof(deque_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    for (uint64_t i = 0; i < pool->threads; i += 1) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    }
+    for (uint64_t i = 0; i < pool->threads; i += 1) {
+        worker_arg_t *wa = (worker_arg_t *) malloc(sizeof(worker_arg_t));
+        wa->pool = pool;
+        wa->id = i;
+        if (pthread_create(&pool->tids[pool->started], NULL, pool_worker, wa) != 0) {
+            free(wa);
+            continue;
+        }
+        pool->started += 1;
+    }
+    if (pool->started < pool->threads) {
+        fprintf(stderr, "Could only start %lu of %lu worker threads.\n", pool->started,
+            pool->threads);
+    }
+    if (pool->started == 0) {
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// SUBMIT TASK
+// @param pool : Pool to run the task on
+// @param fn : Function to run
+// @param arg : Argument passed to fn
+// Submissions are dealt round-robin over the worker deques.
+void pool_submit(pool_t *pool, task_fn fn, void *arg) {
+    task_t task = { fn, arg };
+    // COUNT THE TASK BEFORE IT BECOMES VISIBLE SO queued NEVER UNDERFLOWS
+    pthread_mutex_lock(&pool->lock);
+    uint64_t target = pool->next;
+    pool->next = (pool->next + 1) % pool->threads;
+    pool->pending += 1;
+    pool->queued += 1;
+    pthread_mutex_unlock(&pool->lock);
+
+    deque_push(&pool->deques[target], task);
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// WAIT FOR ALL SUBMITTED TASKS
+// @param pool : Pool to wait on
+void pool_wait(pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// DESTROY THREAD POOL
+// @param pool : Pool to stop, queued tasks still run first
+void pool_destroy(pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint64_t i = 0; i < pool->started; i += 1) {
+        pthread_join(pool->tids[i], NULL);
+    }
+    for (uint64_t i = 0; i < pool->threads; i += 1) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].buf);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->deques);
+    free(pool->tids);
+    free(pool);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef void (*task_fn)(void *arg);
+
+typedef struct pool pool_t;
+
+pool_t *pool_create(uint64_t threads);
+
+void pool_submit(pool_t *pool, task_fn fn, void *arg);
+
+void pool_wait(pool_t *pool);
+
+void pool_destroy(pool_t *pool);
@@ -0,0 +1,300 @@
+#include "tune.h"
+#include "rsa.h"
+#include "montgomery.h"
+#include "numtheory.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#define TUNE_LINE    256
+#define TUNE_ENTRIES 64 // PROFILE LINES KEPT FROM OTHER OPS AND KEY SIZES
+#define TUNE_BLOCKS  256 // BLOCKS IN THE SAMPLE FILE
+#define TUNE_OPS     16 // PRIVATE KEY OPERATIONS PER WINDOW CANDIDATE
+#define TUNE_RUNS    2 // BEST OF THIS MANY TIMINGS PER CANDIDATE
+
+// MONOTONIC CLOCK IN SECONDS
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// CPU IDENTITY
+// @param buf : Receives "cpu cores model", the first line of a profile
+// @param size : Size of buf
+static void cpu_id(char *buf, size_t size) {
+    char model[TUNE_LINE] = "unknown";
+    char line[TUNE_LINE];
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        char *c = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && c != NULL) {
+            c += 1 + strspn(c + 1, " \t");
+            c[strcspn(c, "\n")] = '\0';
+            snprintf(model, sizeof(model), "%s", c);
+            break;
+        }
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    snprintf(buf, size, "cpu %ld %s\n", sysconf(_SC_NPROCESSORS_ONLN), model);
+}
+
+// LOAD TUNING PROFILE
+// @param path : Profile file
+// @param op : "encrypt" or "decrypt"
+// @param bits : Bits of n
+// @param t : Receives the settings
+// Returns false when there is no profile, it was made on another CPU or it
+// has no line for op and bits.
+bool tune_load(const char *path, const char *op, uint64_t bits, tune_t *t) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    char id[TUNE_LINE], line[TUNE_LINE];
+    cpu_id(id, sizeof(id));
+    bool found = false;
+    if (fgets(line, sizeof(line), f) != NULL && strcmp(line, id) == 0) {
+        char name[16];
+        uint64_t b;
+        tune_t v;
+        while (!found && fgets(line, sizeof(line), f) != NULL) {
+            if (sscanf(line, "%15s %lu %ld %lu %lu", name, &b, &v.bias, &v.threads, &v.batch) == 5
+                && strcmp(name, op) == 0 && b == bits && v.batch > 0) {
+                *t = v;
+                found = true;
+            }
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// SAVE TUNING PROFILE
+// @param path : Profile file, rewritten
+// @param op,bits : Operation and key size the settings are for
+// @param t : Settings
+// Lines for other operations and key sizes stay when the profile was made
+// on this CPU; a profile from another CPU is replaced whole.
+bool tune_save(const char *path, const char *op, uint64_t bits, const tune_t *t) {
+    char id[TUNE_LINE], line[TUNE_LINE];
+    char keep[TUNE_ENTRIES][TUNE_LINE];
+    uint64_t kept = 0;
+    cpu_id(id, sizeof(id));
+    FILE *f = fopen(path, "r");
+    if (f != NULL && fgets(line, sizeof(line), f) != NULL && strcmp(line, id) == 0) {
+        char name[16];
+        uint64_t b;
+        while (kept < TUNE_ENTRIES && fgets(line, sizeof(line), f) != NULL) {
+            if (sscanf(line, "%15s %lu", name, &b) == 2 && (strcmp(name, op) != 0 || b != bits)) {
+                memcpy(keep[kept], line, TUNE_LINE);
+                kept += 1;
+            }
+        }
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    f = fopen(path, "w");
+    if (f == NULL) {
+        return false;
+    }
+    fputs(id, f);
+    for (uint64_t i = 0; i < kept; i += 1) {
+        fputs(keep[i], f);
+    }
+    fprintf(f, "%s %lu %ld %lu %lu\n", op, bits, t->bias, t->threads, t->batch);
+    fclose(f);
+    return true;
+}
+
+// TIME THE FILE LOOP
+// @param in : Sample input, plaintext for encrypt and ciphertext for decrypt
+// @param n,e : Public key for encrypt
+// @param key : Private key for decrypt, NULL to encrypt
+// @param opts : Settings under test
+// Best of TUNE_RUNS, in seconds.
+static double time_file(FILE *in, mpz_t n, mpz_t e, rsa_priv_t *key, rsa_file_opts_t *opts) {
+    double best = 1e30;
+    for (int r = 0; r < TUNE_RUNS; r += 1) {
+        FILE *out = tmpfile();
+        rewind(in);
+        double t0 = now();
+        if (key != NULL) {
+            rsa_decrypt_file_opts(in, out, key, opts);
+        } else {
+            rsa_encrypt_file_opts(in, out, n, e, opts);
+        }
+        fflush(out);
+        double t = now() - t0;
+        fclose(out);
+        best = t < best ? t : best;
+    }
+    return best;
+}
+
+// TIME THE KEY EXPONENTIATION
+// @param n,e : Public key for encrypt
+// @param key : Private key for decrypt, NULL to encrypt
+// @param c : Base below n
+// Best of TUNE_RUNS over TUNE_OPS operations, in seconds.
+static double time_pow(mpz_t n, mpz_t e, rsa_priv_t *key, mpz_t c) {
+    double best = 1e30;
+    mpz_t m;
+    mpz_init(m);
+    for (int r = 0; r < TUNE_RUNS; r += 1) {
+        double t0 = now();
+        for (uint64_t i = 0; i < TUNE_OPS; i += 1) {
+            if (key != NULL) {
+                rsa_decrypt_crt(m, c, key);
+            } else {
+                rsa_encrypt(m, c, e, n);
+            }
+        }
+        double t = now() - t0;
+        best = t < best ? t : best;
+    }
+    mpz_clear(m);
+    return best;
+}
+
+// PUBLIC EXPONENT FROM A PRIVATE KEY
+// @param e : Receives d^-1 mod lcm(r - 1) over the primes
+// @param key : Private key with CRT data
+// Any such e inverts d, which is all the sample ciphertext needs.
+static void derive_e(mpz_t e, rsa_priv_t *key) {
+    mpz_ptr mods[RSA_MAX_PRIMES], exps[RSA_MAX_PRIMES];
+    uint64_t count = rsa_priv_moduli(key, mods, exps);
+    mpz_t lambda, r;
+    mpz_init_set_ui(lambda, 1);
+    mpz_init(r);
+    for (uint64_t i = 0; i < count; i += 1) {
+        mpz_sub_ui(r, mods[i], 1);
+        mpz_lcm(lambda, lambda, r);
+    }
+    mod_inverse(e, key->d, lambda);
+    mpz_clears(lambda, r, NULL);
+}
+
+// TUNE ON THIS MACHINE
+// @param t : Receives the fastest settings found
+// @param n,e : Public key to tune encryption for
+// @param key : Private key to tune decryption for instead, or NULL
+// Times each candidate in turn, keeping the best so far: the window bias
+// on the key's exponentiation (unless e fits a word, which takes the
+// windowless pow_mod_ui path), then the thread count and then the batch
+// size on the binary file loop over a sample of TUNE_BLOCKS blocks. Decryption needs CRT data
+// to build its sample ciphertext; without it only the window is tuned.
+void tune_run(tune_t *t, mpz_t n, mpz_t e, rsa_priv_t *key) {
+    rsa_file_opts_t opts;
+    rsa_file_opts_init(&opts);
+    opts.binary = true;
+    t->bias = 0;
+    t->threads = opts.threads;
+    t->batch = opts.batch;
+
+    // SAMPLE PLAINTEXT, THE BYTES DO NOT CHANGE THE TIMINGS
+    size_t k = (mpz_sizeinbase(n, 2) - 1) / 8;
+    FILE *sample = tmpfile();
+    for (size_t i = 0; i < TUNE_BLOCKS * (k - 1); i += 1) {
+        fputc((uint8_t) ((i * 2654435761u) >> 13), sample);
+    }
+    fflush(sample);
+
+    if (key != NULL || !mpz_fits_ulong_p(e)) {
+        mpz_t c;
+        mpz_init(c);
+        mpz_tdiv_q_2exp(c, n, 3);
+        double best = time_pow(n, e, key, c);
+        for (int64_t bias = -1; bias <= 1; bias += 2) {
+            mont_window_bias = bias;
+            double s = time_pow(n, e, key, c);
+            if (s < best) {
+                best = s;
+                t->bias = bias;
+            }
+        }
+        mont_window_bias = t->bias;
+        mpz_clear(c);
+    }
+
+    mpz_t pub;
+    mpz_init(pub);
+    FILE *in = sample;
+    if (key != NULL && key->crt) {
+        derive_e(pub, key);
+        in = tmpfile();
+        rewind(sample);
+        rsa_encrypt_file_opts(sample, in, n, pub, &opts);
+        fflush(in);
+    } else if (key == NULL) {
+        mpz_set(pub, e);
+    }
+    if (key == NULL || key->crt) {
+        uint64_t cores = sysconf(_SC_NPROCESSORS_ONLN);
+        double best = time_file(in, n, pub, key, &opts);
+        for (uint64_t threads = 1;; threads *= 2) { // POWERS OF TWO, THEN EVERY CORE
+            threads = threads > cores ? cores : threads;
+            opts.threads = threads;
+            double s = time_file(in, n, pub, key, &opts);
+            if (s < best) {
+                best = s;
+                t->threads = threads;
+            }
+            if (threads == cores) {
+                break;
+            }
+        }
+        opts.threads = t->threads;
+        for (uint64_t batch = 4; batch <= 64; batch *= 2) {
+            if (batch == t->batch) {
+                continue;
+            }
+            opts.batch = batch;
+            double s = time_file(in, n, pub, key, &opts);
+            if (s < best) {
+                best = s;
+                t->batch = batch;
+            }
+        }
+    }
+    if (in != sample) {
+        fclose(in);
+    }
+    fclose(sample);
+    mpz_clear(pub);
+}
+
+// TUNE OR LOAD AT STARTUP
+// @param t : Receives the settings to use
+// @param path : Profile file
+// @param force : Tune now whatever the profile holds
+// @param n,e : Public key when encrypting
+// @param key : Private key when decrypting, NULL when encrypting
+// Without force, nothing happens unless the profile exists: a matching
+// line is used as it is, and a profile from another CPU, or one without
+// this operation and key size, is tuned and saved first. Returns whether
+// t holds settings.
+bool tune_setup(tune_t *t, const char *path, bool force, mpz_t n, mpz_t e, rsa_priv_t *key) {
+    const char *op = key != NULL ? "decrypt" : "encrypt";
+    uint64_t bits = mpz_sizeinbase(n, 2);
+    if (!force && access(path, F_OK) != 0) {
+        return false;
+    }
+    if (!force && tune_load(path, op, bits, t)) {
+        return true;
+    }
+    fprintf(stderr, "Tuning %s for %lu-bit keys on this CPU, saving to %s...\n", op, bits, path);
+    tune_run(t, n, e, key);
+    if (!tune_save(path, op, bits, t)) {
+        fprintf(stderr, "Failed to write %s.\n", path);
+    }
+    return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "rsa.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+// TUNING PROFILE
+// A text file of the settings that timed fastest on this machine. The first
+// line names the CPU, its core count and model name, and a profile made on
+// any other CPU is thrown away and tuned again. Each further line is
+//   op bits bias threads batch
+// for op encrypt or decrypt with an n of bits bits: the window bias
+// (mont_window_bias), the worker threads and the blocks per batch.
+#define TUNE_DEFAULT "rsa.tune"
+
+typedef struct {
+    int64_t bias;
+    uint64_t threads;
+    uint64_t batch;
+} tune_t;
+
+bool tune_load(const char *path, const char *op, uint64_t bits, tune_t *t);
+
+bool tune_save(const char *path, const char *op, uint64_t bits, const tune_t *t);
+
+void tune_run(tune_t *t, mpz_t n, mpz_t e, rsa_priv_t *key);
+
+bool tune_setup(tune_t *t, const char *path, bool force, mpz_t n, mpz_t e, rsa_priv_t *key);
@@ -0,0 +1,82 @@
+#include "rsa.h"
+#include "sha256.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OPTIONS "hvi:s:n:"
+
+void help(char *exec) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "   Verifies a signature made by sign over the SHA-256 digest of a file.\n\n"
+        "USAGE\n"
+        "   %s [-hv] [-n pbfile] [-i input file] -s signature file\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -v              Display verbose program output.\n"
+        "   -i infile       Specifies the signed file (default: stdin).\n"
+        "   -s sigfile      Specifies the signature to check.\n"
+        "   -n pbfile       Public key file (default: rsa.pub).\n",
+        exec);
+}
+
+int main(int argc, char **argv) {
+    arena_install(); // BEFORE ANY GMP ALLOCATION
+    FILE *pbfile = fopen("rsa.pub", "r");
+    FILE *infile = stdin;
+    FILE *sigfile = NULL;
+    int opt = 0;
+    bool verbose = false;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'n': pbfile = fopen(optarg, "r"); break;
+        case 'i': infile = fopen(optarg, "r"); break;
+        case 's': sigfile = fopen(optarg, "r"); break;
+        case 'v': verbose = true; break;
+        case 'h': {
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+        }
+    }
+    if (pbfile == NULL || infile == NULL || sigfile == NULL) {
+        help(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // Read Public Key and the signature
+    char *username = malloc(sizeof(char) * 100);
+    mpz_t n, e, user_s, s, m;
+    mpz_inits(n, e, user_s, s, m, NULL);
+    rsa_read_pub(n, e, user_s, username, pbfile);
+    bool ok = gmp_fscanf(sigfile, "%Zx", s) == 1;
+
+    // Hash the whole file and check the signature against its encoding
+    uint8_t digest[SHA256_DIGEST] = { 0 };
+    uint64_t length = 0;
+    bool hashed = ok && sha256_file(infile, digest, &length);
+    ok = hashed && rsa_encode_digest(m, digest, n) && rsa_verify(m, s, e, n);
+
+    // If verbose, the digest only once the file was hashed
+    if (verbose) {
+        fprintf(stderr, "user = %s\n", username);
+    }
+    if (verbose && hashed) {
+        fprintf(stderr, "length = %lu bytes\nsha256 = ", length);
+        for (int i = 0; i < SHA256_DIGEST; i += 1) {
+            fprintf(stderr, "%02x", digest[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, ok ? "Signature verified.\n" : "Signature does not match.\n");
+
+    // Close files and clear any mpz_t variables used
+    mpz_clears(n, e, user_s, s, m, NULL);
+    free(username);
+    fclose(infile);
+    fclose(sigfile);
+    fclose(pbfile);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}